@@ -0,0 +1,145 @@
+#include "miniforth.h"
+
+#ifdef AOT_WORDS
+
+#ifndef __NATIVE_BUILD__
+#include <Arduino.h>
+#endif
+
+#include "helpers.h"
+#include "errors.h"
+#include "timers.h"
+#include "aot.h"
+
+int *Aot::_base = NULL;
+int *Aot::_failedAt = NULL;
+
+// The top 'count' cells of the stack, to 'cells' (if they are all there)
+bool Aot::take(int *cells, int count)
+{
+    if (Forth::_stack.depth() < unsigned(count))
+        return false;
+    for (int i = count; i-- > 0; ) {
+        cells[i] = Forth::_stack.top();
+        Forth::_stack.pop();
+    }
+    return true;
+}
+
+// ...and 'cells', up to 'sp', back to it.
+void Aot::give(int *cells, int *sp)
+{
+    for (int *p = cells; p < sp; p++)
+        Forth::_stack.push(*p);
+}
+
+CompiledNode::ExecuteResult Aot::run(
+    Body body, int *cells, int in, int out, CompiledNodes::iterator it)
+{
+    // The interpreter would have failed somewhere inside the word;
+    // we do it before we start - and leave the stack as it was.
+    if (!take(cells, in))
+        return error(
+            F("A word compiled ahead of time needs more numbers on the stack"));
+    // (A periodic word may run one of us, while we wait for it)
+    int *outerBase = _base, *outerFailedAt = _failedAt;
+    _base = cells;
+    bool ok = body(cells + in);
+    give(cells, ok ? cells + in + out : _failedAt);
+    _base = outerBase;
+    _failedAt = outerFailedAt;
+    if (!ok)
+        return FAILURE;
+    return it;
+}
+
+bool Aot::run_timers(int *sp)
+{
+    int depth = sp - _base;
+    give(_base, sp);
+    Timers::run_pending();
+    // ...and must leave our part of it alone.
+    if (!take(_base, depth)) {
+        _failedAt = _base;
+        return error(F("A periodic word changed the stack of a running word"));
+    }
+    return true;
+}
+
+bool Aot::wait(int *sp, int value, bool micro)
+{
+    if (value <= 0)
+        return true;
+    int depth = sp - _base;
+    give(_base, sp);
+    if (micro)
+        sleep_us(value);
+    else
+        sleep_ms(value);
+    if (!take(_base, depth)) {
+        _failedAt = _base;
+        return error(F("A periodic word changed the stack of a running word"));
+    }
+    return true;
+}
+
+// Like the interpreter, we leave the stack without the two operands
+bool Aot::division_by_zero(int *sp)
+{
+    _failedAt = sp;
+    return error(F("Division by zero..."));
+}
+
+// ...and without those of an @, !, C@, ... of an address outside the Pool
+bool Aot::bad_address(int *sp)
+{
+    _failedAt = sp;
+    return error(F("Address out of bounds..."));
+}
+
+void Aot::dot(int value)
+{
+    Serial.print(F(" "));
+    Forth::print_number(value, true, Forth::_dotNumberOfDigits);
+    Forth::_dotNumberOfDigits = 0;
+}
+
+void Aot::udot(int value)
+{
+    Serial.print(F(" "));
+    Forth::print_number(value, false, 0);
+}
+
+void Aot::udotR(int value)
+{
+    Forth::_dotNumberOfDigits = value;
+}
+
+void Aot::cr()
+{
+    dprintf("%s", "\n");
+}
+
+void Aot::print_string(const char *textInFlash)
+{
+    Serial.print(F(" "));
+    Serial.print(reinterpret_cast<const __FlashStringHelper *>(textInFlash));
+}
+
+// CSET, CCLEAR and CTOGGLE (see Forth::modify_byte)
+void Aot::modify_byte(int addr, int mask, bool clearMask, bool xorMask)
+{
+    volatile uint8_t *p = reinterpret_cast<volatile uint8_t *>(cell_to_ptr(addr));
+    uint8_t andBits = clearMask ? ~mask : 0xFF;
+    uint8_t xorBits = xorMask ? mask : 0;
+#ifndef __NATIVE_BUILD__
+    uint8_t sreg = SREG;
+    cli();
+#endif
+    *p = (*p & andBits) ^ xorBits;
+#ifndef __NATIVE_BUILD__
+    SREG = sreg;
+#endif
+}
+
+#endif
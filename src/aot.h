@@ -0,0 +1,56 @@
+#ifndef __AOT_H__
+#define __AOT_H__
+
+#include "miniforth.h"
+
+#ifdef AOT_WORDS
+
+// Words translated to C++ ahead of time (see src_x86/aot.cpp).
+//
+// The translator writes src/aot_words.cpp: for each word, a function
+// that works on a plain array of cells - since it knows how deep the
+// stack is at every node, each node is an access at a fixed offset -
+// and, for the ones we can call by name, an entry in c_ops (see
+// AOT_C_OPS in the generated aot_words.h). So they are as native as
+// '+' is: their bodies are code, in Flash; not CompiledNodes, in SRAM.
+//
+// What's here is what they all share: moving their cells from and to
+// the stack, and what the native words would do for them.
+class Aot {
+public:
+    typedef bool (*Body)(int *sp);
+
+    // Take 'in' cells off the stack (all must be numbers) to 'cells',
+    // run the word's body over them, and give back the 'out' it left.
+    // If the body fails, the cells it left until then go back instead.
+    static CompiledNode::ExecuteResult run(
+        Body body, int *cells, int in, int out, CompiledNodes::iterator it);
+
+    // At the end of each pass of a loop: run the periodic words, if
+    // any are due. They see the stack as it would be in the interpreter.
+    static bool run_timers(int *sp);
+    // MS and US - during which, the periodic words run, too.
+    static bool wait(int *sp, int value, bool micro);
+
+    // ...and what else the bodies call.
+    static bool division_by_zero(int *sp);
+    static bool bad_address(int *sp);
+    static void dot(int value);
+    static void udot(int value);
+    static void udotR(int value);
+    static void cr();
+    static void print_string(const char *textInFlash);
+    static void modify_byte(int addr, int mask, bool clearMask, bool xorMask);
+
+private:
+    // The cells of the running word - and where its body failed
+    static int *_base;
+    static int *_failedAt;
+
+    static bool take(int *cells, int count);
+    static void give(int *cells, int *sp);
+};
+
+#endif
+
+#endif
@@ -2,6 +2,9 @@
 #include "compiled_node.h"
 #include "helpers.h"
 #include "dassert.h"
+#include "profile_marks.h"
+#include "timers.h"
+#include "jit.h"
 
 CompiledNode::CompiledNode() {}
 
@@ -40,18 +43,18 @@ CompiledNode CompiledNode::makeVariable(DictionaryPtr dictPtr, int intVal) {
     tmp._kind = VARIABLE;
     tmp._u._variable._dictPtr = dictPtr;
 
-    tmp._u._variable._memoryPtr = &_memory[_currentMemoryOffset];
-    _currentMemoryOffset++;
-    if (_currentMemoryOffset >= MEMORY_SIZE)
-        (void) error(F("Out of memory..."));
+    // Its cell lives in the Pool, like ALLOT-ed space: so the address
+    // it pushes is a plain cell (see ptr_to_cell) that '@' and '!' -
+    // or '+', for that matter - take like any other.
+    tmp._u._variable._memoryPtr = Pool::alloc<int>();
     *tmp._u._variable._memoryPtr = intVal;
     return tmp;
 }
 
-CompiledNode CompiledNode::makeCFunction(const char *addrOfNameOfFunctionInFlash, FuncPtr funcPtr) {
+CompiledNode CompiledNode::makeCFunction(int index, FuncPtr funcPtr) {
     CompiledNode tmp;
     tmp._kind = C_FUNC;
-    tmp._u._function._addrOfNameOfFunctionInFlash = addrOfNameOfFunctionInFlash;
+    tmp._u._function._index = index;
     tmp._u._function._funcPtr = funcPtr;
     return tmp;
 }
@@ -63,10 +66,84 @@ CompiledNode CompiledNode::makeWord(DictionaryPtr dictPtr) {
     return tmp;
 }
 
+CompiledNode CompiledNode::makeXT(DictionaryPtr dictPtr, int xt) {
+    CompiledNode tmp;
+    tmp._kind = XT;
+    tmp._u._xt._dictPtr = dictPtr;
+    tmp._u._xt._xt = xt;
+    return tmp;
+}
+
+CompiledNode CompiledNode::makeDeferred(DictionaryPtr dictPtr, int xt) {
+    CompiledNode tmp = makeXT(dictPtr, xt);
+    tmp._kind = DEFERRED;
+    return tmp;
+}
+
+CompiledNode CompiledNode::makeControl(CompiledNodeType kind) {
+    CompiledNode tmp;
+    tmp._kind = kind;
+    // Until Forth::resolve_cases tells us better: no table, nowhere to go
+    tmp._u._branch._target = NULL;
+    return tmp;
+}
+
+CompiledNode CompiledNode::makeLocals(uint8_t count, uint8_t initialized) {
+    CompiledNode tmp;
+    tmp._kind = LOCALS;
+    tmp._u._locals._count = count;
+    tmp._u._locals._initialized = initialized;
+    return tmp;
+}
+
+// Reading a local (LOCAL) or storing to it (TO_LOCAL)
+CompiledNode CompiledNode::makeLocal(CompiledNodeType kind, int slot) {
+    CompiledNode tmp;
+    tmp._kind = kind;
+    tmp._u._local._slot = slot;
+    return tmp;
+}
+
+const char *CompiledNode::getWordName() {
+    // We can return the pointer to the Word stored in the
+    // DictionaryEntry. It's memory will never be gone,
+    // so it is a pointer we can just use.
+    //
+    // We deliberately placed the _dictPtr as the first field
+    // in all the structs of the _u union; so we can just
+    // call the name() method of the DictionaryEntry...
+
+    // ...except if we are a C_FUNC. In that case, there is
+    // no _dictPtr! Our name lives in Flash, in the c_ops entry
+    // we keep the index of. So we use here a bit of static
+    // space (our pre-baked native ops have small names anyway;
+    // and we do check that they fit in this buffer during
+    // reset(); see below).
+    static char nativeNameBuffer[MAX_NATIVE_COMMAND_LENGTH + 1];
+    if (_kind == C_FUNC) {
+        strncpy_P(
+            nativeNameBuffer,
+            Forth::name_of_C_op(_u._function._index),
+            sizeof(nativeNameBuffer)-1);
+        nativeNameBuffer[sizeof(nativeNameBuffer)-1] = '\0';
+        return nativeNameBuffer;
+    }
+    // We deliberately placed the _dictPtr as the first field
+    // in all the structs of the _u union; so in all other
+    // cases except a C_FUNC, just call the name method:
+    return _u._word._dictPtr->name();
+}
+
 void CompiledNode::dots() {
     switch(_kind) {
     case LITERAL:
-        dprintf("%d", _u._literal._intVal);
+        Forth::print_number(_u._literal._intVal, true, 0);
+        break;
+    case XT:
+        Forth::print_number(_u._xt._xt, true, 0);
+        break;
+    case DEFERRED:
+        Serial.print(F("DEFER"));
         break;
     case STRING:
         dprintf("%s", _u._string._strVal.c_str());
@@ -77,6 +154,29 @@ void CompiledNode::dots() {
     case WORD:
         dprintf("%s", (char *) getWordName());
         break;
+    case CASE:
+        Serial.print(F("CASE"));
+        break;
+    case OF:
+        Serial.print(F("OF"));
+        break;
+    case ENDOF:
+        Serial.print(F("ENDOF"));
+        break;
+    case ENDCASE:
+        Serial.print(F("ENDCASE"));
+        break;
+    case LOCALS:
+        Serial.print(F("{:"));
+        break;
+    case LOCAL:
+    case TO_LOCAL:
+        // Their names are long gone; all we have is the slot
+        if (_kind == TO_LOCAL)
+            Serial.print(F("TO "));
+        Serial.print(F("L"));
+        Serial.print(_u._local._slot);
+        break;
     case UNKNOWN:
         DASSERT(false, "UNKNOWN not expected in CompiledNode::dots");
         break;
@@ -88,24 +188,55 @@ CompiledNode::ExecuteResult CompiledNode::execute(CompiledNodes::iterator it)
     auto ret = Optional<CompiledNodes::iterator>(it);
     switch(_kind) {
     case LITERAL:
-        Forth::_stack.push_back(StackNode::makeNr(_u._literal._intVal));
+        Forth::_stack.push(_u._literal._intVal);
         break;
     case STRING:
         dprintf(" %s", _u._string._strVal.c_str());
         break;
     case VARIABLE:
-        Forth::_stack.push_back(StackNode::makePtr(_u._variable._dictPtr));
+        Forth::_stack.push(ptr_to_cell(_u._variable._memoryPtr));
         break;
     case CONSTANT:
-        Forth::_stack.push_back(StackNode::makeNr(_u._constant._intVal));
+        Forth::_stack.push(_u._constant._intVal);
         break;
-    case C_FUNC:
-        ret = _u._function._funcPtr(it);
+    case XT:
+        Forth::_stack.push(_u._xt._xt);
         break;
-    case WORD:
-        if(!run_full_phrase(_u._word._dictPtr->getCompiledNodes()))
-            return it;
+    case DEFERRED:
+        if (!Forth::execute_deferred(_u._xt._dictPtr, _u._xt._xt))
+            return FAILURE;
+        break;
+    case C_FUNC: {
+        PROFILE_SCOPE(MARK_NATIVE, Forth::name_of_C_op(_u._function._index));
+        COUNT_SCOPE(Forth::builtin_counter(_u._function._index));
+        FuncPtr funcPtr = _u._function._funcPtr;
+        if (_checking)
+            funcPtr = Forth::checked_variant(funcPtr);
+        ret = funcPtr(it);
         break;
+    }
+    case WORD: {
+        PROFILE_SCOPE(MARK_WORD, _u._word._dictPtr->name());
+        COUNT_SCOPE(_u._word._dictPtr->_counter);
+        if(!run_full_phrase(_u._word._dictPtr))
+            return FAILURE;
+        break;
+    }
+    case CASE:
+        return Forth::dispatch_case(_u._case._table, it);
+    case OF:
+        return Forth::of(_u._branch._target, it);
+    case ENDOF:
+        return CompiledNodes::iterator(_u._branch._target);
+    case ENDCASE:
+        return Forth::endcase(it);
+    case LOCALS:
+        return Forth::open_frame(_u._locals._count, _u._locals._initialized, it);
+    case LOCAL:
+        Forth::_stack.push(Forth::_rstack[Forth::_frame + _u._local._slot]);
+        break;
+    case TO_LOCAL:
+        return Forth::to_local(_u._local._slot, it);
     case UNKNOWN:
         break;
     }
@@ -130,14 +261,97 @@ int CompiledNode::getVariableValue()
     return *_u._variable._memoryPtr;
 }
 
-SuccessOrFailure CompiledNode::run_full_phrase(CompiledNodes& compiled_nodes)
+int *CompiledNode::getVariableAddress()
+{
+    DASSERT(_kind == VARIABLE, "getVariableAddress called on non-variable");
+    return _u._variable._memoryPtr;
+}
+
+#ifdef DISPATCH_STATS
+unsigned long CompiledNode::_dispatches = 0;
+#endif
+
+unsigned CompiledNode::_callDepth = 0;
+bool CompiledNode::_checking = false;
+
+struct NestingScope {
+    NestingScope() { CompiledNode::_callDepth++; }
+    ~NestingScope() { CompiledNode::_callDepth--; }
+};
+
+// The locals of a word live on the return stack, from where it was
+// when the word began; on the way out - however we leave - they go.
+struct FrameScope {
+    bool _active;
+    uint8_t _frame, _rdepth;
+    FrameScope(bool active):_active(active) {
+        _frame = Forth::_frame;
+        _rdepth = Forth::_rdepth;
+    }
+    ~FrameScope() {
+        if (_active) {
+            Forth::_frame = _frame;
+            Forth::_rdepth = _rdepth;
+        }
+    }
+};
+
+// A verified word skips the stack checks of its primitives - as long as
+// what it takes is there when it starts. If not, they are put back: it
+// then fails just where (and as) it would have, unverified.
+struct CheckScope {
+    bool _checking;
+    CheckScope(DictionaryPtr word) {
+        _checking = CompiledNode::_checking;
+        bool verified = word->_effect._in != StackEffect::UNVERIFIED;
+        CompiledNode::_checking = verified && !Forth::may_skip_checks(word);
+    }
+    ~CheckScope() {
+        CompiledNode::_checking = _checking;
+    }
+};
+
+SuccessOrFailure CompiledNode::run_full_phrase(DictionaryPtr word)
 {
+    CompiledNodes& compiled_nodes = word->getCompiledNodes();
+
     // The heart of the engine...
     //
+    // (When profiling, what is exclusively ours is the dispatch overhead)
+    PROFILE_SCOPE(MARK_NATIVE, F("run_full_phrase"));
+
+    // Each phrase inside a phrase takes more of the CPU stack.
+    // Runaway recursion must end in an error - not in a crash.
+    if (_callDepth >= MAX_CALL_DEPTH || !stack_has_room())
+        return error(F("Words nested too deep (see MAX_CALL_DEPTH)"));
+    if (!Pool::has_room(POOL_SAFETY_MARGIN))
+        return Forth::pool_full();
+#ifdef JIT
+    // Once we've seen it run often enough, it may run as machine code
+    switch(Jit::run(compiled_nodes)) {
+    case Jit::RAN:
+        return SUCCESS;
+    case Jit::FAILED:
+        return FAILURE;
+    case Jit::NOT_RUN:
+        break;
+    }
+#endif
+    NestingScope nesting;
+    CheckScope checks(word);
+    // {: ... :} can only come first; so that's where we look for it
+    FrameScope frame(
+        !compiled_nodes.empty() &&
+        compiled_nodes.begin()->_kind == CompiledNode::LOCALS);
+
     // Begin at the first CompiledNode in our word
     auto it = compiled_nodes.begin();
     while(it != compiled_nodes.end()) {
-        // First, deal with the IF execution stack.
+        // Between two dispatches is a safe point for the timer words
+        if (Timers::pending())
+            Timers::run_pending();
+
+        // Then, deal with the IF execution stack.
         // To support nested IF/ELSE/THEN, we need an IF stack
         // (stored in Forth::_ifStates). As we can our word's 
         // CompiledNode s, an IF will push on this; a THEN will pop.
@@ -146,27 +360,36 @@ SuccessOrFailure CompiledNode::run_full_phrase(CompiledNodes& compiled_nodes)
         // within the IF body; otherwise we allow execution of
         // CompiledNode s within the ELSE body.
         // Whether we are inside an IF or an ELSE body is coded
-        // in the class global (static) inside_IF_body, updated
-        // as we move along (see the 'execute' methods for IF/ELSE/THEN).
+        // in that same entry (_insideIfBody), updated as we
+        // move along (see the 'execute' methods for IF/ELSE/THEN).
         bool itIsTHEN = it->_kind == CompiledNode::C_FUNC && !strcasecmp_P(it->getWordName(), (PGM_P) F("THEN"));
         bool itIsELSE = it->_kind == CompiledNode::C_FUNC && !strcasecmp_P(it->getWordName(), (PGM_P) F("ELSE"));
         // Is our IF stack not empty? Then we are in code following an IF...
         // Apply IF/ELSE logic to see if we should execute the CompiledNode.
         // But *always* evaluate the ELSE/THENs, to update IF stack/state.
         if (!Forth::_ifStates.empty() && !itIsTHEN && !itIsELSE) {
-            if ((IfState::inside_IF_body && !Forth::_ifStates.begin()->wasTrue()) ||
-                (!IfState::inside_IF_body && Forth::_ifStates.begin()->wasTrue()))
+            IfState& top = *Forth::_ifStates.begin();
+            if ((top._insideIfBody && !top.wasTrue()) ||
+                (!top._insideIfBody && top.wasTrue()))
             {
                 ++it;
                 continue;
             }
 
         }
+#ifdef DISPATCH_STATS
+        _dispatches++;
+#endif
+        if (*Forth::_tracing)
+            Forth::trace(*it);
         auto ret = it->execute(it);
         // A CompiledNode may choose to tell us it failed to execute;
         // e.g. a '+' that didn't find two elements on the stack.
         if (!ret)
             return FAILURE;
+        // A push that found the stack full dropped its cell; stop there
+        if (Forth::_stack._overflowed)
+            return Forth::stack_overflow();
         // A CompiledNode may choose to tell us to change the "program counter"
         // (i.e. the iterator we are using to run through the words)
         if (it != ret.value())
@@ -7,6 +7,16 @@
 
 #include "errors.h"
 
+// What a CASE jumps through, when its OF values are dense constants:
+// the body of the OF for each value from _min on (NULL where there's
+// no such OF), and - for everything else - the default code.
+struct CaseTable {
+    int _min;
+    unsigned _count;
+    CompiledNodes::box *_default;
+    CompiledNodes::box *_targets[1]; // ..._count of them, really
+};
+
 struct CompiledNode {
 
     // The kinds of Forth constructs we support
@@ -17,7 +27,21 @@ struct CompiledNode {
         CONSTANT,
         VARIABLE,
         C_FUNC,
-        WORD
+        WORD,
+        XT,      // ['] something - pushes its execution token
+        // CASE ... v OF ... ENDOF ... ENDCASE. The jump targets are only
+        // known once the word is complete; see Forth::resolve_cases.
+        CASE,
+        OF,
+        ENDOF,
+        ENDCASE,
+        // {: a b :} - and then, reading "a" or storing via "TO a"
+        LOCALS,
+        LOCAL,
+        TO_LOCAL,
+        // The body of a DEFER-ed word: IS points it straight at a word
+        // (in _u._xt), so calling through it needs no search
+        DEFERRED
     };
 
     // Type used for C_FUNC callbacks
@@ -64,64 +88,62 @@ struct CompiledNode {
             int *_memoryPtr;
         } _variable;
         struct {
-            const char *_addrOfNameOfFunctionInFlash;
+            int _index;         // in c_ops (see Forth::C_op_at)
             FuncPtr _funcPtr;
         } _function;
         struct {
             DictionaryPtr _dictPtr;
         } _word;
+        struct {
+            DictionaryPtr _dictPtr; // NULL for natively-implemented words
+            int _xt;
+        } _xt;
+        struct {
+            CaseTable *_table;  // NULL: the OFs compare, one by one
+        } _case;
+        struct {
+            // OF: where to go if the value didn't match (past its ENDOF).
+            // ENDOF: where to go when done (past the ENDCASE).
+            CompiledNodes::box *_target;
+        } _branch;
+        struct {
+            uint8_t _count;        // slots in the frame...
+            uint8_t _initialized;  // ...the first ones taken off the stack
+        } _locals;
+        struct {
+            int _slot;             // counting from the frame's start
+        } _local;
     } _u;
 
-    const char *getWordName() {
-        // We can return the pointer to the Word stored in the
-        // DictionaryEntry. It's memory will never be gone,
-        // so it is a pointer we can just use.
-        //
-        // We deliberately placed the _dictPtr as the first field
-        // in all the structs of the _u union; so we can just
-        // call the name() method of the DictionaryEntry...
-
-        // ...except if we are a C_FUNC. In that case, there is
-        // no _dictPtr! Our name lives in Flash, and we "abuse"
-        // the _dictPtr to point to it. So we use here a bit of
-        // static space (our pre-baked native ops have small names
-        // anyway; and we do check that they fit in this buffer
-        // during reset(); see below).
-        static char nativeNameBuffer[MAX_NATIVE_COMMAND_LENGTH + 1];
-        if (_kind == C_FUNC) {
-            strncpy_P(
-                nativeNameBuffer,
-                reinterpret_cast<const char *>(_u._function._addrOfNameOfFunctionInFlash),
-                sizeof(nativeNameBuffer)-1);
-            nativeNameBuffer[sizeof(nativeNameBuffer)-1] = '\0';
-            return nativeNameBuffer;
-        }
-        // We deliberately placed the _dictPtr as the first field
-        // in all the structs of the _u union; so in all other
-        // cases except a C_FUNC, just call the name method:
-        return _u._word._dictPtr->name();
-    }
-
-    // The memory used to store things like strings/arrays
-    static int      _memory[MEMORY_SIZE];
-    static unsigned _currentMemoryOffset;
-
-    static void memory_clear() {
-        memset(_memory, 0, sizeof(_memory));
-        _currentMemoryOffset = 0;
-    };
+    const char *getWordName();
 
     CompiledNode();
     static CompiledNode makeLiteral(int intVal);
     static CompiledNode makeString(const char *p);
     static CompiledNode makeConstant(DictionaryPtr dictPtr);
     static CompiledNode makeVariable(DictionaryPtr dictPtr, int intVal);
-    static CompiledNode makeCFunction(const char *addrOfNameOfFunctionInFlash, FuncPtr funcPtr);
+    static CompiledNode makeCFunction(int index, FuncPtr funcPtr);
     static CompiledNode makeWord(DictionaryPtr dictPtr);
+    static CompiledNode makeXT(DictionaryPtr dictPtr, int xt);
+    static CompiledNode makeDeferred(DictionaryPtr dictPtr, int xt);
+    static CompiledNode makeControl(CompiledNodeType kind);
+    static CompiledNode makeLocals(uint8_t count, uint8_t initialized);
+    static CompiledNode makeLocal(CompiledNodeType kind, int slot);
     static CompiledNode makeUnknown();
 
     // This runs the complete list of words inside a word.
-    static SuccessOrFailure run_full_phrase(CompiledNodes& c);
+    static SuccessOrFailure run_full_phrase(DictionaryPtr word);
+    // ...and this is how many of them are running, one inside the other.
+    static unsigned _callDepth;
+    // Whether the innermost one is a verified word that can't skip the
+    // stack checks (see verify.cpp); its primitives must then be the
+    // checked ones.
+    static bool _checking;
+
+#ifdef DISPATCH_STATS
+    // How many CompiledNodes run_full_phrase executed (see 'make bench')
+    static unsigned long _dispatches;
+#endif
 
     // ".S" - dump the stack out
     void dots();
@@ -132,6 +154,7 @@ struct CompiledNode {
     void setConstantValue(int intVal);
     void setVariableValue(int intVal);
     int getVariableValue();
+    int *getVariableAddress();
 };
 
 #endif
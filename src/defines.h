@@ -3,9 +3,58 @@
 
 // Including null terminators
 #define MAX_LINE_LENGTH 80
-#define MAX_NATIVE_COMMAND_LENGTH 6
+// The words translated ahead of time (see src/aot.h) can have longer names
+#define AOT_MAX_NAME_LENGTH 15
+#ifdef AOT_WORDS
+#define MAX_NATIVE_COMMAND_LENGTH AOT_MAX_NAME_LENGTH
+#else
+#define MAX_NATIVE_COMMAND_LENGTH 8
+#endif
+
+// Flow control: sent right after each prompt, to grant the host
+// the credit to send us one more line (see testing/test_forth.py)
+#define XON_CHAR 0x11
+
+// Tethered mode (see src_x86/tether.cpp): input that starts with this
+// byte is not a text line, but a binary frame with a compiled word...
+#define FRAME_START 0x02
+// ...and this is how long we wait for each of the frame's bytes.
+#define FRAME_BYTE_TIMEOUT_MS 1000
+
+// The execution trace ("TRACE ON", ".TRACE") keeps the last TRACE_SIZE
+// executed CompiledNodes. .TRACE shows each with a 16-bit id, that is...
+#define TRACE_LITERAL 0xFFFF  // ...either a literal,
+#define TRACE_STRING  0xFFFE  // ...or a string,
+#define TRACE_CONTROL 0xFFFD  // ...or a CASE, OF, ENDOF or ENDCASE,
+#define TRACE_LOCAL   0xFFFC  // ...or a {: (LOCALS), or a local's read/TO,
+#define TRACE_BUILTIN 0x8000  // ...or this, ORed with the index in c_ops,
+                              // ...or the dictionary index (0 is the oldest)
+
+// Periodic words ("500 EVERY heartbeat"; see timers.h): how many can be
+// attached at once, and the queue of those that are due to run - a power
+// of two, with room for all of them (plus the one it always keeps empty).
+#define TIMER_SLOTS 4
+#define TIMER_QUEUE 8
+
+// Running out of Pool halts us (see Pool::inner_alloc). So once fewer
+// than this many bytes of it are left, we refuse - with an error - to
+// take the next input word (a name or a string of up to a line, and the
+// node and dictionary entry it makes), the next node of a frame, or to
+// nest another level (with its IF and loop states). RESET makes room.
+#define POOL_SAFETY_MARGIN (MAX_LINE_LENGTH + 16*sizeof(void *))
+
+// A CASE jumps straight to the right OF through a table, when all its OF
+// values are constants; there are at least CASE_TABLE_MIN_OFS of them;
+// and the table is at most CASE_TABLE_DENSITY times as long as their
+// count. Otherwise, its OFs compare one after the other.
+#define CASE_TABLE_MIN_OFS 3
+#define CASE_TABLE_DENSITY 2
+// ...and how deep CASEs may nest inside CASEs, in a single word.
+#define MAX_CASE_NESTING 4
 
-#define MEMORY_SIZE 4
+// The pictured numeric output buffer ("<# ... #>", and all number
+// printing): enough for a binary, negative int... plus a few HOLDs.
+#define HOLD_SIZE (8*sizeof(int) + 4)
 
 #ifndef __NATIVE_BUILD__
 
@@ -38,24 +87,110 @@
 // from 1640 to 1640+128 = 1768 bytes. Adding 280 for stack,
 // we have 2048 bytes - our total SRAM.
 //
+// FORTH_GLOBALS is what the engine itself keeps in globals - measured
+// the same way. Most of it is:
+//
+// - the data stack: DSTACK_SIZE cells (plus the floor that keeps the
+//   periodic words off the stack of the word they interrupt)
+// - the return stack: RSTACK_SIZE cells - also home to the locals'
+//   frames - and the locals' names, LOCAL_NAMES_SIZE bytes
+// - the trace: TRACE_SIZE entries, of 6 bytes each
+// - the timers: TIMER_SLOTS slots, and a queue of TIMER_QUEUE
+//
+// ...and the interpreter's own state. Everything else - the words,
+// their nodes, the variables' cells, the digits of pictured numbers -
+// is in the Pool.
+//
 // In this configuration, we therefore have...
 //
 // - 280 bytes (for our CPU stack)
-// - and 1388 bytes (for our FORTH stacks)
+// - and 1150 bytes (for the Pool: our words, and their data)
 //
-// Not bad! Lots of FORTH code can be written in 1.4K,
+// Not bad! Lots of FORTH code can be written in 1.2K,
 // so we make good use of our 2K of SRAM :-)
 
 #define ATMEGA328_MEMORY   2048
 #define STACK_SIZE         280
-#define FORTH_GLOBALS      380
+#ifdef AOT_WORDS
+// (...and 11 more, for src/aot.cpp and the longer native names)
+#define FORTH_GLOBALS      629
+#else
+#define FORTH_GLOBALS      618
+#endif
 #define POOL_SIZE (ATMEGA328_MEMORY - STACK_SIZE - FORTH_GLOBALS)
 
+// To see how deep the CPU stack really goes, use MAXSTACK (or .S)
+// after running your code: we paint the stack's space at boot, and
+// find the high-water mark of the paint (see helpers.cpp). If it stays
+// well below STACK_SIZE, shrink it - and give the bytes to the Pool.
+// Conversely, we warn once the paint left above the Pool drops below:
+#define STACK_SAFETY_MARGIN 32
+
+#define TRACE_SIZE 16
+
+// The data stack: a plain array of cells, reserved up front.
+#define DSTACK_SIZE 32
+
+// ">R" parks values here - a few per word, a few words deep;
+// and the locals ({: a b :}) of the words that are running, too.
+#define RSTACK_SIZE 12
+
+// How many locals a word may have - and how many characters
+// their names may take, all together (plus a NUL for each).
+#define MAX_LOCALS 6
+#define LOCAL_NAMES_SIZE 24
+
+// How deep words may call words (e.g. RECURSE). Each level takes CPU
+// stack, so in the AVR we also stop - cleanly - once the stack gets
+// within STACK_SAFETY_MARGIN of the Pool; whichever comes first.
+// (See also POOL_SAFETY_MARGIN, below.)
+#ifndef MAX_CALL_DEPTH
+#define MAX_CALL_DEPTH 64
+#endif
+
 #else
 
 // For x86 testing, just use 4K. Pointers and integers are much
-// bigger, so this is still a good test.
+// bigger, so this is still a good test. (The benchmarks need more;
+// see 'make bench').
+#ifndef POOL_SIZE
 #define POOL_SIZE 4096
+#endif
+
+#define TRACE_SIZE 256
+
+// (The scaling runs fill it deeper; see 'make scaling')
+#ifndef DSTACK_SIZE
+#define DSTACK_SIZE 256
+#endif
+
+#define RSTACK_SIZE 64
+
+#define MAX_LOCALS 16
+#define LOCAL_NAMES_SIZE 128
+
+#ifndef MAX_CALL_DEPTH
+#define MAX_CALL_DEPTH 10000
+#endif
+
+// On x86-64 hosts, the words that run more than once are translated to
+// machine code (see src/jit.h), at their JIT_THRESHOLD-th call. That's
+// cheap - a few microseconds; what we save is the one-off words, that
+// we type at the prompt. Build with -D NO_JIT to always interpret.
+// (The word profiler counts each node it runs; so it interprets, too.)
+#if defined(__x86_64__) && !defined(NO_JIT) && !defined(WORD_PROFILE)
+#define JIT
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 2
+#endif
+// While a translated word runs, the stack is in an array of this many
+// cells; words that could need more are left to the interpreter.
+#define JIT_STACK_CELLS 1024
+// The machine code of all the translated words, per dictionary
+#define JIT_CODE_SIZE (256*1024)
+// How deep a word's callees may go, for it to be translated
+#define JIT_MAX_NESTING 64
+#endif
 
 #define PROGMEM
 #define __FlashStringHelper char
@@ -64,6 +199,7 @@
 #define strlen_P strlen
 #define PGM_P const char *
 #define pgm_read_word_near(x) (*(x))
+#define pgm_read_byte_near(x) (*(x))
 
 #endif
 
@@ -25,12 +25,22 @@ SuccessOrFailure error(const __FlashStringHelper *msg, const __FlashStringHelper
 
 #endif
 
+#ifdef __NATIVE_BUILD__
+static unsigned errorsSoFar = 0;
+unsigned errors_so_far() { return errorsSoFar; }
+#define COUNT_ERROR() errorsSoFar++
+#else
+#define COUNT_ERROR()
+#endif
+
 SuccessOrFailure error(const char *msg) {
+    COUNT_ERROR();
     dprintf("[x] %s\n", msg);
     return FAILURE;
 }
 
 SuccessOrFailure error(const char *msg, const char *data) {
+    COUNT_ERROR();
     dprintf("[x] %s %s\n", msg, data);
     return FAILURE;
 }
@@ -32,6 +32,10 @@ SuccessOrFailure error(const __FlashStringHelper *msg);
 SuccessOrFailure error(const __FlashStringHelper *msg, const char *data);
 #ifndef __NATIVE_BUILD__
 SuccessOrFailure error(const __FlashStringHelper *msg, const __FlashStringHelper *data);
+#else
+// How many errors we reported so far; so that a host program can tell
+// if the Forth it ran complained (see src_x86/forth_vm.h).
+unsigned errors_so_far();
 #endif
 
 #endif
@@ -0,0 +1,243 @@
+#include "miniforth.h"
+#include "getline.h"
+#include "helpers.h"
+
+// Tethered mode.
+//
+// The host (see src_x86/tether.cpp) compiles ':' definitions on its side,
+// using this very same engine - against a mirror of our dictionary.
+// It then sends us the compiled bodies, already resolved, in this frame:
+//
+//   FRAME_START
+//   the length of the rest of the frame (2 bytes, LSB first)
+//   name length (1 byte), and the name itself
+//   number of CompiledNodes (varint)
+//   for each CompiledNode - in reverse order - its kind (1 byte) and...
+//       LITERAL: the value (zig-zag varint)
+//       STRING:  the length (1 byte), and the characters
+//       C_FUNC:  the index of the native word in c_ops (1 byte)
+//       WORD:    how far from the top of the dictionary it is (varint);
+//                0 is the word being defined itself (i.e. recursion)
+//       XT:      the same as WORD, or - for a native word - its negated
+//                (minus 1) c_ops index; in a zig-zag varint, to tell them
+//                apart. Execution tokens are addresses - ours, not the host's!
+//       CASE, OF, ENDOF, ENDCASE: nothing; we work out where they jump
+//                to (and the CASE tables) ourselves, once the body is in.
+//       LOCALS:  the number of locals, and of those taking initial values
+//                (1 byte each)
+//       LOCAL, TO_LOCAL: the local's slot (1 byte)
+//   checksum: the sum of all the bytes after the length (1 byte)
+//
+// Whatever goes wrong, we skip the rest of the frame (see frame_drain):
+// its bytes must not be taken for the lines that follow it.
+//
+// We link them straight into _dict: no lexing, no lookups, and
+// no string temporaries in our precious Pool.
+//
+// The nodes come in reverse, because our forward_list::push_back
+// actually pushes at the front; this way, we don't need to reverse
+// the list afterwards, like ';' has to.
+
+static unsigned char frameChecksum;
+static unsigned frameLeft;  // the bytes of the frame we haven't read yet
+
+// (Never past the end of the frame - whatever its contents say)
+static int frame_byte()
+{
+    if (!frameLeft)
+        return -1;
+    int c = get_byte();
+    if (c < 0) {
+        frameLeft = 0;
+        return -1;
+    }
+    frameLeft--;
+    frameChecksum += c;
+    return c;
+}
+
+static void frame_drain()
+{
+    while(frameLeft && get_byte() >= 0)
+        frameLeft--;
+    frameLeft = 0;
+}
+
+// Integers are sent 7 bits at a time, least significant first;
+// the top bit of each byte says "there's more".
+static Optional<unsigned> frame_varint()
+{
+    unsigned val = 0;
+    unsigned char shift = 0;
+    while(true) {
+        int c = frame_byte();
+        if (c < 0)
+            return FAILURE;
+        val |= (unsigned)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return val;
+        shift += 7;
+    }
+}
+
+// Undo the zig-zag encoding, that keeps small negatives small
+static Optional<int> frame_signed()
+{
+    auto val = frame_varint();
+    if (!val)
+        return FAILURE;
+    unsigned u = val.value();
+    return (int)(u >> 1) ^ -(int)(u & 1);
+}
+
+// Reads a byte-sized length and that many characters, into 'scratch'
+static SuccessOrFailure frame_chars(char *scratch)
+{
+    int len = frame_byte();
+    if (len < 0 || len >= MAX_LINE_LENGTH)
+        return FAILURE;
+    for(int i=0; i<len; i++) {
+        int c = frame_byte();
+        if (c < 0)
+            return FAILURE;
+        scratch[i] = (char) c;
+    }
+    scratch[len] = '\0';
+    return SUCCESS;
+}
+
+// The word that is 'distance' entries below the top of the dictionary
+static Optional<DictionaryPtr> frame_word(unsigned distance)
+{
+    auto it = Forth::_dict.begin();
+    while(distance && it != Forth::_dict.end()) {
+        ++it;
+        distance--;
+    }
+    if (it == Forth::_dict.end())
+        return FAILURE;
+    return &*it;
+}
+
+Optional<CompiledNode> Forth::receive_node(char *scratch)
+{
+    int kind = frame_byte();
+    switch(kind) {
+    case CompiledNode::LITERAL: {
+        auto val = frame_signed();
+        if (!val)
+            return FAILURE;
+        return CompiledNode::makeLiteral(val.value());
+    }
+    case CompiledNode::STRING:
+        if (!frame_chars(scratch))
+            return FAILURE;
+        return CompiledNode::makeString(scratch);
+    case CompiledNode::C_FUNC: {
+        int idx = frame_byte();
+        const BakedInCommand *pCmd = idx < 0 ? NULL : C_op_at(idx);
+        if (!pCmd)
+            return FAILURE;
+        return compile_C_op(pCmd);
+    }
+    case CompiledNode::WORD: {
+        auto distance = frame_varint();
+        if (!distance)
+            return FAILURE;
+        auto word = frame_word(distance.value());
+        if (!word)
+            return FAILURE;
+        return CompiledNode::makeWord(word.value());
+    }
+    case CompiledNode::XT: {
+        auto val = frame_signed();
+        if (!val)
+            return FAILURE;
+        int v = val.value();
+        if (v < 0) {
+            if (!C_op_at(-1 - v))
+                return FAILURE;
+            return CompiledNode::makeXT(NULL, v);
+        }
+        auto word = frame_word(v);
+        if (!word)
+            return FAILURE;
+        return CompiledNode::makeXT(word.value(), ptr_to_cell(word.value()));
+    }
+    case CompiledNode::CASE:
+    case CompiledNode::OF:
+    case CompiledNode::ENDOF:
+    case CompiledNode::ENDCASE:
+        return CompiledNode::makeControl((CompiledNode::CompiledNodeType) kind);
+    case CompiledNode::LOCALS: {
+        int count = frame_byte();
+        int initialized = frame_byte();
+        if (count <= 0 || count > MAX_LOCALS || initialized < 0 || initialized > count)
+            return FAILURE;
+        return CompiledNode::makeLocals(count, initialized);
+    }
+    case CompiledNode::LOCAL:
+    case CompiledNode::TO_LOCAL: {
+        int slot = frame_byte();
+        if (slot < 0 || slot >= MAX_LOCALS)
+            return FAILURE;
+        return CompiledNode::makeLocal((CompiledNode::CompiledNodeType) kind, slot);
+    }
+    default:
+        return FAILURE;
+    }
+}
+
+SuccessOrFailure Forth::receive_frame(char *scratch)
+{
+    int low = get_byte(), high = get_byte();
+    if (low < 0 || high < 0)
+        return error(F("Bad frame (length)..."));
+    frameLeft = low | (high << 8);
+    frameChecksum = 0;
+    if (_compiling) {
+        frame_drain();
+        return error(F("Finish defining the word, before sending frames..."));
+    }
+    if (!frame_chars(scratch) || !*scratch) {
+        frame_drain();
+        return error(F("Bad frame (name)..."));
+    }
+    auto count = frame_varint();
+    if (!count) {
+        frame_drain();
+        return error(F("Bad frame (count)..."));
+    }
+
+    if (!Pool::has_room(POOL_SAFETY_MARGIN)) {
+        frame_drain();
+        return pool_full();
+    }
+
+    // Make the dictionary entry first; so that the word can call itself.
+    _dict.push_back(DictionaryEntry(string(scratch), CompiledNodes()));
+    CompiledNodes& nodes = _dict.begin()->getCompiledNodes();
+    unsigned n = count.value();
+    bool full = false;
+    while(n) {
+        full = !Pool::has_room(POOL_SAFETY_MARGIN);
+        if (full)
+            break;
+        auto node = receive_node(scratch);
+        if (!node)
+            break;
+        nodes.push_back(node.value());
+        n--;
+    }
+    unsigned char expected = frameChecksum;
+    if (!n && frame_byte() == expected && !frameLeft &&
+            resolve_cases(nodes) && verify(&*_dict.begin()))
+        return SUCCESS;
+
+    // Undo whatever we linked so far.
+    frame_drain();
+    while(!nodes.empty())
+        nodes.pop_front();
+    _dict.pop_front();
+    return full ? pool_full() : error(F("Bad frame (body)..."));
+}
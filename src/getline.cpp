@@ -1,6 +1,7 @@
 #include <Arduino.h>
 
 #include "defines.h"
+#include "timers.h"
 
 #ifdef __NATIVE_BUILD__
 
@@ -9,24 +10,48 @@
 bool get(char *cmd)
 {
     printf("> ");
+    // Tethered uploads send us binary frames, not just text lines
+    int c = getchar();
+    if (c == FRAME_START) {
+        cmd[0] = FRAME_START;
+        cmd[1] = '\0';
+        return true;
+    }
+    if (c != EOF)
+        ungetc(c, stdin);
     bool ret = NULL != fgets(cmd, MAX_LINE_LENGTH, stdin);
     if (strlen(cmd) >= MAX_LINE_LENGTH-1) 
         puts("############################################## Too lengthy line!");
     return ret;
 }
 
+int get_byte()
+{
+    return getchar();
+}
+
 #else
 
 bool get(char *cmd)
 {
     int cmdIdx = 0;
     Serial.print("> ");
+    // We are ready for the next line - tell whoever is uploading.
+    // This way, scripts are sent at full speed, without ever overrunning
+    // our 64-byte serial RX buffer while we execute the previous line.
+    // Interactive terminals just ignore it.
+    Serial.write(XON_CHAR);
     while(1) {
         int c = Serial.read();
         if (c!=-1) {
             if (c == 8 && cmdIdx>0) {
                 Serial.print(F(" \b"));
                 cmdIdx--;
+            } else if (c == FRAME_START && cmdIdx == 0) {
+                // A tethered upload sent us a binary frame
+                cmd[0] = FRAME_START;
+                cmd[1] = '\0';
+                break;
             } else if (c == '\r') {
                 cmd[cmdIdx] = '\0';
                 break;
@@ -37,9 +62,22 @@ bool get(char *cmd)
                 else
                     Serial.print(F("\b \b"));
             }
-        }
+        } else if (Timers::pending())
+            // Nothing to read - a safe point for the timer words
+            Timers::run_pending();
     }
     return true;
 }
 
+int get_byte()
+{
+    unsigned long start = millis();
+    while(millis() - start < FRAME_BYTE_TIMEOUT_MS) {
+        int c = Serial.read();
+        if (c != -1)
+            return c;
+    }
+    return -1;
+}
+
 #endif
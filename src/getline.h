@@ -2,5 +2,6 @@
 #define __GETLINE_H__
 
 bool get(char *cmd);
+int get_byte();
 
 #endif
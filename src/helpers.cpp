@@ -4,6 +4,8 @@
 #include <stdarg.h>
 
 #include "helpers.h"
+#include "profile_marks.h"
+#include "timers.h"
 
 #ifdef __NATIVE_BUILD__
 
@@ -22,6 +24,8 @@ void flash_printf(const __FlashStringHelper *fmt, ...)
 
 void flash_printf(const __FlashStringHelper *fmt, ...)
 {
+    PROFILE_SCOPE(MARK_NATIVE, F("flash_printf"));
+
     // Steal space from the pool (temporarily)
     //
     // We need space for two reasons: one is to create a normal
@@ -51,11 +55,154 @@ void flash_printf(const __FlashStringHelper *fmt, ...)
 
 #endif
 
+#ifndef __NATIVE_BUILD__
+
+// CPU stack high-water mark.
+//
+// Between the end of our globals (_end - we have no heap) and the top
+// of the CPU stack, there's nothing but the stack growing downwards.
+// We paint all of it with a canary at boot; the deepest the stack
+// ever went is then where the paint stops being intact.
+
+#define STACK_CANARY 0xC5
+
+extern uint8_t _end;
+
+// Runs before anything else (even before the stack pointer is set up),
+// so it can only use registers.
+void stack_paint_at_boot(void) __attribute__ ((naked, used, section (".init1")));
+void stack_paint_at_boot(void)
+{
+    __asm volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "M" (STACK_CANARY));
+}
+
+// At RESET, we paint again whatever is below us; except for a few bytes,
+// that the loop below (and any interrupt) may use. So after a RESET, the
+// reported max is at least 32 bytes deeper than where we were called.
+void stack_paint()
+{
+    uint8_t *p = &_end;
+    uint8_t *limit = (uint8_t *) SP - 32;
+    while(p < limit)
+        *p++ = STACK_CANARY;
+}
+
+// How many bytes are still untouched by the stack
+static unsigned stack_untouched()
+{
+    uint8_t *p = &_end;
+    while(p <= (uint8_t *) RAMEND && *p == STACK_CANARY)
+        p++;
+    return p - &_end;
+}
+
+unsigned stack_max_depth()
+{
+    return (uint8_t *) RAMEND - &_end + 1 - stack_untouched();
+}
+
+// Can we go one word deeper? (run_full_phrase asks, before it does)
+bool stack_has_room()
+{
+    return (uint8_t *) SP - &_end > STACK_SAFETY_MARGIN;
+}
+
+// Called after each line we run: complain while there's still time.
+void stack_check()
+{
+    unsigned untouched = stack_untouched();
+    if (untouched < STACK_SAFETY_MARGIN) {
+        Serial.print(F("[x] Warning: the CPU stack came within "));
+        Serial.print(untouched);
+        Serial.print(F(" bytes of the Pool!\n"));
+    }
+}
+
+#else
+
+// The host has no paint; and plenty of stack.
+void stack_paint() {}
+unsigned stack_max_depth() { return 0; }
+void stack_check() {}
+bool stack_has_room() { return true; }
+
+#endif
+
 void memory_info(unsigned freeListTotals)
 {
 #ifndef __NATIVE_BUILD__
-    dprintf("\nStack used so far: %d/%d bytes\n",
-            RAMEND - SP, STACK_SIZE);
+    Serial.print(F("\nStack used so far: "));
+    Serial.print(RAMEND - SP);
+    Serial.print(F("/"));
+    Serial.print(STACK_SIZE);
+    Serial.print(F(" bytes (max: "));
+    Serial.print(stack_max_depth());
+    Serial.print(F(")\n"));
 #endif
     Pool::pool_stats(freeListTotals);
 }
+
+#ifndef __NATIVE_BUILD__
+
+// Waiting is a safe point for the timer words; they run meanwhile.
+void sleep_ms(unsigned ms)
+{
+    unsigned long start = millis();
+    while(millis() - start < ms)
+        if (Timers::pending())
+            Timers::run_pending();
+}
+
+// micros() moves in steps of 4 (in a 16MHz UNO) - so will we.
+void sleep_us(unsigned us)
+{
+    unsigned long start = micros();
+    while(micros() - start < us)
+        if (Timers::pending())
+            Timers::run_pending();
+}
+
+unsigned long ticks_ms()
+{
+    return millis();
+}
+
+#else
+
+#include <time.h>
+#include <errno.h>
+
+static void sleep_ns(unsigned long long ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    // Relative sleeps that get interrupted, tell us what's left.
+    // The timer ticks interrupt us; and they may have queued words.
+    while(clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+        if (Timers::pending())
+            Timers::run_pending();
+}
+
+void sleep_ms(unsigned ms) { sleep_ns(ms * 1000000ULL); }
+void sleep_us(unsigned us) { sleep_ns(us * 1000ULL); }
+
+unsigned long ticks_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+#endif
@@ -6,6 +6,19 @@
 #define dprintf(fmt, ...) flash_printf(F(fmt), __VA_ARGS__)
 
 void memory_info(unsigned freeListTotals);
+
+// The CPU stack high-water mark (in the AVR; see helpers.cpp)
+void stack_paint();
+unsigned stack_max_depth();
+void stack_check();
+bool stack_has_room();
+
+// Time: waits (that run the timer words meanwhile; see timers.h),
+// and a monotonic millisecond counter.
+void sleep_ms(unsigned ms);
+void sleep_us(unsigned us);
+unsigned long ticks_ms();
+
 void flash_printf(const __FlashStringHelper *fmt, ...);
 
 #endif
@@ -0,0 +1,1221 @@
+#include "miniforth.h"
+
+#ifdef JIT
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "helpers.h"
+#include "errors.h"
+#include "timers.h"
+#include "verify.h"
+#include "jit.h"
+
+Jit::State Jit::_state;
+int Jit::_cells[JIT_STACK_CELLS];
+
+// The record table starts this big, and doubles when 3/4 full
+#define JIT_RECORDS 64
+// How deep IF and DO may nest inside a translated word
+#define JIT_CONTROL 16
+
+///////////////////////////////////////////////////////////////////////
+// What each node does - as far as we are concerned
+///////////////////////////////////////////////////////////////////////
+
+namespace {
+
+enum Op {
+    OP_PUSH, OP_STRING, OP_FETCH_VAR, OP_STORE_VAR, OP_CALL,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD,
+    OP_EQUAL, OP_LESS, OP_GREATER, OP_AND, OP_OR, OP_XOR,
+    OP_LSHIFT, OP_RSHIFT, OP_INVERT, OP_CELLS, OP_FETCH, OP_STORE,
+    OP_DUP, OP_DROP, OP_SWAP, OP_ROT,
+    OP_DOT, OP_UDOT, OP_UDOTR, OP_CR,
+    OP_IF, OP_ELSE, OP_THEN, OP_DO, OP_LOOP, OP_I, OP_J,
+    OP_TO_R, OP_R_FROM, OP_R_FETCH,
+    OP_UNSUPPORTED
+};
+
+// The native words we know how to emit (what they take and leave is
+// in verify.cpp's table)
+const struct Builtin {
+    CompiledNode::FuncPtr _func;
+    Op _op;
+} builtins[] = {
+    { &Forth::add,     OP_ADD },
+    { &Forth::sub,     OP_SUB },
+    { &Forth::mul,     OP_MUL },
+    { &Forth::div,     OP_DIV },
+    { &Forth::mod,     OP_MOD },
+    { &Forth::equal,   OP_EQUAL },
+    { &Forth::less,    OP_LESS },
+    { &Forth::greater, OP_GREATER },
+    { &Forth::andd,    OP_AND },
+    { &Forth::orr,     OP_OR },
+    { &Forth::xorr,    OP_XOR },
+    { &Forth::lshift,  OP_LSHIFT },
+    { &Forth::rshift,  OP_RSHIFT },
+    { &Forth::invert,  OP_INVERT },
+    { &Forth::cells,   OP_CELLS },
+    { &Forth::at,      OP_FETCH },
+    { &Forth::bang,    OP_STORE },
+    { &Forth::dup,     OP_DUP },
+    { &Forth::drop,    OP_DROP },
+    { &Forth::swap,    OP_SWAP },
+    { &Forth::rot,     OP_ROT },
+    { &Forth::dot,     OP_DOT },
+    { &Forth::Udot,    OP_UDOT },
+    { &Forth::UdotR,   OP_UDOTR },
+    { &Forth::CR,      OP_CR },
+    { &Forth::iff,     OP_IF },
+    { &Forth::elsee,   OP_ELSE },
+    { &Forth::then,    OP_THEN },
+    { &Forth::doloop,  OP_DO },
+    { &Forth::loop,    OP_LOOP },
+    { &Forth::loop_I,  OP_I },
+    { &Forth::loop_J,  OP_J },
+    { &Forth::toR,     OP_TO_R },
+    { &Forth::rFrom,   OP_R_FROM },
+    { &Forth::rFetch,  OP_R_FETCH },
+};
+
+struct Step {
+    Op _op;
+    int _pops, _pushes;
+    int _value;                  // OP_PUSH
+    const void *_ptr;            // OP_STRING's text, OP_*_VAR's cell
+    CompiledNodes *_callee;      // OP_CALL
+};
+
+}
+
+// The body of a word, if it is just one node (a constant, or a variable)
+static CompiledNode *sole_node(CompiledNodes& body)
+{
+    if (body.empty() || body.begin()._p->_next)
+        return NULL;
+    return &*body.begin();
+}
+
+static bool is_builtin(CompiledNodes::iterator it, CompiledNode::FuncPtr func)
+{
+    return it._p && it->_kind == CompiledNode::C_FUNC &&
+        it->_u._function._funcPtr == func;
+}
+
+// What the node at 'it' does; and where the next one is. That's usually
+// the one after it - but a variable, and the @ or ! that follows it, are
+// one step: the cell is read or written where it is. On its own, a
+// variable just pushes its address.
+static CompiledNodes::iterator decode(CompiledNodes::iterator it, Step& step)
+{
+    CompiledNode& node = *it;
+    ++it;
+    step._op = OP_UNSUPPORTED;
+    step._pops = step._pushes = 0;
+    switch(node._kind) {
+    case CompiledNode::LITERAL:
+        step._op = OP_PUSH;
+        step._pushes = 1;
+        step._value = node._u._literal._intVal;
+        break;
+    case CompiledNode::CONSTANT:
+        step._op = OP_PUSH;
+        step._pushes = 1;
+        step._value = node._u._constant._intVal;
+        break;
+    case CompiledNode::XT:
+        step._op = OP_PUSH;
+        step._pushes = 1;
+        step._value = node._u._xt._xt;
+        break;
+    case CompiledNode::STRING:
+        step._op = OP_STRING;
+        step._ptr = node._u._string._strVal.c_str();
+        break;
+    case CompiledNode::C_FUNC: {
+        // (A verified word's primitives may be the unchecked variants;
+        // we check its cells ourselves - see run)
+        CompiledNode::FuncPtr func = Forth::checked_variant(node._u._function._funcPtr);
+        for (unsigned i = 0; i < sizeof(builtins)/sizeof(builtins[0]); i++)
+            if (builtins[i]._func == func) {
+                step._op = builtins[i]._op;
+                StackWalk::effect_of(func, step._pops, step._pushes);
+                break;
+            }
+        break;
+    }
+    case CompiledNode::WORD: {
+        CompiledNodes& body = node._u._word._dictPtr->getCompiledNodes();
+        CompiledNode *sole = sole_node(body);
+        if (sole && sole->_kind == CompiledNode::CONSTANT) {
+            step._op = OP_PUSH;
+            step._pushes = 1;
+            step._value = sole->_u._constant._intVal;
+        } else if (sole && sole->_kind == CompiledNode::VARIABLE) {
+            int *cell = sole->_u._variable._memoryPtr;
+            // (TRACE ON must reach run_full_phrase, to start tracing)
+            if (cell == Forth::_tracing)
+                break;
+            if (is_builtin(it, &Forth::at)) {
+                step._op = OP_FETCH_VAR;
+                step._pushes = 1;
+            } else if (is_builtin(it, &Forth::bang)) {
+                step._op = OP_STORE_VAR;
+                step._pops = 1;
+            } else {
+                step._op = OP_PUSH;
+                step._pushes = 1;
+                step._value = ptr_to_cell(cell);
+                break;
+            }
+            step._ptr = cell;
+            ++it;
+        } else {
+            step._op = OP_CALL;
+            step._callee = &body;
+        }
+        break;
+    }
+    default:
+        // Locals, CASE, ... and a variable's own node
+        break;
+    }
+    return it;
+}
+
+///////////////////////////////////////////////////////////////////////
+// The table of records
+///////////////////////////////////////////////////////////////////////
+
+static unsigned slot_of(CompiledNodes *nodes, unsigned capacity)
+{
+    uintptr_t p = reinterpret_cast<uintptr_t>(nodes) >> 3;
+    return unsigned(p * 2654435761u) & (capacity - 1);
+}
+
+// The record of 'nodes' - or a new one, if 'create'-ing. An insertion
+// can move all the records; don't keep pointers to them across one.
+Jit::Record *Jit::find(CompiledNodes *nodes, bool create)
+{
+    if (create && 4*(_state._count + 1) > 3*_state._capacity) {
+        unsigned capacity = _state._capacity ? 2*_state._capacity : JIT_RECORDS;
+        Record *records = static_cast<Record *>(calloc(capacity, sizeof(Record)));
+        if (!records)
+            return NULL;
+        for (unsigned i = 0; i < _state._capacity; i++) {
+            Record& old = _state._records[i];
+            if (!old._nodes)
+                continue;
+            unsigned slot = slot_of(old._nodes, capacity);
+            while (records[slot]._nodes)
+                slot = (slot + 1) & (capacity - 1);
+            records[slot] = old;
+        }
+        free(_state._records);
+        _state._records = records;
+        _state._capacity = capacity;
+    }
+    if (!_state._capacity)
+        return NULL;
+    unsigned slot = slot_of(nodes, _state._capacity);
+    while (true) {
+        Record& rec = _state._records[slot];
+        if (rec._nodes == nodes)
+            return &rec;
+        if (!rec._nodes) {
+            if (!create)
+                return NULL;
+            memset(&rec, 0, sizeof(rec));
+            rec._nodes = nodes;
+            rec._status = Record::FRESH;
+            _state._count++;
+            return &rec;
+        }
+        slot = (slot + 1) & (_state._capacity - 1);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// Analysis: the stack effect of a word - if it has a fixed one
+///////////////////////////////////////////////////////////////////////
+
+bool Jit::translate(CompiledNodes *nodes, unsigned nesting)
+{
+    Record *rec = find(nodes, true);
+    if (!rec)
+        return false;
+    switch(rec->_status) {
+    case Record::TRANSLATED:
+        return true;
+    case Record::TRANSLATING: // recursion
+    case Record::REJECTED:
+        return false;
+    }
+    if (nesting >= JIT_MAX_NESTING)
+        return false;
+    rec->_status = Record::TRANSLATING;
+
+    Record shape;
+    memset(&shape, 0, sizeof(shape));
+    bool ok = analyze(nodes, shape, nesting) && emit(nodes, shape);
+    rec = find(nodes, false);
+    if (!ok) {
+        rec->_status = Record::REJECTED;
+        return false;
+    }
+    shape._nodes = rec->_nodes;
+    shape._calls = rec->_calls;
+    shape._status = Record::TRANSLATED;
+    *rec = shape;
+    return true;
+}
+
+bool Jit::analyze(CompiledNodes *nodes, Record& shape, unsigned nesting)
+{
+    StackWalk::Control control[JIT_CONTROL];
+    StackWalk walk(control, JIT_CONTROL);
+    shape._nesting = 1;
+
+    auto it = nodes->begin();
+    while (it != nodes->end()) {
+        Step step;
+        bool isWord = it->_kind == CompiledNode::WORD;
+        it = decode(it, step);
+        if (isWord && shape._nesting < 2)
+            shape._nesting = 2;
+        if (step._op == OP_UNSUPPORTED)
+            return false;
+        if (step._op == OP_CALL) {
+            // The words we call are translated first
+            if (!translate(step._callee, nesting + 1))
+                return false;
+            Record *callee = find(step._callee, false);
+            // Inside our IF, the interpreter would apply it to
+            // the IFs of the callee too; see run_full_phrase.
+            if (callee->_touchesIf && walk._ifs)
+                return false;
+            shape._touchesIf |= callee->_touchesIf;
+            walk.call(callee->_in, callee->_out, callee->_peak);
+            if (walk._rdepth + callee->_rpeak > shape._rpeak)
+                shape._rpeak = walk._rdepth + callee->_rpeak;
+            if (callee->_nesting + 1 > shape._nesting)
+                shape._nesting = callee->_nesting + 1;
+            continue;
+        }
+        walk.apply(step._pops, step._pushes);
+
+        StackWalk::Outcome outcome = StackWalk::FINE;
+        switch(step._op) {
+        case OP_IF:
+            // Inside an IF, the interpreter can't skip an IF
+            if (walk._ifs)
+                return false;
+            outcome = walk.iff();
+            shape._touchesIf = true;
+            break;
+        case OP_ELSE:
+            outcome = walk.elsee();
+            break;
+        case OP_THEN:
+            outcome = walk.then();
+            break;
+        case OP_DO:
+            outcome = walk.doo();
+            break;
+        case OP_LOOP:
+            outcome = walk.loop();
+            break;
+        case OP_I:
+        case OP_J:
+            outcome = walk.index(step._op == OP_I ? 1 : 2);
+            break;
+        case OP_TO_R:
+            outcome = walk.toR();
+            break;
+        case OP_R_FROM:
+        case OP_R_FETCH:
+            outcome = walk.rFrom(step._op == OP_R_FETCH);
+            break;
+        default:
+            break;
+        }
+        if (outcome != StackWalk::FINE)
+            return false;
+    }
+    if (walk._loops || walk._ifs || walk._rdepth)
+        return false;
+    shape._in = -walk._lowest;
+    shape._out = walk._depth;
+    shape._peak = walk._peak;
+    shape._loops = walk._maxLoops;
+    shape._rdepth = walk._rpeak;
+    if (walk._rpeak > shape._rpeak)
+        shape._rpeak = walk._rpeak;
+    return shape._in + shape._peak <= JIT_STACK_CELLS &&
+        shape._rpeak <= RSTACK_SIZE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Emission: x86-64 machine code
+///////////////////////////////////////////////////////////////////////
+
+// rbx points past the top of the stack, in _cells; the top cell is
+// at [rbx-4]. Up to 4 of the topmost cells, though, may not be there
+// yet: they are "cached" - as constants we know, or in r8d-r11d.
+// eax, ecx and edx are for scratch. The word's frame (rbp) has two
+// slots for each level of DO (the index, and the limit) and then
+// one for each >R.
+namespace {
+
+enum Reg { EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI, R8, R9, R10, R11 };
+
+// The cached cells; [cached-1] is the top of the stack
+struct Entry {
+    bool _imm;
+    int _value;
+    int _reg;
+};
+
+// The IFs and DOs we are inside of, while emitting
+struct Block {
+    size_t _chain;               // the jumps to where it ends
+    size_t _top;                 // the DO's first instruction
+};
+
+}
+
+static uint8_t *out;
+static size_t pos;
+static size_t room;
+
+static void byte(uint8_t b)
+{
+    if (pos < room)
+        out[pos] = b;
+    pos++;
+}
+
+static void dword(uint32_t d)
+{
+    for (int i = 0; i < 4; i++)
+        byte(uint8_t(d >> (8*i)));
+}
+
+static void qword(uint64_t q)
+{
+    dword(uint32_t(q));
+    dword(uint32_t(q >> 32));
+}
+
+static void patch(size_t at, uint32_t d)
+{
+    if (at + 4 <= room)
+        memcpy(out + at, &d, 4);
+}
+
+static uint32_t peek(size_t at)
+{
+    uint32_t d = 0;
+    if (at + 4 <= room)
+        memcpy(&d, out + at, 4);
+    return d;
+}
+
+// Opcodes above 0xFF are the two-byte (0x0F ...) ones
+static void opcode(unsigned op)
+{
+    if (op > 0xFF)
+        byte(uint8_t(op >> 8));
+    byte(uint8_t(op));
+}
+
+static void rex(bool wide, int reg, int base)
+{
+    uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3);
+    if (prefix != 0x40)
+        byte(prefix);
+}
+
+// op reg, rm - as the ModRM byte has them (for "mov", "add" et al,
+// 'rm' is the destination; for "imul" and "movzx", 'reg' is)
+static void rr(unsigned op, int reg, int rm, bool wide = false)
+{
+    rex(wide, reg, rm);
+    opcode(op);
+    byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// ...and on [base + disp] (never rsp or r12 - they'd need a SIB byte)
+static void rm(unsigned op, int reg, int base, int disp, bool wide = false)
+{
+    rex(wide, reg, base);
+    opcode(op);
+    if (!disp && (base & 7) != EBP)
+        byte(((reg & 7) << 3) | (base & 7));
+    else if (disp >= -128 && disp < 128) {
+        byte(0x40 | ((reg & 7) << 3) | (base & 7));
+        byte(uint8_t(disp));
+    } else {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        dword(uint32_t(disp));
+    }
+}
+
+// ...and on [rax + rcx]
+static void rm_indexed(unsigned op, int reg)
+{
+    rex(false, reg, EAX);
+    opcode(op);
+    byte(0x04 | ((reg & 7) << 3));
+    byte(0x08);
+}
+
+static void mov_imm(int reg, int value)
+{
+    rex(false, 0, reg);
+    byte(0xB8 + (reg & 7));
+    dword(uint32_t(value));
+}
+
+static void mov_imm64(int reg, const void *p)
+{
+    rex(true, 0, reg);
+    byte(0xB8 + (reg & 7));
+    qword(reinterpret_cast<uintptr_t>(p));
+}
+
+static void call_abs(const void *function)
+{
+    mov_imm64(EAX, function);
+    byte(0xFF);
+    byte(0xD0);
+}
+
+static void leave_with(int result)
+{
+    if (result)
+        mov_imm(EAX, result);
+    else
+        rr(0x31, EAX, EAX);
+    byte(0xC9);
+    byte(0xC3);
+}
+
+// A jump forward, to where we don't know yet. Until we do, the
+// displacements of all such jumps to the same place form a chain.
+#define JMP 0xE9
+#define JZ  0x0F84
+#define JGE 0x0F8D
+#define JA  0x0F87
+
+static void jump(unsigned op, size_t& chain)
+{
+    opcode(op);
+    size_t at = pos;
+    dword(uint32_t(chain));
+    chain = at;
+}
+
+// ...which is here
+static void land(size_t& chain)
+{
+    while (chain && chain + 4 <= room) {
+        size_t next = peek(chain);
+        patch(chain, uint32_t(pos - (chain + 4)));
+        chain = next;
+    }
+    chain = 0;
+}
+
+static void jump_back(unsigned op, size_t target)
+{
+    opcode(op);
+    dword(uint32_t(target - (pos + 4)));
+}
+
+#define CACHED 4
+static Entry cache[CACHED];
+static int cached;
+
+static int free_reg()
+{
+    for (int reg = R8; reg <= R11; reg++) {
+        bool used = false;
+        for (int i = 0; i < cached; i++)
+            used |= !cache[i]._imm && cache[i]._reg == reg;
+        if (!used)
+            return reg;
+    }
+    DASSERT(false, "No register left for the JIT");
+    return EAX;
+}
+
+// Store all cached cells but the top 'keep' ones
+static void flush(int keep)
+{
+    int n = cached - keep;
+    if (n <= 0)
+        return;
+    for (int i = 0; i < n; i++) {
+        if (cache[i]._imm) {
+            rm(0xC7, 0, EBX, 4*i);
+            dword(uint32_t(cache[i]._value));
+        } else
+            rm(0x89, cache[i]._reg, EBX, 4*i);
+    }
+    rr(0x83, 0, EBX, true); // add rbx, 4*n
+    byte(uint8_t(4*n));
+    memmove(cache, cache + n, keep * sizeof(Entry));
+    cached = keep;
+}
+
+// Have (at least) the top 'count' cells cached
+static void ensure(int count)
+{
+    int n = count - cached;
+    if (n <= 0)
+        return;
+    memmove(cache + n, cache, cached * sizeof(Entry));
+    for (int i = 0; i < n; i++)
+        cache[i]._imm = true;
+    cached += n;
+    for (int i = 0; i < n; i++) {
+        int reg = free_reg();
+        cache[i]._imm = false;
+        cache[i]._reg = reg;
+        rm(0x8B, reg, EBX, -4*(n - i));
+    }
+    rr(0x83, 5, EBX, true); // sub rbx, 4*n
+    byte(uint8_t(4*n));
+}
+
+// ...and in a register
+static int to_reg(int i)
+{
+    if (cache[i]._imm) {
+        int reg = free_reg();
+        mov_imm(reg, cache[i]._value);
+        cache[i]._imm = false;
+        cache[i]._reg = reg;
+    }
+    return cache[i]._reg;
+}
+
+static void push_imm(int value)
+{
+    if (cached == CACHED)
+        flush(CACHED - 1);
+    cache[cached]._imm = true;
+    cache[cached]._value = value;
+    cached++;
+}
+
+// A new top of the stack, in a register - which is returned
+static int push_reg()
+{
+    if (cached == CACHED)
+        flush(CACHED - 1);
+    int reg = free_reg();
+    cache[cached]._imm = false;
+    cache[cached]._reg = reg;
+    cached++;
+    return reg;
+}
+
+// The top of the stack to a register (for a call, typically)
+static void pop_to(int reg)
+{
+    ensure(1);
+    Entry& top = cache[--cached];
+    if (top._imm)
+        mov_imm(reg, top._value);
+    else
+        rr(0x89, top._reg, reg);
+}
+
+// 'dst' op= 'src' - for op as in "add r/m32, r32"; 'digit' is
+// its "81 /digit" immediate form
+static void alu(unsigned op, int digit, int dst, const Entry& src)
+{
+    if (src._imm) {
+        rr(0x81, digit, dst);
+        dword(uint32_t(src._value));
+    } else
+        rr(op, src._reg, dst);
+}
+
+// a op b, both known: that's a constant. (Or not, when it
+// has to go through the errors of the real thing)
+static bool fold(Op op, int a, int b, int& result)
+{
+    unsigned ua = unsigned(a), ub = unsigned(b);
+    switch(op) {
+    case OP_ADD:     result = int(ua + ub); return true;
+    case OP_SUB:     result = int(ua - ub); return true;
+    case OP_MUL:     result = int(ua * ub); return true;
+    case OP_AND:     result = a & b; return true;
+    case OP_OR:      result = a | b; return true;
+    case OP_XOR:     result = a ^ b; return true;
+    case OP_EQUAL:   result = a == b; return true;
+    case OP_LESS:    result = a < b; return true;
+    case OP_GREATER: result = a > b; return true;
+    case OP_LSHIFT:  result = ub < 8*sizeof(int) ? int(ua << ub) : 0; return true;
+    case OP_RSHIFT:  result = ub < 8*sizeof(int) ? int(ua >> ub) : 0; return true;
+    case OP_DIV:
+    case OP_MOD:
+        if (!b || (a == INT_MIN && b == -1))
+            return false;
+        result = op == OP_DIV ? a / b : a % b;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ( a b -- a op b )
+static void binary(Op op, size_t& divChain)
+{
+    ensure(2);
+    Entry& a = cache[cached - 2];
+    Entry b = cache[cached - 1];
+    int result;
+    if (a._imm && b._imm && fold(op, a._value, b._value, result)) {
+        cached -= 2;
+        push_imm(result);
+        return;
+    }
+    if (op == OP_DIV || op == OP_MOD) {
+        // If it fails, the stack must be as the interpreter leaves it:
+        // without these two - but with all the rest.
+        flush(2);
+        for (int i = 0; i < 2; i++) {
+            int reg = i ? ECX : EAX;
+            if (cache[i]._imm)
+                mov_imm(reg, cache[i]._value);
+            else
+                rr(0x89, cache[i]._reg, reg);
+        }
+        rr(0x85, ECX, ECX);
+        jump(JZ, divChain);
+        byte(0x99);             // cdq
+        rr(0xF7, 7, ECX);       // idiv ecx
+        cached = 0;
+        rr(0x89, op == OP_DIV ? EAX : EDX, push_reg());
+        return;
+    }
+    if ((op == OP_LSHIFT || op == OP_RSHIFT) && b._imm) {
+        cached--;
+        if (unsigned(b._value) >= 8*sizeof(int)) {
+            cached--;
+            push_imm(0);
+        } else {
+            rr(0xC1, op == OP_LSHIFT ? 4 : 5, to_reg(cached - 1));
+            byte(uint8_t(b._value));
+        }
+        return;
+    }
+    int dst = to_reg(cached - 2);
+    cached--;
+    switch(op) {
+    case OP_ADD: alu(0x01, 0, dst, b); break;
+    case OP_SUB: alu(0x29, 5, dst, b); break;
+    case OP_AND: alu(0x21, 4, dst, b); break;
+    case OP_OR:  alu(0x09, 1, dst, b); break;
+    case OP_XOR: alu(0x31, 6, dst, b); break;
+    case OP_MUL:
+        if (b._imm) {
+            rr(0x69, dst, dst);
+            dword(uint32_t(b._value));
+        } else
+            rr(0x0FAF, dst, b._reg);
+        break;
+    case OP_EQUAL:
+    case OP_LESS:
+    case OP_GREATER:
+        alu(0x39, 7, dst, b);
+        // setcc al; movzx dst, al
+        opcode(op == OP_EQUAL ? 0x0F94 : op == OP_LESS ? 0x0F9C : 0x0F9F);
+        byte(0xC0);
+        rr(0x0FB6, dst, EAX);
+        break;
+    case OP_LSHIFT:
+    case OP_RSHIFT: {
+        // Shifting by 32 or more gives 0 (for x86, it's modulo 32)
+        rr(0x89, b._reg, ECX);
+        rr(0xD3, op == OP_LSHIFT ? 4 : 5, dst);
+        rr(0x83, 7, ECX);       // cmp ecx, 32
+        byte(32);
+        byte(0x72);             // jb past the xor
+        size_t at = pos;
+        byte(0);
+        rr(0x31, dst, dst);
+        if (at < room)
+            out[at] = uint8_t(pos - (at + 1));
+        break;
+    }
+    default:
+        DASSERT(false, "Not a binary operation");
+    }
+}
+
+// rax + rcx = the address of cell 'reg' (the index of a byte in the
+// Pool, whose start is at 'origin')
+static void pool_address(char **origin, int reg)
+{
+    mov_imm64(EAX, origin);
+    rm(0x8B, EAX, EAX, 0, true);        // mov rax, [rax]
+    rr(0x63, ECX, reg, true);           // movsxd rcx, reg
+}
+
+// ...and fail (to 'chain') unless [rax + rcx] has a cell's room in it.
+// So the failure leaves the stack as the interpreter does, 'flush'
+// all but the operands first.
+static void check_address(size_t *size, size_t& chain)
+{
+    mov_imm64(EDX, size);
+    rm(0x8B, EDX, EDX, 0, true);        // mov rdx, [rdx]
+    rr(0x83, 5, EDX, true);             // sub rdx, 4
+    byte(uint8_t(sizeof(int)));
+    rr(0x39, EDX, ECX, true);           // cmp rcx, rdx
+    jump(JA, chain);
+}
+
+static int slot(int n)
+{
+    return -8*(n + 1);
+}
+
+bool Jit::emit(CompiledNodes *nodes, Record& shape)
+{
+    out = _state._code;
+    room = JIT_CODE_SIZE;
+    size_t start = pos = _state._codeUsed;
+    cached = 0;
+    size_t failChain = 0, divChain = 0, addrChain = 0, timerChain = 0;
+    Block control[JIT_CONTROL];
+    int nested = 0, loops = 0, rdepth = 0;
+
+    byte(0x55);                         // push rbp
+    rr(0x89, ESP, EBP, true);           // mov rbp, rsp
+    int frame = (8*(2*shape._loops + shape._rdepth) + 15) & ~15;
+    if (frame) {
+        rr(0x81, 5, ESP, true);         // sub rsp, frame
+        dword(uint32_t(frame));
+    }
+
+    auto it = nodes->begin();
+    while (it != nodes->end()) {
+        Step step;
+        it = decode(it, step);
+        Block *c = nested ? &control[nested - 1] : NULL;
+        switch(step._op) {
+        case OP_PUSH:
+            push_imm(step._value);
+            break;
+        case OP_STRING:
+            flush(0);
+            mov_imm64(EDI, step._ptr);
+            call_abs(reinterpret_cast<const void *>(&Jit::print_string));
+            break;
+        case OP_FETCH_VAR: {
+            int reg = push_reg();
+            mov_imm64(EAX, step._ptr);
+            rm(0x8B, reg, EAX, 0);
+            break;
+        }
+        case OP_STORE_VAR:
+            ensure(1);
+            mov_imm64(EAX, step._ptr);
+            rm(0x89, to_reg(cached - 1), EAX, 0);
+            cached--;
+            break;
+        case OP_CALL: {
+            flush(0);
+            Record *callee = find(step._callee, false);
+            byte(0xE8);
+            dword(uint32_t(callee->_code - (pos + 4)));
+            rr(0x85, EAX, EAX);
+            jump(JZ, failChain);
+            break;
+        }
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+        case OP_EQUAL: case OP_LESS: case OP_GREATER:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_LSHIFT: case OP_RSHIFT:
+            binary(step._op, divChain);
+            break;
+        case OP_INVERT:
+        case OP_CELLS:
+            ensure(1);
+            if (cache[cached - 1]._imm) {
+                int& value = cache[cached - 1]._value;
+                value = step._op == OP_INVERT ? ~value : int(unsigned(value) * sizeof(int));
+            } else if (step._op == OP_INVERT)
+                rr(0xF7, 2, cache[cached - 1]._reg);
+            else {
+                rr(0xC1, 4, cache[cached - 1]._reg);
+                byte(2);
+            }
+            break;
+        case OP_FETCH: {
+            ensure(1);
+            flush(1);
+            int reg = to_reg(cached - 1);
+            pool_address(&Pool::pool_data, reg);
+            check_address(&Pool::pool_size, addrChain);
+            rm_indexed(0x8B, reg);
+            break;
+        }
+        case OP_STORE: {
+            ensure(2);
+            flush(2);
+            int value = to_reg(cached - 2);
+            pool_address(&Pool::pool_data, to_reg(cached - 1));
+            check_address(&Pool::pool_size, addrChain);
+            rm_indexed(0x89, value);
+            cached -= 2;
+            break;
+        }
+        case OP_DUP: {
+            ensure(1);
+            if (cached == CACHED)
+                flush(CACHED - 1);
+            Entry top = cache[cached - 1];
+            if (top._imm)
+                push_imm(top._value);
+            else
+                rr(0x89, top._reg, push_reg());
+            break;
+        }
+        case OP_DROP:
+            if (cached)
+                cached--;
+            else {
+                rr(0x83, 5, EBX, true);
+                byte(4);
+            }
+            break;
+        case OP_SWAP: {
+            ensure(2);
+            Entry tmp = cache[cached - 1];
+            cache[cached - 1] = cache[cached - 2];
+            cache[cached - 2] = tmp;
+            break;
+        }
+        case OP_ROT: {
+            ensure(3);
+            Entry tmp = cache[cached - 3];
+            cache[cached - 3] = cache[cached - 2];
+            cache[cached - 2] = cache[cached - 1];
+            cache[cached - 1] = tmp;
+            break;
+        }
+        case OP_DOT:
+        case OP_UDOT:
+        case OP_UDOTR:
+            pop_to(EDI);
+            flush(0);
+            call_abs(
+                step._op == OP_DOT ? reinterpret_cast<const void *>(&Jit::dot) :
+                step._op == OP_UDOT ? reinterpret_cast<const void *>(&Jit::udot) :
+                reinterpret_cast<const void *>(&Jit::udotR));
+            break;
+        case OP_CR:
+            flush(0);
+            call_abs(reinterpret_cast<const void *>(&Jit::cr));
+            break;
+        case OP_IF: {
+            ensure(1);
+            int flag = to_reg(cached - 1);
+            cached--;
+            flush(0);
+            rr(0x85, flag, flag);
+            c = &control[nested++];
+            c->_chain = 0;
+            jump(JZ, c->_chain);
+            break;
+        }
+        case OP_ELSE: {
+            flush(0);
+            size_t end = 0;
+            jump(JMP, end);
+            land(c->_chain);
+            c->_chain = end;
+            break;
+        }
+        case OP_THEN:
+            flush(0);
+            land(c->_chain);
+            nested--;
+            break;
+        case OP_DO: {
+            ensure(2);
+            loops++;
+            // ( limit index -- )
+            for (int i = 0; i < 2; i++) {
+                Entry& e = cache[cached - 1 - i];
+                int at = slot(2*(loops - 1) + i);
+                if (e._imm) {
+                    rm(0xC7, 0, EBP, at);
+                    dword(uint32_t(e._value));
+                } else
+                    rm(0x89, e._reg, EBP, at);
+            }
+            cached -= 2;
+            flush(0);
+            c = &control[nested++];
+            c->_chain = 0;
+            c->_top = pos;
+            break;
+        }
+        case OP_LOOP: {
+            flush(0);
+            int index = slot(2*(loops - 1)), limit = slot(2*(loops - 1) + 1);
+            rm(0x8B, EAX, EBP, index);
+            rr(0x83, 0, EAX);           // add eax, 1
+            byte(1);
+            rm(0x89, EAX, EBP, index);
+            rm(0x3B, EAX, EBP, limit);  // cmp eax, limit
+            jump(JGE, c->_chain);
+            // Between two passes is a safe point for the timer words
+            mov_imm64(EAX, const_cast<uint8_t *>(&Timers::_head));
+            rm(0x0FB6, ECX, EAX, 0);    // movzx ecx, byte [rax]
+            mov_imm64(EDX, const_cast<uint8_t *>(&Timers::_tail));
+            rm(0x3A, ECX, EDX, 0);      // cmp cl, [rdx]
+            jump_back(JZ, c->_top);
+            rr(0x89, EBX, EDI, true);   // mov rdi, rbx
+            call_abs(reinterpret_cast<const void *>(&Jit::run_timers));
+            rr(0x85, EAX, EAX, true);
+            jump(JZ, timerChain);
+            rr(0x89, EAX, EBX, true);   // mov rbx, rax
+            jump_back(JMP, c->_top);
+            land(c->_chain);
+            nested--;
+            loops--;
+            break;
+        }
+        case OP_I:
+        case OP_J:
+            rm(0x8B, push_reg(), EBP, slot(2*(loops - (step._op == OP_I ? 1 : 2))));
+            break;
+        case OP_TO_R: {
+            ensure(1);
+            Entry& e = cache[cached - 1];
+            int at = slot(2*shape._loops + rdepth++);
+            if (e._imm) {
+                rm(0xC7, 0, EBP, at);
+                dword(uint32_t(e._value));
+            } else
+                rm(0x89, e._reg, EBP, at);
+            cached--;
+            break;
+        }
+        case OP_R_FROM:
+        case OP_R_FETCH:
+            if (step._op == OP_R_FROM)
+                rdepth--;
+            rm(0x8B, push_reg(), EBP,
+               slot(2*shape._loops + rdepth - (step._op == OP_R_FETCH)));
+            break;
+        case OP_UNSUPPORTED:
+            return false;
+        }
+    }
+    flush(0);
+    leave_with(1);
+
+    land(failChain);
+    leave_with(0);
+    if (divChain) {
+        land(divChain);
+        call_abs(reinterpret_cast<const void *>(&Jit::division_by_zero));
+        leave_with(0);
+    }
+    if (addrChain) {
+        land(addrChain);
+        call_abs(reinterpret_cast<const void *>(&Jit::bad_address));
+        leave_with(0);
+    }
+    if (timerChain) {
+        // (run_timers left the whole stack in the list)
+        land(timerChain);
+        mov_imm64(EBX, _cells);
+        leave_with(0);
+    }
+
+    if (pos > room)
+        return false;
+    shape._code = start;
+    _state._codeUsed = pos;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Running
+///////////////////////////////////////////////////////////////////////
+
+// Our way in from C++: with the stack pointer (rbx) in and out of
+// 'sp'; and r12 to remember where that is.
+typedef int (*Entrance)(void *code, int **sp);
+static const uint8_t entrance[] = {
+    0x53,                       // push rbx
+    0x41, 0x54,                 // push r12
+    0x48, 0x83, 0xEC, 0x08,     // sub rsp, 8
+    0x49, 0x89, 0xF4,           // mov r12, rsi
+    0x49, 0x8B, 0x1C, 0x24,     // mov rbx, [r12]
+    0xFF, 0xD7,                 // call rdi
+    0x49, 0x89, 0x1C, 0x24,     // mov [r12], rbx
+    0x48, 0x83, 0xC4, 0x08,     // add rsp, 8
+    0x41, 0x5C,                 // pop r12
+    0x5B,                       // pop rbx
+    0xC3                        // ret
+};
+
+// The code can be written, or run; never both at the same time
+bool Jit::writable(bool yes)
+{
+    State& state = _state;
+    if (!state._code) {
+        void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+            state._broken = true;
+            return false;
+        }
+        state._code = static_cast<uint8_t *>(code);
+        memcpy(state._code, entrance, sizeof(entrance));
+        state._codeUsed = sizeof(entrance);
+    }
+    if (mprotect(state._code, JIT_CODE_SIZE,
+                 yes ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC)) {
+        state._broken = true;
+        return false;
+    }
+    return true;
+}
+
+Jit::Outcome Jit::run(CompiledNodes& nodes)
+{
+    // (Tracing records every node; only the interpreter can do that)
+
+    if (*Forth::_tracing || _state._broken)
+        return NOT_RUN;
+    Record *rec = find(&nodes, true);
+    if (!rec)
+        return NOT_RUN;
+    if (rec->_status != Record::TRANSLATED) {
+        if (rec->_status != Record::FRESH || ++rec->_calls < JIT_THRESHOLD)
+            return NOT_RUN;
+        bool translated = writable(true) && translate(&nodes, 0);
+        if (!writable(false) || !translated)
+            return NOT_RUN;
+        rec = find(&nodes, false);
+    }
+    // Where the interpreter would complain, let it do so
+    if (CompiledNode::_callDepth + rec->_nesting > MAX_CALL_DEPTH ||
+            Forth::_rdepth + rec->_rpeak > RSTACK_SIZE ||
+            (rec->_touchesIf && !Forth::_ifStates.empty()) ||
+            !take(rec->_in))
+        return NOT_RUN;
+    int *sp = _cells + rec->_in;
+    Entrance enter = reinterpret_cast<Entrance>(_state._code);
+    bool ok = enter(_state._code + rec->_code, &sp);
+    give(sp);
+    return ok ? RAN : FAILED;
+}
+
+bool Jit::take(int count)
+{
+    if (Forth::_stack.depth() < unsigned(count))
+        return false;
+    for (int i = count; i-- > 0; ) {
+        _cells[i] = Forth::_stack.top();
+        Forth::_stack.pop();
+    }
+    return true;
+}
+
+void Jit::give(int *sp)
+{
+    for (int *p = _cells; p < sp; p++)
+        Forth::_stack.push(*p);
+}
+
+void Jit::clear()
+{
+    if (_state._records)
+        memset(_state._records, 0, _state._capacity * sizeof(Record));
+    _state._count = 0;
+    if (_state._code)
+        _state._codeUsed = sizeof(entrance);
+}
+
+void Jit::release(State& state)
+{
+    free(state._records);
+    if (state._code)
+        munmap(state._code, JIT_CODE_SIZE);
+    state = State();
+}
+
+///////////////////////////////////////////////////////////////////////
+// What the code calls - doing what the native words do
+///////////////////////////////////////////////////////////////////////
+
+int *Jit::run_timers(int *sp)
+{
+    // The timer words see the stack as it would be in the interpreter...
+    int depth = sp - _cells;
+    give(sp);
+    Timers::run_pending();
+    // ...and must leave our part of it alone.
+    if (!take(depth)) {
+        (void) error(F("A periodic word changed the stack of a running word"));
+        return NULL;
+    }
+    return _cells + depth;
+}
+
+void Jit::dot(int value)
+{
+    Serial.print(F(" "));
+    Forth::print_number(value, true, Forth::_dotNumberOfDigits);
+    Forth::_dotNumberOfDigits = 0;
+}
+
+void Jit::udot(int value)
+{
+    Serial.print(F(" "));
+    Forth::print_number(value, false, 0);
+}
+
+void Jit::udotR(int value)
+{
+    Forth::_dotNumberOfDigits = value;
+}
+
+void Jit::cr()
+{
+    dprintf("%s", "\n");
+}
+
+void Jit::print_string(const char *text)
+{
+    dprintf(" %s", text);
+}
+
+void Jit::division_by_zero()
+{
+    (void) error(F("Division by zero..."));
+}
+
+void Jit::bad_address()
+{
+    (void) error(F("Address out of bounds..."));
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "miniforth.h"
+
+#ifdef JIT
+
+// The host's JIT (x86-64 only; see JIT_THRESHOLD in defines.h).
+//
+// Once a word has been called JIT_THRESHOLD times, we try to translate
+// its CompiledNodes into machine code; and from then on, run_full_phrase
+// calls that instead of walking them. Inside it, the top cells of the
+// stack live in registers, the built-in arithmetic is a few instructions
+// inline, DO/LOOP is a native loop - and other words are direct calls.
+//
+// Only what we can prove things about is translated: we must know, for
+// each node, how deep the stack is (so IF/ELSE must leave it the same
+// either way, and each pass of a loop too), and the word mustn't depend
+// on anything that its caller left behind - a DO (for its I), or a >R.
+// Anything else - locals, CASE, EXECUTE, RECURSE, the words we don't
+// know how to emit - and the word stays with the interpreter. As do the
+// ones that call it.
+//
+// A translated word's DO/LOOPs let the periodic words run at the end of
+// each pass - not between any two nodes, as the interpreter does. And a
+// word with an IF is left to the interpreter while another word's IF is
+// pending (see run_full_phrase: that one would skip parts of ours, too).
+//
+// Before it runs, the cells a translated word needs are checked once:
+// if they aren't all there, the interpreter runs it instead; it would
+// complain as it always did. Past that check, a word can only
+// fail by dividing by zero.
+class Jit {
+public:
+    // What run() did: ran the word (and how that went), or nothing
+    enum Outcome { NOT_RUN, RAN, FAILED };
+    static Outcome run(CompiledNodes& nodes);
+
+    // Forget all the translations (RESET)
+    static void clear();
+
+    // What we know about a word
+    struct Record {
+        CompiledNodes *_nodes;   // NULL in a free slot of the table
+        unsigned _calls;
+        enum Status { FRESH, TRANSLATING, TRANSLATED, REJECTED };
+        uint8_t _status;
+        bool _touchesIf;         // runs an IF (see translate)
+        uint8_t _loops;          // how deep its DOs nest...
+        uint8_t _rdepth;         // ...and its >Rs go;
+        uint8_t _rpeak;          // ...also counting those of its callees,
+        uint8_t _nesting;        // ...and how deep it calls words.
+        int _in;                 // the cells it takes,
+        int _out;                // how many more it leaves than it took,
+        int _peak;               // and the most it ever adds, meanwhile
+        size_t _code;            // where it is in State::_code
+    };
+
+    // All of it is per-dictionary (so each ForthVM has its own; see
+    // src_x86/forth_vm.h). Nothing is allocated until it is needed.
+    struct State {
+        Record *_records;        // open addressing, by _nodes
+        unsigned _capacity;
+        unsigned _count;
+        uint8_t *_code;          // JIT_CODE_SIZE bytes, mmap-ed
+        size_t _codeUsed;
+        bool _broken;            // no memory for it; don't try again
+        State():_records(NULL), _capacity(0), _count(0),
+                _code(NULL), _codeUsed(0), _broken(false) {}
+    };
+    static void release(State& state);
+
+private:
+    friend class ForthVM;
+    static State _state;
+
+    // While translated words run, the stack is here - not in the list.
+    static int _cells[JIT_STACK_CELLS];
+
+    static Record *find(CompiledNodes *nodes, bool create);
+    static bool translate(CompiledNodes *nodes, unsigned nesting);
+    static bool analyze(CompiledNodes *nodes, Record& shape, unsigned nesting);
+    static bool emit(CompiledNodes *nodes, Record& shape);
+    static bool writable(bool yes);
+
+    // The top 'count' cells of the stack, to _cells (if all are numbers)
+    static bool take(int count);
+    // ...and _cells, up to 'sp', back to it.
+    static void give(int *sp);
+
+    // What the translated code calls
+    static int *run_timers(int *sp);
+    static void dot(int value);
+    static void udot(int value);
+    static void udotR(int value);
+    static void cr();
+    static void print_string(const char *text);
+    static void division_by_zero();
+    static void bad_address();
+};
+
+#endif
+
+#endif
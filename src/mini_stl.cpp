@@ -1,8 +1,14 @@
-#include "stack_node.h"
+#include "miniforth.h"
 #include "compiled_node.h"
 
 #include "mini_stl.h"
 #include "defines.h"
 
+#ifdef __NATIVE_BUILD__
+static char defaultPool[POOL_SIZE];
+char *Pool::pool_data = defaultPool;
+size_t Pool::pool_size = POOL_SIZE;
+#else
 char Pool::pool_data[POOL_SIZE];
+#endif
 size_t Pool::pool_offset = 0;
@@ -2,9 +2,11 @@
 #define __MINI_STL_H__
 
 #include <string.h>
+#include <stdint.h>
 
 #include "dassert.h"
 #include "defines.h"
+#include "profile_marks.h"
 
 extern void dprintf(const char *fmt, ...);
 
@@ -31,15 +33,31 @@ tuple<T1, T2> make_tuple(const T1& t1, const T2& t2)
 
 // My own "heap". Calling this a heap is blasphemy, but oh well :-)
 class Pool {
+#ifdef __NATIVE_BUILD__
+    // In the host, a ForthVM brings a Pool of its own (see src_x86/forth_vm.h)
+    static char *pool_data;
+    static size_t pool_size;
+    friend class ForthVM;
+#ifdef JIT
+    friend class Jit; // its code reads pool_data (see jit.cpp)
+#endif
+#else
     static char pool_data[POOL_SIZE];
+    static const size_t pool_size = POOL_SIZE;
+#endif
 public:
+    static char *origin() { return pool_data; }
+    static size_t size() { return pool_size; }
     static size_t pool_offset;
     static void clear() {
-        memset(pool_data, 0, sizeof(pool_data));
+        memset(pool_data, 0, pool_size);
         pool_offset = 0;
     }
+    static bool has_room(size_t size) {
+        return pool_offset + size < pool_size;
+    }
     static void *inner_alloc(size_t size) {
-        DASSERT(pool_offset < sizeof(pool_data) - size, "Out of heap...");
+        DASSERT(pool_offset < pool_size - size, "Out of heap...");
         void *ptr = reinterpret_cast<void*>(&pool_data[pool_offset]);
         pool_offset += size;
         return ptr;
@@ -57,11 +75,39 @@ public:
         Serial.print(F("Pool  used so far: "));
         Serial.print((long unsigned int)Pool::pool_offset - freeListTotals);
         Serial.print(F("/"));
-        Serial.print((long unsigned int)sizeof(Pool::pool_data));
+        Serial.print((long unsigned int)Pool::pool_size);
         Serial.print(F(" bytes"));
     }
 };
 
+// Forth cells may hold addresses - e.g. "$25 @", or what "#>" leaves.
+// In the AVR, an int can hold any SRAM address as-is. In the host,
+// pointers are twice as big as ints; so there, addresses are stored
+// as offsets from our Pool - which is near everything we point to.
+#ifdef __NATIVE_BUILD__
+inline int ptr_to_cell(const void *p) {
+    return (int)(reinterpret_cast<const char *>(p) - Pool::origin());
+}
+inline void *cell_to_ptr(int cell) {
+    return Pool::origin() + cell;
+}
+// ...which is also all there is to address: a cell that points
+// outside it (e.g. "100000000 @") is refused, not dereferenced.
+inline bool cell_is_address(int cell, size_t bytes) {
+    return cell >= 0 && size_t(cell) + bytes <= Pool::size();
+}
+#else
+inline int ptr_to_cell(const void *p) {
+    return (int)reinterpret_cast<intptr_t>(p);
+}
+inline void *cell_to_ptr(int cell) {
+    return reinterpret_cast<void *>(cell);
+}
+inline bool cell_is_address(int, size_t) {
+    return true;
+}
+#endif
+
 // Good old strings. I exploit the knowledge that we never release
 // strings, once we allocate them... And only implement what I need.
 class string {
@@ -159,6 +205,7 @@ public:
         _head = NULL;
     }
     void push_back(const T& t) {
+        PROFILE_SCOPE(MARK_NATIVE, F("list::push_back"));
         box *ptr;
         // If we have available nodes in our free list, reuse them!
         if (!_freeList)
@@ -174,6 +221,7 @@ public:
         _head = ptr;
     }
     void pop_front() {
+        PROFILE_SCOPE(MARK_NATIVE, F("list::pop_front"));
         DASSERT(_head, "pop_front called with empty list...");
         // Free the node by putting it on the free list.
         box *newHead = _head->_next;
@@ -190,4 +238,64 @@ public:
     }
 };
 
+// ...and a stack of at most N cells, in a plain array: our run-time
+// Forth stack. No allocations, no free-list; pushing and popping just
+// move _depth. Pushing onto a full one drops the cell - but remembers
+// that it did, for the engine to report (see run_full_phrase).
+//
+// The cells under _floor are hidden: a periodic word runs on top of the
+// stack of the word it interrupted, and can't see - or touch - any of
+// it (see hide, and Timers::run_pending).
+template <class T, unsigned N>
+class array_stack {
+    T _cells[N];
+    unsigned _depth, _floor;
+public:
+    bool _overflowed;
+
+    array_stack():_depth(0), _floor(0), _overflowed(false) {}
+    bool empty() {
+        return _depth == _floor;
+    }
+    unsigned depth() {
+        return _depth - _floor;
+    }
+    void clear() {
+        _depth = _floor = 0;
+        _overflowed = false;
+    }
+    void push(const T& t) {
+        if (_depth < N)
+            _cells[_depth++] = t;
+        else
+            _overflowed = true;
+    }
+    void pop() {
+        DASSERT(_depth > _floor, "pop called with empty stack...");
+        _depth--;
+    }
+    // Hide all the cells there are; what it returns, given to show(),
+    // brings them back - and drops whatever was pushed since.
+    unsigned hide() {
+        unsigned floor = _floor;
+        _floor = _depth;
+        return floor;
+    }
+    void show(unsigned floor) {
+        _depth = _floor;
+        _floor = floor;
+    }
+    T& top() {
+        return _cells[_depth - 1];
+    }
+    // The n-th cell under the top one
+    T& from_top(unsigned n) {
+        return _cells[_depth - 1 - n];
+    }
+    // ...and the i-th one from the bottom
+    T& operator[](unsigned i) {
+        return _cells[_floor + i];
+    }
+};
+
 #endif
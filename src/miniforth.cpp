@@ -9,6 +9,11 @@
 #include "miniforth.h"
 #include "helpers.h"
 #include "errors.h"
+#include "timers.h"
+#include "jit.h"
+#ifdef AOT_WORDS
+#include "aot_words.h"
+#endif
 
 // Instantiate the template-class globals of our lists.
 // See relevant comment in mini_stl.h
@@ -31,19 +36,16 @@ EvalResult Forth::evaluate_stack_top(const __FlashStringHelper *errorMessage)
 {
     if (_stack.empty())
         return error(emptyMsgFlash, errorMessage);
-    auto topVal = *_stack.begin();
-    _stack.pop_front();
-    switch (topVal._kind){
-    case StackNode::LIT:
-        // Evaluating a LITERAL node is easy: put the value on the stack
-        return EvalResult(topVal._u.intVal);
-    default:
-        // For anything else, execute all the corresponding words...
-        if (!CompiledNode::run_full_phrase(topVal._u.dictPtr->getCompiledNodes()))
-            return FAILURE;
-        // ...and hope that they left an integer on the top!
-        return evaluate_stack_top(errorMessage);
-    }
+    int topVal = _stack.top();
+    _stack.pop();
+    return EvalResult(topVal);
+}
+
+// A push found the stack full, and dropped its cell (see array_stack)
+SuccessOrFailure Forth::stack_overflow()
+{
+    _stack._overflowed = false;
+    return error(F("Stack overflow (see DSTACK_SIZE)"));
 }
 
 // Re-used from '+', '-', '*', '/' etc...
@@ -72,7 +74,7 @@ CompiledNode::ExecuteResult Forth::add(CompiledNodes::iterator it)
     int v1, v2;
     if (!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
         return FAILURE;
-    _stack.push_back(StackNode::makeNr(v2+v1));
+    _stack.push(v2+v1);
     return it;
 }
 
@@ -81,7 +83,7 @@ CompiledNode::ExecuteResult Forth::sub(CompiledNodes::iterator it)
     int v1, v2;
     if(!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
         return FAILURE;
-    _stack.push_back(StackNode::makeNr(v2-v1));
+    _stack.push(v2-v1);
     return it;
 }
 
@@ -90,7 +92,7 @@ CompiledNode::ExecuteResult Forth::mul(CompiledNodes::iterator it)
     int v1, v2;
     if(!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
         return FAILURE;
-    _stack.push_back(StackNode::makeNr(v2*v1));
+    _stack.push(v2*v1);
     return it;
 }
 
@@ -109,7 +111,7 @@ CompiledNode::ExecuteResult Forth::muldiv(CompiledNodes::iterator it)
     if (!ret3) return FAILURE;
     v3 = ret3.value();
 
-    _stack.push_back(StackNode::makeNr((long(v3)*v2)/v1));
+    _stack.push((long(v3)*v2)/v1);
     return it;
 }
 
@@ -120,7 +122,7 @@ CompiledNode::ExecuteResult Forth::div(CompiledNodes::iterator it)
         return FAILURE;
     if (!v1)
         return error(F("Division by zero..."));
-    _stack.push_back(StackNode::makeNr(v2/v1));
+    _stack.push(v2/v1);
     return it;
 }
 
@@ -131,7 +133,7 @@ CompiledNode::ExecuteResult Forth::mod(CompiledNodes::iterator it)
         return FAILURE;
     if (!v1)
         return error(F("Division by zero..."));
-    _stack.push_back(StackNode::makeNr(v2%v1));
+    _stack.push(v2%v1);
     return it;
 }
 
@@ -140,7 +142,7 @@ CompiledNode::ExecuteResult Forth::equal(CompiledNodes::iterator it)
     int v1, v2;
     if(!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
         return FAILURE;
-    _stack.push_back(StackNode::makeNr(v2 == v1 ? 1 : 0));
+    _stack.push(v2 == v1 ? 1 : 0);
     return it;
 }
 
@@ -149,7 +151,7 @@ CompiledNode::ExecuteResult Forth::greater(CompiledNodes::iterator it)
     int v1, v2;
     if(!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
         return FAILURE;
-    _stack.push_back(StackNode::makeNr(v2 > v1 ? 1 : 0));
+    _stack.push(v2 > v1 ? 1 : 0);
     return it;
 }
 
@@ -158,28 +160,730 @@ CompiledNode::ExecuteResult Forth::less(CompiledNodes::iterator it)
     int v1, v2;
     if(!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
         return FAILURE;
-    _stack.push_back(StackNode::makeNr(v2 < v1 ? 1 : 0));
+    _stack.push(v2 < v1 ? 1 : 0);
     return it;
 }
 
+void Forth::hold_begin()
+{
+    // The last byte of _hold is the null terminator
+    // of whatever we HOLD in front of it.
+    _holdPtr = &_hold[HOLD_SIZE - 1];
+    *_holdPtr = '\0';
+}
+
+SuccessOrFailure Forth::hold(char c)
+{
+    if (_holdPtr == _hold)
+        return error(F("Pictured numeric output overflow..."));
+    *--_holdPtr = c;
+    return SUCCESS;
+}
+
+// BASE is a normal variable, so anything can be stored in it; but
+// we only print in bases we have digits for (and that are > 1, since
+// with a base of 0 we'd divide by zero, and with 1 never finish).
+unsigned Forth::radix()
+{
+    int base = *_base;
+    return base < 2 ? 2 : base > 36 ? 36 : base;
+}
+
+static char digit_of(unsigned digit)
+{
+    return digit < 10 ? '0' + digit : 'A' + digit - 10;
+}
+
+unsigned Forth::hold_digit(unsigned u)
+{
+    unsigned base = radix();
+    // We just silently stop the digits from growing if "#" is over-used.
+    (void) hold(digit_of(u % base));
+    return u / base;
+}
+
+void Forth::print_number(int value, bool isSigned, int width)
+{
+    bool negative = isSigned && value < 0;
+    unsigned u = negative ? -(unsigned)value : (unsigned)value;
+    unsigned base = radix();
+    // Not in _hold: a "." between "<#" and "#>" mustn't touch
+    // the digits HOLD-ed there so far.
+    char digits[HOLD_SIZE];
+    char *p = &digits[HOLD_SIZE - 1];
+    *p = '\0';
+    do {
+        *--p = digit_of(u % base);
+        u /= base;
+    } while(u);
+    if (negative)
+        *--p = '-';
+    int count = &digits[HOLD_SIZE - 1] - p;
+    while(count++ < width)
+        Serial.print(F(" "));
+    Serial.print(p);
+}
+
 CompiledNode::ExecuteResult Forth::dot(CompiledNodes::iterator it)
 {
     auto ret = evaluate_stack_top(F("Nothing on the stack..."));
     if (!ret)
         return FAILURE;
-    if (_dotNumberOfDigits) {
-        // Sadly, Arduino vsnprintf doesn't support 
-        // the '*' syntax in the format spec...
-        // i.e. "%*d", _dotNumberOfDigits, value...
-        // So count the digits we would need,
-        // and emit enough spaces.
-        int digits = snprintf(NULL, 0, "%d", ret.value());
-        while(digits++ < _dotNumberOfDigits)
-            Serial.print(" ");
-        dprintf(" %d", ret.value());
-        _dotNumberOfDigits = 0; // back to normal (reset from U.R)
-    } else 
-        dprintf(" %d", ret.value());
+    Serial.print(F(" "));
+    // Pad with as many spaces as a previous U.R asked for.
+    print_number(ret.value(), true, _dotNumberOfDigits);
+    _dotNumberOfDigits = 0; // back to normal (reset from U.R)
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::Udot(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F("Nothing on the stack..."));
+    if (!ret)
+        return FAILURE;
+    Serial.print(F(" "));
+    print_number(ret.value(), false, 0);
+    return it;
+}
+
+// Re-used error message when not enough arguments are on the stack
+const char dotRErrorMsg[] PROGMEM = {
+    ".R needs a number and the number of columns"
+};
+__FlashStringHelper* dotRErrorMsgFlash = (__FlashStringHelper*)dotRErrorMsg;
+
+CompiledNode::ExecuteResult Forth::dotR(CompiledNodes::iterator it)
+{
+    int width, value;
+    if (!commonArithmetic(width, value, dotRErrorMsgFlash))
+        return FAILURE;
+    print_number(value, true, width);
+    return it;
+}
+
+// Re-used error message when not enough arguments are on the stack
+const char pictureErrorMsg[] PROGMEM = {
+    "Pictured numeric output needs a number on the stack"
+};
+__FlashStringHelper* pictureErrorMsgFlash = (__FlashStringHelper*)pictureErrorMsg;
+
+CompiledNode::ExecuteResult Forth::lessSharp(CompiledNodes::iterator it)
+{
+    hold_begin();
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::sharp(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(pictureErrorMsgFlash);
+    if (!ret)
+        return FAILURE;
+    _stack.push(hold_digit(ret.value()));
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::sharpS(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(pictureErrorMsgFlash);
+    if (!ret)
+        return FAILURE;
+    unsigned u = ret.value();
+    do
+        u = hold_digit(u);
+    while(u);
+    _stack.push(0);
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::holdChar(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F("HOLD needs a character on the stack"));
+    if (!ret || !hold(ret.value()))
+        return FAILURE;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::sign(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(pictureErrorMsgFlash);
+    if (!ret)
+        return FAILURE;
+    if (ret.value() < 0 && !hold('-'))
+        return FAILURE;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::sharpGreater(CompiledNodes::iterator it)
+{
+    // Drop what's left of the number, and leave the address
+    // and length of the HOLD-ed characters.
+    auto ret = evaluate_stack_top(pictureErrorMsgFlash);
+    if (!ret)
+        return FAILURE;
+    _stack.push(ptr_to_cell(_holdPtr));
+    _stack.push(&_hold[HOLD_SIZE - 1] - _holdPtr);
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::type(CompiledNodes::iterator it)
+{
+    int len, addr;
+    if (!commonArithmetic(len, addr, F("TYPE needs an address and a length")))
+        return FAILURE;
+    if (len <= 0)
+        return it;
+    auto ret = address_of(addr, len);
+    if (!ret)
+        return FAILURE;
+    const char *p = reinterpret_cast<const char *>(ret.value());
+    while(len-- > 0)
+        Serial.write(*p++);
+    return it;
+}
+
+// Our ALLOT is not quite the standard one: we have no contiguous data
+// space, since everything lives in the Pool. So ALLOT carves the bytes
+// out of the Pool, and gives you their (zeroed) address:
+//
+//     100 CELLS ALLOT constant buf
+//
+// That memory is never returned - until a RESET.
+CompiledNode::ExecuteResult Forth::allot(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F("ALLOT needs the number of bytes"));
+    if (!ret)
+        return FAILURE;
+    int bytes = ret.value();
+    if (bytes < 0 || !Pool::has_room((size_t)bytes + POOL_SAFETY_MARGIN))
+        return error(F("Not enough room in the Pool for ALLOT..."));
+    void *p = Pool::inner_alloc(bytes);
+    memset(p, 0, bytes);
+    _stack.push(ptr_to_cell(p));
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::cells(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F("CELLS needs a number"));
+    if (!ret)
+        return FAILURE;
+    _stack.push(ret.value() * (int)sizeof(int));
+    return it;
+}
+
+const char badAddressMsg[] PROGMEM = {
+    "Address out of bounds..."
+};
+
+// The memory behind an address: either a number (e.g. $25 for PORTB),
+// or a variable's. In the host, it must be within our Pool.
+Optional<uint8_t *> Forth::address_of(int addr, size_t bytes)
+{
+    if (!cell_is_address(addr, bytes))
+        return error((__FlashStringHelper *)badAddressMsg);
+    return reinterpret_cast<uint8_t *>(cell_to_ptr(addr));
+}
+
+// ( addr -- c )
+CompiledNode::ExecuteResult Forth::cAt(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F("C@ needs a variable or an address"));
+    if (!ret)
+        return FAILURE;
+    auto addr = address_of(ret.value(), 1);
+    if (!addr)
+        return FAILURE;
+    _stack.push(*(volatile uint8_t *)addr.value());
+    return it;
+}
+
+// ( c addr -- )
+CompiledNode::ExecuteResult Forth::cBang(CompiledNodes::iterator it)
+{
+    int addr, value;
+    if (!commonArithmetic(addr, value, F("C! needs a value and an address")))
+        return FAILURE;
+    auto p = address_of(addr, 1);
+    if (!p)
+        return FAILURE;
+    *(volatile uint8_t *)p.value() = value;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::andd(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    if (!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
+        return FAILURE;
+    _stack.push(v2 & v1);
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::orr(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    if (!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
+        return FAILURE;
+    _stack.push(v2 | v1);
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::xorr(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    if (!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
+        return FAILURE;
+    _stack.push(v2 ^ v1);
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::invert(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(arithmeticErrorMsgFlash);
+    if (!ret)
+        return FAILURE;
+    _stack.push(~ret.value());
+    return it;
+}
+
+// ( x u -- x<<u )
+CompiledNode::ExecuteResult Forth::lshift(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    if (!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
+        return FAILURE;
+    // Shifting by the whole width (or more) is undefined in C++
+    unsigned shifted = unsigned(v1) < 8*sizeof(int) ? unsigned(v2) << v1 : 0;
+    _stack.push(int(shifted));
+    return it;
+}
+
+// ( x u -- x>>u ) - a logical shift; the top bits become zeroes.
+CompiledNode::ExecuteResult Forth::rshift(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    if (!commonArithmetic(v1, v2, arithmeticErrorMsgFlash))
+        return FAILURE;
+    unsigned shifted = unsigned(v1) < 8*sizeof(int) ? unsigned(v2) >> v1 : 0;
+    _stack.push(int(shifted));
+    return it;
+}
+
+// ( mask addr -- ) The common part of CSET, CCLEAR and CTOGGLE:
+// clear the mask bits (or not), then flip them (or not).
+// An interrupt handler that touches the same byte (e.g. the same port)
+// can't sneak in between our read and our write: on the AVR, we do them
+// with interrupts disabled. A handful of instructions, for a GPIO toggle.
+CompiledNode::ExecuteResult Forth::modify_byte(
+    CompiledNodes::iterator it, const __FlashStringHelper *msg,
+    bool clearMask, bool xorMask)
+{
+    int addr, mask;
+    if (!commonArithmetic(addr, mask, msg))
+        return FAILURE;
+    auto ret = address_of(addr, 1);
+    if (!ret)
+        return FAILURE;
+    volatile uint8_t *p = ret.value();
+    uint8_t andBits = clearMask ? ~mask : 0xFF;
+    uint8_t xorBits = xorMask ? mask : 0;
+#ifndef __NATIVE_BUILD__
+    uint8_t sreg = SREG;
+    cli();
+#endif
+    *p = (*p & andBits) ^ xorBits;
+#ifndef __NATIVE_BUILD__
+    SREG = sreg;
+#endif
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::cset(CompiledNodes::iterator it)
+{
+    return modify_byte(it, F("CSET needs a mask and an address"), true, true);
+}
+
+CompiledNode::ExecuteResult Forth::cclear(CompiledNodes::iterator it)
+{
+    return modify_byte(it, F("CCLEAR needs a mask and an address"), true, false);
+}
+
+CompiledNode::ExecuteResult Forth::ctoggle(CompiledNodes::iterator it)
+{
+    return modify_byte(it, F("CTOGGLE needs a mask and an address"), false, true);
+}
+
+// ( n -- ) wait for n milliseconds
+CompiledNode::ExecuteResult Forth::ms(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F("MS needs the milliseconds to wait"));
+    if (!ret)
+        return FAILURE;
+    if (ret.value() > 0)
+        sleep_ms(ret.value());
+    return it;
+}
+
+// ( n -- ) wait for n microseconds
+CompiledNode::ExecuteResult Forth::us(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F("US needs the microseconds to wait"));
+    if (!ret)
+        return FAILURE;
+    if (ret.value() > 0)
+        sleep_us(ret.value());
+    return it;
+}
+
+// ( -- n ) milliseconds since boot. The count wraps around
+// (in the AVR, every 65.5 seconds) - but differences between
+// two TICKS stay correct, as long as they are shorter than that.
+CompiledNode::ExecuteResult Forth::ticks(CompiledNodes::iterator it)
+{
+    _stack.push(int(ticks_ms()));
+    return it;
+}
+
+// ' and [']: the execution token of a word - as an XT node, that
+// knows which word it is (so that e.g. the tether can send it).
+Optional<CompiledNode> Forth::compile_XT(const char *word)
+{
+    auto token = classify(word);
+    switch(token._kind) {
+    case Token::BUILTIN:
+        return CompiledNode::makeXT(NULL, -1 - int(token._u._pCmd - C_op_at(0)));
+    case Token::USER_WORD:
+        return CompiledNode::makeXT(
+            token._u._dictPtr, ptr_to_cell(token._u._dictPtr));
+    default:
+        return error(F("' needs the name of a word; not "), word);
+    }
+}
+
+// The dictionary entry behind an execution token - if there is one.
+// Anything else (a number that merely points into the Pool) isn't one;
+// so we only accept the address of an actual entry. This walks the
+// dictionary - but only for the raw numbers EXECUTE and IS take off
+// the stack: DEFER-ed words keep the entry itself.
+DictionaryPtr Forth::word_of_xt(int xt)
+{
+    if (xt <= 0)
+        return NULL;
+    for(auto& entry: _dict)
+        if (ptr_to_cell(&entry) == xt)
+            return &entry;
+    return NULL;
+}
+
+bool Forth::is_xt(int xt)
+{
+    return xt < 0 ? C_op_at(-1 - xt) != NULL : word_of_xt(xt) != NULL;
+}
+
+// Straight to the body: no name lookups, no evaluate_stack_top.
+SuccessOrFailure Forth::execute_xt(int xt)
+{
+    if (xt < 0) {
+        const BakedInCommand *pCmd = C_op_at(-1 - xt);
+        if (!pCmd)
+            return error(F("EXECUTE needs an execution token"));
+        return run_C_op(pCmd);
+    }
+    return execute_deferred(word_of_xt(xt), xt);
+}
+
+// A DEFER-ed word already knows its target (IS checked it); and so
+// does EXECUTE, once word_of_xt found it. NULL is a native word - or,
+// with an xt of 0, a DEFER that isn't set yet.
+SuccessOrFailure Forth::execute_deferred(DictionaryPtr word, int xt)
+{
+    if (!word) {
+        if (xt < 0)
+            return run_C_op(C_op_at(-1 - xt));
+        return error(F("EXECUTE needs an execution token (is the DEFER set?)"));
+    }
+    PROFILE_SCOPE(MARK_WORD, word->name());
+    COUNT_SCOPE(word->_counter);
+    return CompiledNode::run_full_phrase(word);
+}
+
+// ( xt -- )
+CompiledNode::ExecuteResult Forth::execute(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F("EXECUTE needs an execution token"));
+    if (!ret || !execute_xt(ret.value()))
+        return FAILURE;
+    return it;
+}
+
+// Values move between the stacks as they are - a variable stays
+// a variable - just like DUP and SWAP move them.
+const char rstackFullMsg[] PROGMEM = {
+    "The return stack is full"
+};
+__FlashStringHelper* rstackFullMsgFlash = (__FlashStringHelper*)rstackFullMsg;
+const char rstackEmptyMsg[] PROGMEM = {
+    "The return stack is empty"
+};
+__FlashStringHelper* rstackEmptyMsgFlash = (__FlashStringHelper*)rstackEmptyMsg;
+
+// ( x -- ) ( R: -- x )
+CompiledNode::ExecuteResult Forth::toR(CompiledNodes::iterator it)
+{
+    if (_stack.empty())
+        return error(emptyMsgFlash, F(">R needs a value"));
+    if (_rdepth == RSTACK_SIZE)
+        return error(rstackFullMsgFlash);
+    _rstack[_rdepth++] = _stack.top();
+    _stack.pop();
+    return it;
+}
+
+// ( -- x ) ( R: x -- )
+CompiledNode::ExecuteResult Forth::rFrom(CompiledNodes::iterator it)
+{
+    if (!_rdepth)
+        return error(rstackEmptyMsgFlash);
+    _stack.push(_rstack[--_rdepth]);
+    return it;
+}
+
+// ( -- x ) ( R: x -- x )
+CompiledNode::ExecuteResult Forth::rFetch(CompiledNodes::iterator it)
+{
+    if (!_rdepth)
+        return error(rstackEmptyMsgFlash);
+    _stack.push(_rstack[_rdepth - 1]);
+    return it;
+}
+
+// ( x1 x2 -- ) ( R: -- x1 x2 )
+CompiledNode::ExecuteResult Forth::twoToR(CompiledNodes::iterator it)
+{
+    if (_stack.depth() < 2)
+        return error(emptyMsgFlash, F("2>R needs two values"));
+    if (_rdepth > RSTACK_SIZE - 2)
+        return error(rstackFullMsgFlash);
+    _rstack[_rdepth + 1] = _stack.top();
+    _stack.pop();
+    _rstack[_rdepth] = _stack.top();
+    _stack.pop();
+    _rdepth += 2;
+    return it;
+}
+
+// ( -- x1 x2 ) ( R: x1 x2 -- )
+CompiledNode::ExecuteResult Forth::twoRFrom(CompiledNodes::iterator it)
+{
+    if (_rdepth < 2)
+        return error(rstackEmptyMsgFlash);
+    _rdepth -= 2;
+    _stack.push(_rstack[_rdepth]);
+    _stack.push(_rstack[_rdepth + 1]);
+    return it;
+}
+
+#ifdef WORD_PROFILE
+// (Called on every native dispatch: so no searching - the index is
+//  in the node, since compile_C_op put it there.)
+WordCounter& Forth::builtin_counter(int idx)
+{
+    DASSERT(C_op_at(idx), "A native word outside c_ops...");
+    return _builtinCounters[idx];
+}
+
+// Does counter 'a' rank higher than 'b' in .PROFILE?
+// More time first; the address just breaks the ties.
+static bool ranks_before(const WordCounter *a, const WordCounter *b)
+{
+    return a->_time > b->_time || (a->_time == b->_time && a > b);
+}
+
+// ( n -- ) print the n words we spent the most time in.
+CompiledNode::ExecuteResult Forth::dotProfile(CompiledNodes::iterator it)
+{
+    auto ret = evaluate_stack_top(F(".PROFILE needs the number of words to show"));
+    if (!ret)
+        return FAILURE;
+    // No room to sort them - so find the next one, N times over.
+    const WordCounter *last = NULL;
+    for(int n = ret.value(); n > 0; n--) {
+        const WordCounter *best = NULL;
+        const char *bestName = NULL;
+        bool bestInFlash = false;
+        auto consider = [&](const WordCounter *c, const char *name, bool inFlash) {
+            if (!c->_calls || (last && !ranks_before(last, c)))
+                return;
+            if (!best || ranks_before(c, best)) {
+                best = c;
+                bestName = name;
+                bestInFlash = inFlash;
+            }
+        };
+        int idx = 0;
+        const BakedInCommand *p = iterate_on_C_ops(true);
+        while(p) {
+            consider(&_builtinCounters[idx++], (PGM_P) pgm_read_word_near(&p->name), true);
+            p = iterate_on_C_ops();
+        }
+        for(auto& word: _dict)
+            consider(&word._counter, word.name(), false);
+        if (!best)
+            break;
+        dprintf("\n%10lu calls %12lu " PROFILE_TIME_UNIT "  ", best->_calls, best->_time);
+        if (bestInFlash)
+            Serial.print((const __FlashStringHelper *) bestName);
+        else
+            Serial.print(bestName);
+        last = best;
+    }
+    Serial.print(F("\n"));
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::zeroProfile(CompiledNodes::iterator it)
+{
+    int idx = 0;
+    while(C_op_at(idx))
+        _builtinCounters[idx++].clear();
+    for(auto& word: _dict)
+        word._counter.clear();
+    return it;
+}
+#endif
+
+// ( addr -- ) as in "TRACE ON"
+CompiledNode::ExecuteResult Forth::on(CompiledNodes::iterator it)
+{
+    if (_stack.empty())
+        return error(emptyMsgFlash, F("ON needs a variable or an address"));
+    _stack.push(-1);
+    if (!swap(it))
+        return FAILURE;
+    return bang(it);
+}
+
+// ( addr -- ) as in "TRACE OFF"
+CompiledNode::ExecuteResult Forth::off(CompiledNodes::iterator it)
+{
+    if (_stack.empty())
+        return error(emptyMsgFlash, F("OFF needs a variable or an address"));
+    _stack.push(0);
+    if (!swap(it))
+        return FAILURE;
+    return bang(it);
+}
+
+// What .TRACE shows of a record: the id that "tether --decode" knows
+// how to name.
+uint16_t Forth::trace_id(const TraceRecord& rec)
+{
+    switch(rec._kind) {
+    case CompiledNode::LITERAL:
+        return TRACE_LITERAL;
+    case CompiledNode::STRING:
+        return TRACE_STRING;
+    case CompiledNode::XT:
+        // It pushes a number, just like a literal does
+        return TRACE_LITERAL;
+    case CompiledNode::C_FUNC:
+        return TRACE_BUILTIN | rec._raw;
+    case CompiledNode::CASE:
+    case CompiledNode::OF:
+    case CompiledNode::ENDOF:
+    case CompiledNode::ENDCASE:
+        return TRACE_CONTROL;
+    case CompiledNode::LOCALS:
+    case CompiledNode::LOCAL:
+    case CompiledNode::TO_LOCAL:
+        return TRACE_LOCAL;
+    default: {
+        // A word, variable or constant: where it is in the dictionary,
+        // counting from the oldest entry - so the ids stay put as we
+        // define more words. (Yes, this walks the dictionary; but only
+        // while dumping. An entry we can't find gets an id past them all.)
+        uint16_t distance = 0, total = 0;
+        bool found = false;
+        for(auto& word: _dict) {
+            if (ptr_to_cell(&word) == rec._raw) {
+                distance = total;
+                found = true;
+            }
+            total++;
+        }
+        return found ? total - 1 - distance : total;
+    }
+    }
+}
+
+// Called by run_full_phrase for each CompiledNode - but only when tracing.
+void Forth::trace(CompiledNode& node)
+{
+    TraceRecord& rec = _trace[_traceNext];
+    rec._kind = node._kind;
+    switch(node._kind) {
+    case CompiledNode::C_FUNC:
+        rec._raw = node._u._function._index;
+        break;
+    case CompiledNode::CONSTANT:
+    case CompiledNode::VARIABLE:
+    case CompiledNode::WORD:
+        rec._raw = ptr_to_cell(node._u._word._dictPtr);
+        break;
+    case CompiledNode::DEFERRED:
+        // Shown as the call it makes
+        if (node._u._xt._dictPtr) {
+            rec._kind = CompiledNode::WORD;
+            rec._raw = ptr_to_cell(node._u._xt._dictPtr);
+        } else if (node._u._xt._xt < 0) {
+            rec._kind = CompiledNode::C_FUNC;
+            rec._raw = -1 - node._u._xt._xt;
+        } else
+            rec._raw = 0;
+        break;
+    default:
+        rec._raw = 0;
+    }
+    unsigned depth = _stack.depth();
+    rec._depth = depth < 0xFF ? depth : 0xFF;
+    rec._tos = depth ? _stack.top() : 0;
+    _traceNext = (_traceNext + 1) % TRACE_SIZE;
+    if (_traceCount < TRACE_SIZE)
+        _traceCount++;
+}
+
+static void print_hex(unsigned val, int digits)
+{
+    while(digits--) {
+        unsigned nibble = (val >> (4*digits)) & 0xF;
+        Serial.write(nibble < 10 ? '0' + nibble : 'A' + nibble - 10);
+    }
+}
+
+// Dump the trace, oldest first; one "id depth top-of-stack" per line.
+// See "tether --decode" in the host, for what the ids mean.
+CompiledNode::ExecuteResult Forth::dotTrace(CompiledNodes::iterator it)
+{
+    unsigned idx = (_traceNext + TRACE_SIZE - _traceCount) % TRACE_SIZE;
+    for(unsigned n=0; n<_traceCount; n++) {
+        TraceRecord& rec = _trace[idx];
+        Serial.print(F("\n"));
+        print_hex(trace_id(rec), 4);
+        Serial.print(F(" "));
+        print_hex(rec._depth, 2);
+        Serial.print(F(" "));
+        print_hex(rec._tos, 2*sizeof(int));
+        idx = (idx + 1) % TRACE_SIZE;
+    }
+    Serial.print(F("\n"));
+    return it;
+}
+
+// ( -- n ) the deepest the CPU stack went since RESET, in bytes
+// (AVR only; in the host, there's nothing to measure it with)
+CompiledNode::ExecuteResult Forth::maxStack(CompiledNodes::iterator it)
+{
+    _stack.push(stack_max_depth());
     return it;
 }
 
@@ -199,18 +903,18 @@ CompiledNode::ExecuteResult Forth::swap(CompiledNodes::iterator it)
 {
     if (_stack.empty())
         return error(emptyMsgFlash, swapErrorMsg);
-    auto topVal = *_stack.begin();
-    _stack.pop_front();
+    auto topVal = _stack.top();
+    _stack.pop();
 
     if (_stack.empty()) {
-        _stack.push_back(topVal);
+        _stack.push(topVal);
         return error(emptyMsgFlash, swapErrorMsg);
     }
-    auto bottomVal = *_stack.begin();
-    _stack.pop_front();
+    auto bottomVal = _stack.top();
+    _stack.pop();
 
-    _stack.push_back(topVal);
-    _stack.push_back(bottomVal);
+    _stack.push(topVal);
+    _stack.push(bottomVal);
     return it;
 }
 
@@ -224,27 +928,27 @@ CompiledNode::ExecuteResult Forth::rot(CompiledNodes::iterator it)
 {
     if (_stack.empty())
         return error(emptyMsgFlash, rotErrorMsg);
-    auto val3 = *_stack.begin();
-    _stack.pop_front();
+    auto val3 = _stack.top();
+    _stack.pop();
 
     if (_stack.empty()) {
-        _stack.push_back(val3);
+        _stack.push(val3);
         return error(emptyMsgFlash, rotErrorMsg);
     }
-    auto val2 = *_stack.begin();
-    _stack.pop_front();
+    auto val2 = _stack.top();
+    _stack.pop();
 
     if (_stack.empty()) {
-        _stack.push_back(val2);
-        _stack.push_back(val3);
+        _stack.push(val2);
+        _stack.push(val3);
         return error(emptyMsgFlash, rotErrorMsg);
     }
-    auto val1 = *_stack.begin();
-    _stack.pop_front();
+    auto val1 = _stack.top();
+    _stack.pop();
 
-    _stack.push_back(val2);
-    _stack.push_back(val3);
-    _stack.push_back(val1);
+    _stack.push(val2);
+    _stack.push(val3);
+    _stack.push(val1);
     return it;
 }
 
@@ -306,12 +1010,11 @@ CompiledNode::ExecuteResult Forth::iff(CompiledNodes::iterator it)
     auto topVal = needs_a_number(msg);
     if (!topVal)
         return error(msg);
-    _stack.pop_front();
+    _stack.pop();
 
     // Read the explanation in the run_full_phrase
     // method of CompiledNode to understand these two lines.
     _ifStates.push_back(IfState(0 != topVal.value()));
-    IfState::inside_IF_body = true;
     return it;
 }
 
@@ -327,7 +1030,89 @@ CompiledNode::ExecuteResult Forth::elsee(CompiledNodes::iterator it)
 {
     // Read the explanation in the run_full_phrase
     // method of CompiledNode to understand these two lines.
-    IfState::inside_IF_body = false;
+    if (!_ifStates.empty())
+        _ifStates.begin()->_insideIfBody = false;
+    return it;
+}
+
+// CASE ... ENDCASE: unlike IF, there's no execution stack here; where
+// each of these nodes jumps to was decided once, by resolve_cases.
+CompiledNode::ExecuteResult Forth::dispatch_case(
+    CaseTable *table, CompiledNodes::iterator it)
+{
+    // Without a table, the OFs that follow do all the work
+    if (!table)
+        return it;
+    auto msg = F("CASE needs a number...");
+    auto topVal = needs_a_number(msg);
+    if (!topVal)
+        return error(msg);
+    // Unsigned, so that values below _min wrap to way above _count
+    unsigned slot = (unsigned) topVal.value() - (unsigned) table->_min;
+    if (slot < table->_count && table->_targets[slot]) {
+        // Just like a matching OF, we consume the value
+        _stack.pop();
+        return CompiledNodes::iterator(table->_targets[slot]);
+    }
+    // The default code still sees it; ENDCASE drops it
+    return CompiledNodes::iterator(table->_default);
+}
+
+CompiledNode::ExecuteResult Forth::of(
+    CompiledNodes::box *target, CompiledNodes::iterator it)
+{
+    auto msg = F("OF needs a value, and the one to compare it with");
+    auto val = evaluate_stack_top(msg);
+    if (!val)
+        return FAILURE;
+    auto topVal = needs_a_number(msg);
+    if (!topVal)
+        return error(msg);
+    // No match: on to the next OF (past our ENDOF)
+    if (topVal.value() != val.value())
+        return CompiledNodes::iterator(target);
+    _stack.pop();
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::endcase(CompiledNodes::iterator it)
+{
+    if (_stack.empty())
+        return error(emptyMsgFlash, F("ENDCASE needs the value no OF matched"));
+    _stack.pop();
+    return it;
+}
+
+// {: a b | c :} ( a b -- ) - the frame of the word's locals, on the
+// return stack; run_full_phrase closes it when the word is done.
+// Reading a local is then just an index: _rstack[_frame + slot].
+CompiledNode::ExecuteResult Forth::open_frame(
+    uint8_t count, uint8_t initialized, CompiledNodes::iterator it)
+{
+    if (_rdepth + count > RSTACK_SIZE)
+        return error(rstackFullMsgFlash);
+    // All there, or we take none of them
+    if (_stack.depth() < initialized)
+        return error(emptyMsgFlash, F("{: needs a value for each local before the |"));
+    // The last local gets the value at the top of the stack
+    for(uint8_t slot = initialized; slot-- > 0; ) {
+        _rstack[_rdepth + slot] = _stack.top();
+        _stack.pop();
+    }
+    for(uint8_t slot = initialized; slot < count; slot++)
+        _rstack[_rdepth + slot] = 0;
+    _frame = _rdepth;
+    _rdepth += count;
+    return it;
+}
+
+// ( x -- ) "TO a"
+CompiledNode::ExecuteResult Forth::to_local(int slot, CompiledNodes::iterator it)
+{
+    if (_stack.empty())
+        return error(emptyMsgFlash, F("TO needs a value"));
+    _rstack[_frame + slot] = _stack.top();
+    _stack.pop();
     return it;
 }
 
@@ -338,7 +1123,7 @@ CompiledNode::ExecuteResult Forth::loop_I(CompiledNodes::iterator it)
     // Put the top-most counter in the LOOP stack...
     auto& loopState = *_loopStates.begin();
     // ...on the Forth stack.
-    _stack.push_back(StackNode::makeNr(loopState._currentIdx));
+    _stack.push(loopState._currentIdx);
     return it;
 }
 
@@ -350,7 +1135,26 @@ CompiledNode::ExecuteResult Forth::loop_J(CompiledNodes::iterator it)
     if (_loopStates.begin()._p->_next == NULL)
         return error(emptyMsgFlash, errMsg);
     // Put the second-from-the-top-most counter in the LOOP stack...
-    _stack.push_back(StackNode::makeNr(_loopStates.begin()._p->_next->_data._currentIdx));
+    _stack.push(_loopStates.begin()._p->_next->_data._currentIdx);
+    return it;
+}
+
+// The BASE-setting words
+CompiledNode::ExecuteResult Forth::hex(CompiledNodes::iterator it)
+{
+    *_base = 16;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::decimal(CompiledNodes::iterator it)
+{
+    *_base = 10;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::binary(CompiledNodes::iterator it)
+{
+    *_base = 2;
     return it;
 }
 
@@ -359,11 +1163,7 @@ Optional<int> Forth::needs_a_number(const __FlashStringHelper *msg)
 {
     if (_stack.empty())
         return error(emptyMsgFlash, msg);
-    auto topVal = *_stack.begin();
-    if (topVal._kind == StackNode::LIT)
-        return topVal._u.intVal;
-    else
-        return FAILURE;
+    return _stack.top();
 }
 
 CompiledNode::ExecuteResult Forth::UdotR(CompiledNodes::iterator it)
@@ -372,7 +1172,7 @@ CompiledNode::ExecuteResult Forth::UdotR(CompiledNodes::iterator it)
     auto topVal = needs_a_number(msg);
     if (!topVal)
         return error(msg);
-    _stack.pop_front();
+    _stack.pop();
     // Update the global state used by the 'dot' member
     // to 'pad' the next print with spaces.
     _dotNumberOfDigits = topVal.value();
@@ -383,8 +1183,8 @@ CompiledNode::ExecuteResult Forth::dup(CompiledNodes::iterator it)
 {
     if (_stack.empty())
         return error(emptyMsgFlash, F("DUP needs a non-empty stack"));
-    auto topVal = *_stack.begin();
-    _stack.push_back(topVal);
+    auto topVal = _stack.top();
+    _stack.push(topVal);
     return it;
 }
 
@@ -392,48 +1192,27 @@ CompiledNode::ExecuteResult Forth::drop(CompiledNodes::iterator it)
 {
     if (_stack.empty())
         return error(emptyMsgFlash, F("DROP` needs a non-empty stack"));
-    _stack.pop_front();
+    _stack.pop();
     return it;
 }
 
+// How ".S" shows each cell.
+static void dot_cell(int cell)
+{
+    Forth::print_number(cell, true, 0);
+    Serial.print(F(" "));
+}
+
 CompiledNode::ExecuteResult Forth::dots(CompiledNodes::iterator it)
 {
     Serial.print(F("[ "));
-    // This is the simplest way to reverse the order...
-    // But it's also wasteful - it needs at least as much
-    // room in our pool to host what currently exists
-    // in our stack...
-    //
-    // forward_list<StackNode> swapperList;
-    // for(auto& stackNode: _stack)
-    //     swapperList.push_back(stackNode);
-    // for(auto& stackNode: swapperList)
-    //     stackNode.dots();
-    // while(!swapperList.empty())
-    //     swapperList.pop_front();
-    //
-    // Instead... a much more optimal, memory-wise, way:
-    void *pEnd = NULL;
-    while(true) {
-        // Hunt for the LAST element
-        forward_list<StackNode>::iterator it2 = _stack.begin();
-        while(it2._p && it2.next() != pEnd)
-            ++it2;
-        if ( it2 == _stack.begin())
-            break;
-        it2->dots();
-        // Move the LAST element to hunt for, to one step before...
-        pEnd = it2._p;
-    }
-    // Finally, print the head element.
-    if (!_stack.empty())
-        _stack.begin()->dots();
-
+    // Bottom first - the array is already in that order.
+    for(unsigned i=0; i<_stack.depth(); i++)
+        dot_cell(_stack[i]);
     Serial.print(F("] "));
 
     // Print some memory stats, too.
     memory_info(
-        forward_list<StackNode>::_freeListMemory +
         forward_list<CompiledNode>::_freeListMemory +
         forward_list<DictionaryEntry>::_freeListMemory +
         forward_list<IfState>::_freeListMemory +
@@ -441,28 +1220,18 @@ CompiledNode::ExecuteResult Forth::dots(CompiledNodes::iterator it)
     return it;
 }
 
+// ( addr -- x ) - addr being a variable's, or e.g. $1234:
+// useful to access register space directly.
 CompiledNode::ExecuteResult Forth::at(CompiledNodes::iterator it)
 {
-    const __FlashStringHelper *errMsg = \
-        F("@ needs a variable or constant on the stack");
     if (_stack.empty())
-        return error(emptyMsgFlash, errMsg);
-    auto tmp = *_stack.begin();
-    // Constant value, e.g. $1234. Dereference it as ptr to int
-    // Useful to access register space directly.
-    if (StackNode::LIT == tmp._kind) {
-        _stack.pop_front();
-        _stack.push_back(StackNode::makeNr( *reinterpret_cast<int *>(tmp._u.intVal)));
-    } else {
-        CompiledNodes& c = tmp._u.dictPtr->getCompiledNodes();
-        if (c.empty())
-            return error(emptyMsgFlash, errMsg);
-        CompiledNode& node = *c.begin();
-        if (node._kind != CompiledNode::VARIABLE && node._kind != CompiledNode::CONSTANT)
-            return error(errMsg);
-        _stack.pop_front();
-        _stack.push_back(StackNode::makeNr(node.getVariableValue()));
+        return error(emptyMsgFlash, F("@ needs a variable or an address on the stack"));
+    auto addr = address_of(_stack.top(), sizeof(int));
+    if (!addr) {
+        _stack.pop();
+        return FAILURE;
     }
+    _stack.top() = *reinterpret_cast<int *>(addr.value());
     return it;
 }
 
@@ -485,58 +1254,62 @@ CompiledNode::ExecuteResult Forth::words(CompiledNodes::iterator it)
     return it;
 }
 
+// ( x addr -- )
 CompiledNode::ExecuteResult Forth::bang(CompiledNodes::iterator it)
 {
-    const __FlashStringHelper *errMsg = \
-        F("! needs a [variable|constant] and a value on the stack");
     if (_stack.empty())
-        return error(emptyMsgFlash, errMsg);
-    auto tmp = *_stack.begin();
-    // Our StackNode-s can be either a LITERAL/CONSTANT,
-    // ...in which case we just treat them as pointer to int...
-    if (StackNode::LIT == tmp._kind) {
-        _stack.pop_front();
-        int *pDest = reinterpret_cast<int *>(tmp._u.intVal);
-        auto ret = evaluate_stack_top(F("Failed to evaluate value for !..."));
-        if (ret) {
-            *pDest = ret.value();
-            return it;
-        }
+        return error(emptyMsgFlash, F("! needs a value and a variable (or an address) on the stack"));
+    int addr = _stack.top();
+    _stack.pop();
+    auto ret = evaluate_stack_top(F("Failed to evaluate value for !..."));
+    if (!ret)
         return FAILURE;
-    } else {
-        // ...or it can be something that the dictionary knows:
-        // In this case, an actual VARIABLE.
-        auto& c = tmp._u.dictPtr->getCompiledNodes();
-        if (c.empty())
-            return error(emptyMsgFlash, errMsg);
-        // Since we hunt for a variable, there must be
-        // such a node a the top of that DictionaryEntry's list:
-        CompiledNode& node = *c.begin();
-        if (node._kind != CompiledNode::VARIABLE)
-            return error(errMsg);
-        _stack.pop_front();
-
-        // Then, compute the value
-        auto ret = evaluate_stack_top(F("Failed to evaluate value for !..."));
-        if (ret) {
-            node.setVariableValue(ret.value());
-            return it;
-        }
+    auto pDest = address_of(addr, sizeof(int));
+    if (!pDest)
         return FAILURE;
-    }
+    *reinterpret_cast<int *>(pDest.value()) = ret.value();
+    return it;
 }
 
 const Forth::BakedInCommand *Forth::lookup_C(const char *wrd) {
     // search in the words implemented natively
     const BakedInCommand *p = iterate_on_C_ops(true);
+    char first = toupper(*wrd);
     while(p) {
-        if (!strcasecmp_P(wrd, pgm_read_word_near(&p->name)))
+        // Our native names are all upper-case; so checking the first
+        // character before strcasecmp_P-ing rejects most of them cheaply.
+        PGM_P name = (PGM_P) pgm_read_word_near(&p->name);
+        if (first == (char) pgm_read_byte_near(name) && !strcasecmp_P(wrd, name))
             return p;
         p = iterate_on_C_ops();
     }
     return NULL;
 }
 
+const Forth::BakedInCommand *Forth::C_op_at(int idx) {
+    // c_ops is an array; we only need to walk it once, to count it.
+    static int count = -1;
+    if (count < 0) {
+        count = 0;
+        for(auto p = iterate_on_C_ops(true); p; p = iterate_on_C_ops())
+            count++;
+    }
+    if (idx < 0 || idx >= count)
+        return NULL;
+    return iterate_on_C_ops(true) + idx;
+}
+
+const char *Forth::name_of_C_op(int idx) {
+    const BakedInCommand *p = C_op_at(idx);
+    return p ? (PGM_P) pgm_read_word_near(&p->name) : NULL;
+}
+
+CompiledNode Forth::compile_C_op(const BakedInCommand *pCmd) {
+    return CompiledNode::makeCFunction(
+        pCmd - C_op_at(0),
+        reinterpret_cast<CompiledNode::FuncPtr>(pgm_read_word_near(&pCmd->funcPtr)));
+}
+
 // Perform a case-insensitive lookup for the word entered on the REPL.
 DictionaryPtr Forth::lookup(const char *wrd) {
     for(auto it = _dict.begin(); it != _dict.end(); ++it) {
@@ -575,6 +1348,48 @@ const Forth::BakedInCommand* Forth::iterate_on_C_ops(bool reset)
     static const char elsee_sym[]    PROGMEM = { "ELSE" };
     static const char swap_sym[]     PROGMEM = { "SWAP" };
     static const char rot_sym[]      PROGMEM = { "ROT" };
+    static const char hex_sym[]      PROGMEM = { "HEX" };
+    static const char decimal_sym[]  PROGMEM = { "DECIMAL" };
+    static const char binary_sym[]   PROGMEM = { "BINARY" };
+    static const char Udot_sym[]     PROGMEM = { "U." };
+    static const char dotR_sym[]     PROGMEM = { ".R" };
+    static const char lessSharp_sym[] PROGMEM = { "<#" };
+    static const char sharp_sym[]    PROGMEM = { "#" };
+    static const char sharpS_sym[]   PROGMEM = { "#S" };
+    static const char hold_sym[]     PROGMEM = { "HOLD" };
+    static const char sign_sym[]     PROGMEM = { "SIGN" };
+    static const char sharpGreater_sym[] PROGMEM = { "#>" };
+    static const char type_sym[]     PROGMEM = { "TYPE" };
+    static const char allot_sym[]    PROGMEM = { "ALLOT" };
+    static const char cells_sym[]    PROGMEM = { "CELLS" };
+    static const char on_sym[]       PROGMEM = { "ON" };
+    static const char off_sym[]      PROGMEM = { "OFF" };
+    static const char dotTrace_sym[] PROGMEM = { ".TRACE" };
+    static const char maxStack_sym[] PROGMEM = { "MAXSTACK" };
+    static const char cAt_sym[]      PROGMEM = { "C@" };
+    static const char cBang_sym[]    PROGMEM = { "C!" };
+    static const char andd_sym[]     PROGMEM = { "AND" };
+    static const char orr_sym[]      PROGMEM = { "OR" };
+    static const char xorr_sym[]     PROGMEM = { "XOR" };
+    static const char invert_sym[]   PROGMEM = { "INVERT" };
+    static const char lshift_sym[]   PROGMEM = { "LSHIFT" };
+    static const char rshift_sym[]   PROGMEM = { "RSHIFT" };
+    static const char cset_sym[]     PROGMEM = { "CSET" };
+    static const char cclear_sym[]   PROGMEM = { "CCLEAR" };
+    static const char ctoggle_sym[]  PROGMEM = { "CTOGGLE" };
+    static const char ms_sym[]       PROGMEM = { "MS" };
+    static const char us_sym[]       PROGMEM = { "US" };
+    static const char ticks_sym[]    PROGMEM = { "TICKS" };
+    static const char execute_sym[]  PROGMEM = { "EXECUTE" };
+    static const char toR_sym[]      PROGMEM = { ">R" };
+    static const char rFrom_sym[]    PROGMEM = { "R>" };
+    static const char rFetch_sym[]   PROGMEM = { "R@" };
+    static const char twoToR_sym[]   PROGMEM = { "2>R" };
+    static const char twoRFrom_sym[] PROGMEM = { "2R>" };
+#ifdef WORD_PROFILE
+    static const char dotProfile_sym[]  PROGMEM = { ".PROFILE" };
+    static const char zeroProfile_sym[] PROGMEM = { "0PROFILE" };
+#endif
     static const char sentinel_sym[] PROGMEM = { "#@#@#" };
     static int idx = 0;
     static const BakedInCommand c_ops[] PROGMEM = {
@@ -607,6 +1422,52 @@ const Forth::BakedInCommand* Forth::iterate_on_C_ops(bool reset)
         { (__FlashStringHelper *)elsee_sym,    &Forth::elsee   },
         { (__FlashStringHelper *)swap_sym,     &Forth::swap    },
         { (__FlashStringHelper *)rot_sym,      &Forth::rot     },
+        { (__FlashStringHelper *)hex_sym,      &Forth::hex     },
+        { (__FlashStringHelper *)decimal_sym,  &Forth::decimal },
+        { (__FlashStringHelper *)binary_sym,   &Forth::binary  },
+        { (__FlashStringHelper *)Udot_sym,     &Forth::Udot    },
+        { (__FlashStringHelper *)dotR_sym,     &Forth::dotR    },
+        { (__FlashStringHelper *)lessSharp_sym, &Forth::lessSharp },
+        { (__FlashStringHelper *)sharp_sym,    &Forth::sharp   },
+        { (__FlashStringHelper *)sharpS_sym,   &Forth::sharpS  },
+        { (__FlashStringHelper *)hold_sym,     &Forth::holdChar },
+        { (__FlashStringHelper *)sign_sym,     &Forth::sign    },
+        { (__FlashStringHelper *)sharpGreater_sym, &Forth::sharpGreater },
+        { (__FlashStringHelper *)type_sym,     &Forth::type    },
+        { (__FlashStringHelper *)allot_sym,    &Forth::allot   },
+        { (__FlashStringHelper *)cells_sym,    &Forth::cells   },
+        { (__FlashStringHelper *)on_sym,       &Forth::on      },
+        { (__FlashStringHelper *)off_sym,      &Forth::off     },
+        { (__FlashStringHelper *)dotTrace_sym, &Forth::dotTrace },
+        { (__FlashStringHelper *)maxStack_sym, &Forth::maxStack },
+        { (__FlashStringHelper *)cAt_sym,      &Forth::cAt     },
+        { (__FlashStringHelper *)cBang_sym,    &Forth::cBang   },
+        { (__FlashStringHelper *)andd_sym,     &Forth::andd    },
+        { (__FlashStringHelper *)orr_sym,      &Forth::orr     },
+        { (__FlashStringHelper *)xorr_sym,     &Forth::xorr    },
+        { (__FlashStringHelper *)invert_sym,   &Forth::invert  },
+        { (__FlashStringHelper *)lshift_sym,   &Forth::lshift  },
+        { (__FlashStringHelper *)rshift_sym,   &Forth::rshift  },
+        { (__FlashStringHelper *)cset_sym,     &Forth::cset    },
+        { (__FlashStringHelper *)cclear_sym,   &Forth::cclear  },
+        { (__FlashStringHelper *)ctoggle_sym,  &Forth::ctoggle },
+        { (__FlashStringHelper *)ms_sym,       &Forth::ms      },
+        { (__FlashStringHelper *)us_sym,       &Forth::us      },
+        { (__FlashStringHelper *)ticks_sym,    &Forth::ticks   },
+        { (__FlashStringHelper *)execute_sym,  &Forth::execute },
+        { (__FlashStringHelper *)toR_sym,      &Forth::toR     },
+        { (__FlashStringHelper *)rFrom_sym,    &Forth::rFrom   },
+        { (__FlashStringHelper *)rFetch_sym,   &Forth::rFetch  },
+        { (__FlashStringHelper *)twoToR_sym,   &Forth::twoToR  },
+        { (__FlashStringHelper *)twoRFrom_sym, &Forth::twoRFrom },
+#ifdef WORD_PROFILE
+        { (__FlashStringHelper *)dotProfile_sym,  &Forth::dotProfile  },
+        { (__FlashStringHelper *)zeroProfile_sym, &Forth::zeroProfile },
+#endif
+#ifdef AOT_WORDS
+        // The words that src_x86/aot translated to C++ (see src/aot.h)
+        AOT_C_OPS
+#endif
         { (__FlashStringHelper *)sentinel_sym, &Forth::add     }
     };
 
@@ -614,7 +1475,7 @@ const Forth::BakedInCommand* Forth::iterate_on_C_ops(bool reset)
         idx = 0;
 
     const BakedInCommand* ret = &c_ops[idx++];
-    if (!strcasecmp_P("#@#@#", pgm_read_word_near(&ret->name))) {
+    if ((PGM_P) pgm_read_word_near(&ret->name) == sentinel_sym) {
         // We reached the sentinel - reset back to the beginning
         // for the next iteration.
         // Oh, and tell the caller we didn't find this symbol.
@@ -626,15 +1487,20 @@ const Forth::BakedInCommand* Forth::iterate_on_C_ops(bool reset)
 
 void Forth::reset()
 {
+    // No timer word may run, on the words we are about to forget
+    Timers::clear();
+
     definingVariable = false;
     definingConstant = false;
+    attachingTimer = false;
+    tickingWord = false;
+    definingDeferred = false;
+    settingDeferred = false;
     definingString = false;
     _dictionary_key.clear();
 
     // Remember, each list<T> instance has a globally-reused
     // freelist. Reset them all, for each one of our types.
-    forward_list<StackNode>::_freeList = NULL;
-    forward_list<StackNode>::_freeListMemory = 0;
     forward_list<CompiledNode>::_freeList = NULL;
     forward_list<CompiledNode>::_freeListMemory = 0;
     forward_list<LoopState>::_freeList = NULL;
@@ -644,24 +1510,57 @@ void Forth::reset()
     forward_list<DictionaryEntry>::_freeList = NULL;
     forward_list<DictionaryEntry>::_freeListMemory = 0;
 
-    // The IF stack also has some more global state
-    IfState::inside_IF_body = false;
-
     // ...as does the "." implementation...
     _dotNumberOfDigits = 0;
 
     // ...and all the lists...
     _stack.clear();
     _dict.clear();
+#ifdef JIT
+    // ...including the translations of the words that were in it...
+    Jit::clear();
+#endif
     _ifStates.clear();
     _loopStates.clear();
-
-    // ...and the CompiledNode's memory buffer...
-    CompiledNode::memory_clear();
+    _rdepth = 0;
+    _frame = 0;
+    forget_locals();
 
     // ...and the master Pool itself!
     Pool::clear();
 
+    // The CPU stack high-water mark, too.
+    stack_paint();
+
+#ifdef WORD_PROFILE
+    // (Which also zeroed the counters we now get out of it)
+    int builtins = 0;
+    while(C_op_at(builtins))
+        builtins++;
+    _builtinCounters = reinterpret_cast<WordCounter *>(
+        Pool::inner_alloc(builtins * sizeof(WordCounter)));
+#endif
+
+    // Pictured numbers are built in the Pool, too (see hold)
+    _hold = reinterpret_cast<char *>(Pool::inner_alloc(HOLD_SIZE));
+    hold_begin();
+
+    // BASE is a normal variable - we just keep a pointer to its
+    // storage, where the number parser can find it.
+    CompiledNodes baseNodes;
+    baseNodes.push_back(CompiledNode::makeVariable(NULL, 10));
+    _base = baseNodes.begin()->getVariableAddress();
+    _dict.push_back(DictionaryEntry(string(F("BASE")), baseNodes));
+    _dict.begin()->getCompiledNodes().begin()->_u._variable._dictPtr = &*_dict.begin();
+
+    // ...and so is TRACE; dispatching checks its storage directly.
+    _traceNext = _traceCount = 0;
+    CompiledNodes traceNodes;
+    traceNodes.push_back(CompiledNode::makeVariable(NULL, 0));
+    _tracing = traceNodes.begin()->getVariableAddress();
+    _dict.push_back(DictionaryEntry(string(F("TRACE")), traceNodes));
+    _dict.begin()->getCompiledNodes().begin()->_u._variable._dictPtr = &*_dict.begin();
+
     // Validate sanity (otherwise getWordName will never work!)
     const Forth::BakedInCommand *p = iterate_on_C_ops(true);
     while(p) {
@@ -691,25 +1590,93 @@ Forth::Forth()
     // main, and in the embedded-spaces, there-be-dragons.
 }
 
-// Parses input literal numbers (including hex ones, starting with '$')
-Optional<int> Forth::isnumber(const char * word)
+// The value of a digit in any base up to 36 - or -1 if it isn't one.
+static int digit_value(char c)
 {
-    if (0 == strlen(word))
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20; // Lower-case it
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Parses input literal numbers in the current BASE - or in the one
+// requested by a prefix: '$' for hex, '%' for binary, '#' for decimal.
+//
+// Done in a single pass over the word, with no strlen/strtol;
+// and since most words in a script are not numbers, we usually
+// bail out at the very first character.
+Optional<int> Forth::parse_number(const char *word)
+{
+    int base = *_base;
+    switch(*word) {
+    case '$': base = 16; word++; break;
+    case '%': base = 2;  word++; break;
+    case '#': base = 10; word++; break;
+    default:
+        // (No digits for bases beyond 36; nor can anything be written
+        //  in bases 0 and 1 - see radix)
+        if (base < 2 || base > 36)
+            return FAILURE;
+    }
+    bool negative = *word == '-';
+    if (negative)
+        word++;
+    if (!*word)
         return FAILURE;
-    const char *ptrStart = word;
-    char *ptrEnd;
-    int base = 10;
-    if (word[0] == '$') { // hex numbers
-        ptrStart++;
-        base = 16;
-    } else if (word[0] == '%') { // binary numbers
-        ptrStart++;
-        base = 2;
+    // Accumulate in unsigned, to wrap around like strtol-ing into an int did
+    unsigned val = 0;
+    do {
+        int digit = digit_value(*word);
+        if (digit < 0 || digit >= base)
+            return FAILURE;
+        val = val*base + digit;
+    } while(*++word);
+    return negative ? -(int)val : (int)val;
+}
+
+// Does a word use letters - digits above 9, in a BASE beyond 10?
+static bool has_letter_digits(const char *word)
+{
+    for(; *word; word++)
+        if (digit_value(*word) >= 10)
+            return true;
+    return false;
+}
+
+// Figure out what an input word is: a natively-implemented word,
+// something from the dictionary, or a number. Both the compiler and
+// the interpreter use this - so we only look at each word once.
+//
+// Words come first, as in any Forth: in HEX, "cafe" and "DUP" must
+// still be words (if there are such), not numbers. But a number spelled
+// with decimal digits alone is always that number (a word named "42"
+// would never be called) - so literals, the bulk of the numbers in a
+// script, skip both lookups.
+Forth::Token Forth::classify(const char *word)
+{
+    Token token;
+    auto numericValue = parse_number(word);
+    if (!numericValue || has_letter_digits(word)) {
+        token._u._pCmd = lookup_C(word);
+        if (token._u._pCmd) {
+            token._kind = Token::BUILTIN;
+            return token;
+        }
+        token._u._dictPtr = lookup(word);
+        if (token._u._dictPtr) {
+            token._kind = Token::USER_WORD;
+            return token;
+        }
     }
-    long val = strtol(ptrStart, &ptrEnd, base);
-    if (ptrEnd == &word[strlen(word)])
-        return (int)val;
-    return FAILURE;
+    if (numericValue) {
+        token._kind = Token::NUMBER;
+        token._u._intVal = numericValue.value();
+        return token;
+    }
+    token._kind = Token::NOT_FOUND;
+    return token;
 }
 
 // To print strings without wasting space to store them as we 
@@ -736,8 +1703,14 @@ void Forth::undoStrtok(char *word)
 // Since this can fail, we return an Optional<CompiledNode>.
 Optional<CompiledNode> Forth::compile_word(const char *word)
 {
-    auto numericValue = isnumber(word);
-    if (!definingString && !strcmp(word, ".\"")) {
+    if (tickingWord) {
+        // The word after ['] - compile its execution token
+        tickingWord = false;
+        return compile_XT(word);
+    } else if (!definingString && !strcmp(word, "[']")) {
+        tickingWord = true;
+        return CompiledNode::makeUnknown();
+    } else if (!definingString && !strcmp(word, ".\"")) {
         definingString = true;
         startOfString = NULL;
         // Strings start their lives as UNKNOWN kind.
@@ -761,26 +1734,274 @@ Optional<CompiledNode> Forth::compile_word(const char *word)
             // not used, just continue
             return CompiledNode::makeUnknown();
         }
-    } else if (numericValue) {
-        return CompiledNode::makeLiteral(numericValue.value());
-    } else {
-        // First, check if it is one of the natively-implemented words
-        auto pCmd = lookup_C(word);
-        if (pCmd) {
-            return CompiledNode::makeCFunction(
-                reinterpret_cast<const char *>(pgm_read_word_near(&pCmd->name)),
-                reinterpret_cast<CompiledNode::FuncPtr>(pgm_read_word_near(&pCmd->funcPtr)));
+    } else if (definingLocals) {
+        return declare_local(word);
+    } else if (!strcmp(word, "{:")) {
+        // Only first: run_full_phrase looks for the frame there, and
+        // nothing can jump back to before it (a DO, say) to open it twice.
+        if (_localCount || !_wordBeingCompiled->getCompiledNodes().empty()) {
+            error(F("{: must come first in a definition (and only once)"));
+            return FAILURE;
+        }
+        definingLocals = true;
+        return CompiledNode::makeUnknown();
+    } else if (storingLocal) {
+        storingLocal = false;
+        int slot = local_slot(word);
+        if (slot < 0) {
+            error(F("TO needs a local; not "), word);
+            return FAILURE;
         }
-        // Nope, not a native command - it must be in the dictionary:
-        auto it = lookup(word);
-        if (!it) {
+        return CompiledNode::makeLocal(CompiledNode::TO_LOCAL, slot);
+    } else if (_localCount && !strcasecmp(word, "to")) {
+        storingLocal = true;
+        return CompiledNode::makeUnknown();
+    } else if (_localCount && local_slot(word) >= 0) {
+        // Locals hide any words of the same name
+        return CompiledNode::makeLocal(CompiledNode::LOCAL, local_slot(word));
+    } else if (!strcasecmp(word, "case")) {
+        // These four only make sense inside a definition; and where
+        // they jump to, we'll only know at its end (see resolve_cases).
+        return CompiledNode::makeControl(CompiledNode::CASE);
+    } else if (!strcasecmp(word, "of")) {
+        return CompiledNode::makeControl(CompiledNode::OF);
+    } else if (!strcasecmp(word, "endof")) {
+        return CompiledNode::makeControl(CompiledNode::ENDOF);
+    } else if (!strcasecmp(word, "endcase")) {
+        return CompiledNode::makeControl(CompiledNode::ENDCASE);
+    } else if (!strcasecmp(word, "recurse")) {
+        // A direct call to the word being defined (which, since ':'
+        // already put it in the dictionary, is also what its name gives).
+        return CompiledNode::makeWord(_wordBeingCompiled);
+    } else {
+        auto token = classify(word);
+        switch(token._kind) {
+        case Token::NUMBER:
+            return CompiledNode::makeLiteral(token._u._intVal);
+        case Token::BUILTIN:
+            // One of the natively-implemented words
+            return compile_C_op(token._u._pCmd);
+        case Token::USER_WORD:
+            // Nope, not a native command - it is in the dictionary:
+            return CompiledNode::makeWord(token._u._dictPtr);
+        default:
             error(F("Unknown word:"), word);
             return FAILURE;
         }
-        return CompiledNode::makeWord(it);
     }
 }
 
+// Everything between {: and :}
+Optional<CompiledNode> Forth::declare_local(const char *word)
+{
+    if (!strcmp(word, ":}")) {
+        definingLocals = localsUninitialized = localsComment = false;
+        if (!_localCount)
+            return CompiledNode::makeUnknown();
+        return CompiledNode::makeLocals(_localCount, _localInitialized);
+    }
+    if (localsComment)
+        return CompiledNode::makeUnknown();
+    if (!strcmp(word, "--"))
+        localsComment = true;
+    else if (!strcmp(word, "|"))
+        localsUninitialized = true;
+    else {
+        size_t len = strlen(word);
+        if (_localCount == MAX_LOCALS ||
+                _localNamesUsed + len + 1 > sizeof(_localNames)) {
+            error(F("Too many locals (see MAX_LOCALS, LOCAL_NAMES_SIZE)"));
+            return FAILURE;
+        }
+        strcpy(&_localNames[_localNamesUsed], word);
+        _localNamesUsed += len + 1;
+        _localCount++;
+        if (!localsUninitialized)
+            _localInitialized++;
+    }
+    return CompiledNode::makeUnknown();
+}
+
+// Which of the locals of the word being compiled is this? (-1: none)
+int Forth::local_slot(const char *word)
+{
+    const char *name = _localNames;
+    for(int slot=0; slot<_localCount; slot++) {
+        if (!strcasecmp(word, name))
+            return slot;
+        name += strlen(name) + 1;
+    }
+    return -1;
+}
+
+// Once the definition is over, its locals' names mean nothing
+void Forth::forget_locals()
+{
+    definingLocals = localsUninitialized = localsComment = storingLocal = false;
+    _localNamesUsed = _localCount = _localInitialized = 0;
+}
+
+// A CASE whose ENDCASE we haven't met yet
+struct CaseFrame {
+    CompiledNodes::box *_case;
+    CompiledNodes::box *_pendingOf;  // an OF still waiting for its ENDOF
+    CompiledNodes::box *_endofs;     // the ENDOFs so far, chained through
+                                     // their _target (until the ENDCASE)
+    unsigned _ofs;
+};
+
+SuccessOrFailure Forth::resolve_cases(CompiledNodes& nodes)
+{
+    CaseFrame frames[MAX_CASE_NESTING];
+    unsigned depth = 0;
+    for(auto it = nodes.begin(); it != nodes.end(); ++it) {
+        CaseFrame *f = depth ? &frames[depth-1] : NULL;
+        switch(it->_kind) {
+        case CompiledNode::CASE:
+            if (depth == MAX_CASE_NESTING)
+                return error(F("CASEs nested too deep (see MAX_CASE_NESTING)"));
+            f = &frames[depth++];
+            f->_case = it._p;
+            f->_pendingOf = f->_endofs = NULL;
+            f->_ofs = 0;
+            break;
+        case CompiledNode::OF:
+            if (!f || f->_pendingOf)
+                return error(F("OF needs a CASE - or an ENDOF, for the previous OF"));
+            f->_pendingOf = it._p;
+            f->_ofs++;
+            break;
+        case CompiledNode::ENDOF:
+            if (!f || !f->_pendingOf)
+                return error(F("ENDOF needs an OF"));
+            // A mismatching OF skips its body, and this ENDOF
+            f->_pendingOf->_data._u._branch._target = it.next();
+            f->_pendingOf = NULL;
+            it->_u._branch._target = f->_endofs;
+            f->_endofs = it._p;
+            break;
+        case CompiledNode::ENDCASE:
+            if (!f || f->_pendingOf)
+                return error(F("ENDCASE needs a CASE - and an ENDOF, for the last OF"));
+            // The ENDOFs skip the ENDCASE, too: their OF consumed the value
+            while(f->_endofs) {
+                CompiledNodes::box *next = f->_endofs->_data._u._branch._target;
+                f->_endofs->_data._u._branch._target = it.next();
+                f->_endofs = next;
+            }
+            build_case_table(f->_case, f->_ofs);
+            depth--;
+            break;
+        default:
+            break;
+        }
+    }
+    if (depth)
+        return error(F("CASE needs an ENDCASE"));
+    return SUCCESS;
+}
+
+// The value of "<v> OF" - if it is known before running it.
+// Constants count, too: nothing can change them once defined.
+static bool value_of_node(CompiledNode& node, int& value)
+{
+    if (node._kind == CompiledNode::LITERAL) {
+        value = node._u._literal._intVal;
+        return true;
+    }
+    if (node._kind == CompiledNode::WORD) {
+        CompiledNodes& body = node._u._word._dictPtr->getCompiledNodes();
+        if (!body.empty() && body.begin()->_kind == CompiledNode::CONSTANT) {
+            value = body.begin()->_u._constant._intVal;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Forth::build_case_table(CompiledNodes::box *caseBox, unsigned ofs)
+{
+    if (ofs < CASE_TABLE_MIN_OFS)
+        return;
+    // Each OF must directly follow its ENDOF (or the CASE), with just a
+    // known value in between; any other code there, and we can't jump
+    // past it. Walk the OFs via their (already resolved) targets...
+    int lo = 0, hi = 0, value;
+    CompiledNodes::box *p = caseBox->_next;
+    for(unsigned n=0; n<ofs; n++) {
+        if (!p || !value_of_node(p->_data, value) ||
+                !p->_next || p->_next->_data._kind != CompiledNode::OF)
+            return;
+        if (!n || value < lo)
+            lo = value;
+        if (!n || value > hi)
+            hi = value;
+        p = p->_next->_data._u._branch._target;
+    }
+    // ...and see if they are dense enough to be worth a table.
+    long span = (long) hi - (long) lo + 1;
+    if (span > (long) CASE_TABLE_DENSITY * (long) ofs)
+        return;
+    size_t size = sizeof(CaseTable) + (span - 1)*sizeof(CompiledNodes::box *);
+    if (!Pool::has_room(size + POOL_SAFETY_MARGIN))
+        return; // The OFs still work; just not in constant time
+    CaseTable *table = reinterpret_cast<CaseTable *>(Pool::inner_alloc(size));
+    table->_min = lo;
+    table->_count = (unsigned) span;
+    for(unsigned slot=0; slot<table->_count; slot++)
+        table->_targets[slot] = NULL;
+    p = caseBox->_next;
+    for(unsigned n=0; n<ofs; n++) {
+        value_of_node(p->_data, value);
+        CompiledNodes::box *ofBox = p->_next;
+        // If a value repeats, the first OF wins - as it would, comparing
+        unsigned slot = (unsigned) (value - lo);
+        if (!table->_targets[slot])
+            table->_targets[slot] = ofBox->_next;
+        p = ofBox->_data._u._branch._target;
+    }
+    // Whatever follows the last ENDOF is the default code
+    table->_default = p;
+    caseBox->_data._u._case._table = table;
+}
+
+// Run a natively-implemented word, outside of any compiled phrase.
+//
+// A bit complex - but:
+//
+// - We need to read the funcPtr from the BakedInCommand.
+// - That command - pointed-to by pCmd - is stored in Flash,
+//   so we need to read it via pgm_read_word_near.
+// - Once we get it, type-system wise it's just a 16bit value
+// - ...so we cast it to FuncPtr. and call it!
+// - But... what will we call it with? The FuncPtrs are
+//   supposed to expect an iterator (because they can
+//   "move" the instruction pointer as we iterate inside
+//   CompiledNodes)
+// - In this case however, we are interpreting (or EXECUTE-ing).
+// - ...so just call the function with a dummy iterator.
+SuccessOrFailure Forth::run_C_op(const BakedInCommand *pCmd)
+{
+    CompiledNodes foo;
+    PROFILE_SCOPE(MARK_NATIVE, pgm_read_word_near(&pCmd->name));
+    COUNT_SCOPE(builtin_counter(pCmd - C_op_at(0)));
+    return bool(
+        ((CompiledNode::FuncPtr)pgm_read_word_near(&pCmd->funcPtr))(foo.begin())) ? SUCCESS : FAILURE;
+}
+
+// A word failed, somewhere inside it - so it never got to
+// the THENs, LOOPs, R>s and closing of locals frames that
+// would have cleaned up after it.
+void Forth::abandon_phrase()
+{
+    while(!_ifStates.empty())
+        _ifStates.pop_front();
+    while(!_loopStates.empty())
+        _loopStates.pop_front();
+    _rdepth = 0;
+    _frame = 0;
+}
+
 SuccessOrFailure Forth::interpret(const char *word)
 {
     if (definingString) {
@@ -804,44 +2025,53 @@ SuccessOrFailure Forth::interpret(const char *word)
         if (_stack.empty())
             return error(F("You forgot to initialise the constant..."));
         definingConstant = true;
+    } else if (!strcmp(word, "'") || !strcmp(word, "[']")) {
+        tickingWord = true;
+    } else if (!strcasecmp(word, "defer")) {
+        definingDeferred = true;
+    } else if (!strcasecmp(word, "is")) {
+        if (_stack.empty())
+            return error(F("IS needs an execution token on the stack..."));
+        settingDeferred = true;
+    } else if (!strcasecmp(word, "every")) {
+        // "500 EVERY heartbeat" - the period must already be there
+        if (_stack.empty())
+            return error(F("EVERY needs the period (in ms) on the stack..."));
+        attachingTimer = true;
     } else if (!definingString && !strcmp(word, ".\"")) {
         definingString = true;
         startOfString = NULL;
     } else {
         // if we are not defining a string, a constant or a variable,
-        auto numericValue = isnumber(word);
-        if (numericValue)
+        auto token = classify(word);
+        switch(token._kind) {
+        case Token::NUMBER:
             // then we are either a number...
-            _stack.push_back(StackNode::makeNr(numericValue.value()));
-        else {
-            // ...or a natively-implemented function...
-            auto pCmd = lookup_C(word);
-            if (pCmd) {
-                // A bit complex - but:
-                //
-                // - We need to read the funcPtr from the BakedInCommand.
-                // - That command - pointed-to by pCmd - is stored in Flash,
-                //   so we need to read it via pgm_read_word_near.
-                // - Once we get it, type-system wise it's just a 16bit value
-                // - ...so we cast it to FuncPtr. and call it!
-                // - But... what will we call it with? The FuncPtrs are 
-                //   supposed to expect an iterator (because they can 
-                //   "move" the instruction pointer as we iterate inside
-                //   CompiledNodes)
-                // - In this case however, we are interpreting, not compiling.
-                // - ...so just call the function with a dummy iterator.
-                CompiledNodes foo;
-                return bool(
-                    ((CompiledNode::FuncPtr)pgm_read_word_near(&pCmd->funcPtr))(foo.begin())) ? SUCCESS : FAILURE;
+            _stack.push(token._u._intVal);
+            break;
+        case Token::BUILTIN:
+            // ...or a natively-implemented function (EXECUTE
+            // can fail deep inside the word it runs)...
+            if (!run_C_op(token._u._pCmd)) {
+                abandon_phrase();
+                return FAILURE;
             }
-
+            break;
+        case Token::USER_WORD: {
             // ...or we must already exist in the dictionary:
-            auto ptrWord = lookup(word);
-            if (!ptrWord)
-                return error(F("No such symbol found: "), word);
-            if (!CompiledNode::run_full_phrase(ptrWord->getCompiledNodes()))
+            PROFILE_SCOPE(MARK_WORD, token._u._dictPtr->name());
+            COUNT_SCOPE(token._u._dictPtr->_counter);
+            if (!CompiledNode::run_full_phrase(token._u._dictPtr)) {
+                abandon_phrase();
                 return FAILURE;
+            }
+            break;
         }
+        default:
+            return error(F("No such symbol found: "), word);
+        }
+        if (_stack._overflowed)
+            return stack_overflow();
     }
     return SUCCESS;
 }
@@ -849,6 +2079,30 @@ SuccessOrFailure Forth::interpret(const char *word)
 // Set just once and re-used from global space
 const char resetCmd[] PROGMEM = { "reset" };
 
+// A half-wired word must not be callable
+void Forth::abandon_definition()
+{
+    if (_wordBeingCompiled) {
+        while(!_wordBeingCompiled->getCompiledNodes().empty())
+            _wordBeingCompiled->getCompiledNodes().pop_front();
+        _dict.pop_front();
+        _wordBeingCompiled = NULL;
+    }
+    _compiling = false;
+    _dictionary_key.clear();
+    forget_locals();
+}
+
+// Whatever we were in the middle of, we can't finish it.
+SuccessOrFailure Forth::pool_full()
+{
+    if (_compiling)
+        abandon_definition();
+    definingVariable = definingConstant = attachingTimer = false;
+    tickingWord = definingDeferred = settingDeferred = false;
+    return error(F("The Pool is full; RESET, to make room..."));
+}
+
 SuccessOrFailure Forth::parse_line(char *begin, char *end)
 {
     const char *word=begin;
@@ -868,9 +2122,13 @@ SuccessOrFailure Forth::parse_line(char *begin, char *end)
         if (*word == '\\') {
             // Forth comments - ignore them.
             break;
+        } else if (!Pool::has_room(POOL_SAFETY_MARGIN) &&
+                strcasecmp_P(word, resetCmd)) {
+            return pool_full();
         } else if (*word == ':' && *(word+1) == '\0' && !_compiling) {
             _compiling = true;
             _wordBeingCompiled = NULL;
+            forget_locals();
         } else if (*word == ';' && *(word+1) == '\0' && _compiling) {
             _compiling = false;
             _dictionary_key.clear();
@@ -880,13 +2138,26 @@ SuccessOrFailure Forth::parse_line(char *begin, char *end)
                 return error(F("You didn't finish defining the constant..."));
             if (definingString)
                 return error(F("You didn't finish defining the string! Enter the missing quote."));
+            bool unfinishedLocals = definingLocals || storingLocal;
+            forget_locals();
+            if (unfinishedLocals)
+                (void) error(F("You didn't finish declaring the locals (:}) - or a TO..."));
             // We need to reverse the order of words, since we 'push_back'-ed them along...
+            // (each popped node is pushed right back: no new Pool space)
+            CompiledNodes& compiled = _wordBeingCompiled->getCompiledNodes();
             forward_list<CompiledNode> swapperList;
-            for(auto& compNode1: _wordBeingCompiled->getCompiledNodes())
+            while(!compiled.empty()) {
+                CompiledNode compNode1 = *compiled.begin();
+                compiled.pop_front();
                 swapperList.push_back(compNode1);
-            while(!_wordBeingCompiled->getCompiledNodes().empty())
-                _wordBeingCompiled->getCompiledNodes().pop_front();
-            _wordBeingCompiled->getCompiledNodes() = swapperList;
+            }
+            compiled = swapperList;
+            // Only now, that the nodes are in place, can CASEs find their way.
+            if (unfinishedLocals || !resolve_cases(compiled) ||
+                    !verify(_wordBeingCompiled)) {
+                abandon_definition();
+                return FAILURE;
+            }
         } else {
             if (_compiling) {
                 if (_dictionary_key.empty()) {
@@ -951,6 +2222,47 @@ SuccessOrFailure Forth::parse_line(char *begin, char *end)
                         _dictionary_key.clear();
                     }
                     definingVariable = false;
+                } else if (attachingTimer) {
+                    attachingTimer = false;
+                    auto ret = evaluate_stack_top(
+                        F("[x] Failure computing the period..."));
+                    if (!ret)
+                        break;
+                    if (ret.value() < 0)
+                        return error(F("EVERY needs a positive period (or 0 to stop)"));
+                    DictionaryPtr p = lookup(word);
+                    if (!p)
+                        return error(F("EVERY needs a word from the dictionary; not "), word);
+                    if (!Timers::attach(p, ret.value()))
+                        break;
+                } else if (tickingWord) {
+                    tickingWord = false;
+                    auto ret = compile_XT(word);
+                    if (!ret)
+                        break;
+                    _stack.push(ret.value()._u._xt._xt);
+                } else if (definingDeferred) {
+                    definingDeferred = false;
+                    // A deferred word is a single DEFERRED node;
+                    // with nothing to execute yet, until IS sets it.
+                    CompiledNodes tmp;
+                    tmp.push_back(CompiledNode::makeDeferred(NULL, 0));
+                    _dictionary_key = string(word);
+                    _dict.push_back(DictionaryEntry(_dictionary_key, tmp));
+                    _dict.begin()->_deferred = true;
+                    _dictionary_key.clear();
+                } else if (settingDeferred) {
+                    settingDeferred = false;
+                    DictionaryPtr p = lookup(word);
+                    if (!p || !p->_deferred)
+                        return error(F("IS needs a DEFER-ed word; not "), word);
+                    auto xt = evaluate_stack_top(F("IS needs an execution token"));
+                    if (!xt)
+                        break;
+                    if (!is_xt(xt.value()))
+                        return error(F("IS needs an execution token"));
+                    *p->getCompiledNodes().begin() =
+                        CompiledNode::makeDeferred(word_of_xt(xt.value()), xt.value());
                 } else {
                     if (!definingString && !strcasecmp_P(word, resetCmd)) {
                         reset();
@@ -965,6 +2277,14 @@ SuccessOrFailure Forth::parse_line(char *begin, char *end)
     }
     if (definingVariable)
         return error(F("You didn't finish defining the variable..."));
+    if (tickingWord || definingDeferred || settingDeferred) {
+        tickingWord = definingDeferred = settingDeferred = false;
+        return error(F("Missing the name of the word, at the end of the line..."));
+    }
+    if (attachingTimer) {
+        attachingTimer = false;
+        return error(F("EVERY needs the name of the word to run..."));
+    }
     if (definingConstant)
         return error(F("You didn't finish defining the constant..."));
     if (definingString)
@@ -975,19 +2295,41 @@ SuccessOrFailure Forth::parse_line(char *begin, char *end)
 }
 
 // Define all class-globals (i.e. static-s)
-int CompiledNode::_memory[MEMORY_SIZE] = {0};
-unsigned CompiledNode::_currentMemoryOffset = 0;
 StackNodes Forth::_stack;
 DictionaryType Forth::_dict;
 LoopsStates Forth::_loopStates;
+StackNode Forth::_rstack[RSTACK_SIZE];
+uint8_t Forth::_rdepth = 0;
+uint8_t Forth::_frame = 0;
 IfStates Forth::_ifStates;
-bool IfState::inside_IF_body = false;
 int Forth::_dotNumberOfDigits = 0;
+int *Forth::_tracing = NULL;
+Forth::TraceRecord Forth::_trace[TRACE_SIZE];
+unsigned Forth::_traceNext = 0;
+unsigned Forth::_traceCount = 0;
+#ifdef WORD_PROFILE
+WordCounter *Forth::_builtinCounters = NULL;
+#endif
+int *Forth::_base = NULL;
+char *Forth::_hold = NULL;
+char *Forth::_holdPtr = NULL;
 bool Forth::_compiling = false;
 DictionaryPtr Forth::_wordBeingCompiled = NULL;
 bool Forth::definingConstant = false;
 bool Forth::definingVariable = false;
+bool Forth::attachingTimer = false;
+bool Forth::tickingWord = false;
+bool Forth::definingDeferred = false;
+bool Forth::settingDeferred = false;
 bool Forth::definingString = false;
+bool Forth::definingLocals = false;
+bool Forth::localsUninitialized = false;
+bool Forth::localsComment = false;
+bool Forth::storingLocal = false;
+char Forth::_localNames[LOCAL_NAMES_SIZE];
+uint8_t Forth::_localNamesUsed = 0;
+uint8_t Forth::_localCount = 0;
+uint8_t Forth::_localInitialized = 0;
 const char *Forth::startOfString = NULL;
 Word Forth::_dictionary_key;
 
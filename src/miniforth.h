@@ -3,21 +3,43 @@
 
 #include "mini_stl.h"
 #include "defines.h"
+#include "word_profile.h"
 
-class StackNode;
 class CompiledNode;
 
 typedef string Word;
-typedef forward_list<StackNode> StackNodes;
+// What our run-time Forth stack holds: raw cells - a number, or an
+// address (as ptr_to_cell makes them; a variable pushes its own).
+typedef int StackNode;
+typedef array_stack<StackNode, DSTACK_SIZE> StackNodes;
 typedef forward_list<CompiledNode> CompiledNodes;
+
+// What ';' could prove about a word's use of the stack (see verify.cpp)
+struct StackEffect {
+    enum { UNVERIFIED = 0xFF };
+    uint8_t _in;        // the cells it takes - or UNVERIFIED
+    int8_t _out;        // how many more it leaves than it took
+    bool _touchesIf;    // it (or a word it calls) runs an IF
+};
+
 class DictionaryEntry : private tuple<Word, CompiledNodes> {
 public:
     DictionaryEntry(const Word& name, const CompiledNodes& nodes) {
         this->_t1 = name;
         this->_t2 = nodes;
+        _effect._in = StackEffect::UNVERIFIED;
+        _deferred = false;
+#ifdef WORD_PROFILE
+        _counter.clear();
+#endif
     }
     const char *name() { return _t1.c_str(); }
     CompiledNodes& getCompiledNodes() { return _t2; }
+    StackEffect _effect;
+    bool _deferred;     // made by DEFER - the only kind IS may re-point
+#ifdef WORD_PROFILE
+    WordCounter _counter;
+#endif
 };
 typedef DictionaryEntry* DictionaryPtr;
 typedef forward_list<DictionaryEntry> DictionaryType;
@@ -37,13 +59,14 @@ typedef forward_list<LoopState> LoopsStates;
 
 typedef struct IfState {
     bool _lastIfTruth;
-    IfState(bool b):_lastIfTruth(b) {}
+    // Each IF its own: a word called (or RECURSE-d into) from within
+    // our IF body may well end inside its own ELSE body.
+    bool _insideIfBody;
+    IfState(bool b):_lastIfTruth(b), _insideIfBody(true) {}
     bool wasTrue() { return _lastIfTruth; }
-    static bool inside_IF_body;
 } IfState;
 typedef forward_list<IfState> IfStates;
 
-#include "stack_node.h"
 #include "compiled_node.h"
 
 // The proliferation of 'static' is because, frankly...
@@ -55,6 +78,11 @@ typedef forward_list<IfState> IfStates;
 //
 class Forth
 {
+#ifdef __NATIVE_BUILD__
+    // (The host can have many, though: see src_x86/forth_vm.h)
+    friend class ForthVM;
+#endif
+
     // The currently being populated dictionary key
     static Word _dictionary_key;
 
@@ -65,9 +93,25 @@ class Forth
     // Interpreter state-machine-related variables
     static bool definingConstant;
     static bool definingVariable;
+    static bool attachingTimer;
+    static bool tickingWord;       // after ' (or ['] in a definition)
+    static bool definingDeferred;  // after DEFER
+    static bool settingDeferred;   // after IS
     static bool definingString;
     static const char *startOfString;
 
+    // Locals, while compiling: between {: and :} we are declaring them -
+    // after a | without initial values, and after -- just skipping the
+    // comment. Their names are kept (NUL-separated) until the ';'.
+    static bool definingLocals;
+    static bool localsUninitialized;
+    static bool localsComment;
+    static bool storingLocal;      // after TO
+    static char _localNames[LOCAL_NAMES_SIZE];
+    static uint8_t _localNamesUsed;
+    static uint8_t _localCount;
+    static uint8_t _localInitialized;
+
     // The words that have a C++ implementation
     typedef struct tag_BakedInCommand {
         // Naturally, the name is stored in Flash.
@@ -83,10 +127,24 @@ class Forth
     //
     // So... workaround (see implementation for details)
     static const BakedInCommand* iterate_on_C_ops(bool reset=false);
+    static const BakedInCommand* C_op_at(int idx);
+    static CompiledNode compile_C_op(const BakedInCommand *pCmd);
+
+    // What an input word turned out to be, after a single pass over it.
+    typedef struct Token {
+        enum TokenKind { NOT_FOUND, NUMBER, BUILTIN, USER_WORD } _kind;
+        union TokenData {
+            int _intVal;
+            const BakedInCommand *_pCmd;
+            DictionaryPtr _dictPtr;
+        } _u;
+    } Token;
 
 public:
     // The execution stack
     static StackNodes _stack;
+    // ...and the error of a push that found it full.
+    static SuccessOrFailure stack_overflow();
 
     // All the known words
     static DictionaryType _dict;
@@ -98,12 +156,55 @@ public:
     // The do/loop stack
     static LoopsStates _loopStates;
 
+    // The return stack (">R", "R>", "R@"): a plain array, not a list -
+    // parking a value there costs no allocation. It is separate from
+    // the do/loop stack, so I and J still work while values are parked.
+    static StackNode _rstack[RSTACK_SIZE];
+    static uint8_t _rdepth;
+    // ...which also hosts the locals of the running word, from here on.
+    static uint8_t _frame;
+
     // The if/else/then stack
     static IfStates _ifStates;
 
     // The number of columns to span over for the next "."
     static int _dotNumberOfDigits;
 
+    // The radix used to parse and print numbers - the BASE variable's storage
+    static int *_base;
+
+    // Pictured numeric output ("<# # #S #>").
+    // Digits are HOLD-ed right-to-left, from the end of _hold backwards.
+    // Its HOLD_SIZE bytes are in the Pool, so what "#>" leaves is an
+    // address that TYPE (see address_of) can take.
+    static char *_hold;
+    static char *_holdPtr;
+    static void hold_begin();
+    static SuccessOrFailure hold(char c);
+    static unsigned hold_digit(unsigned u);
+    static unsigned radix();
+    // Emit a number in BASE, right-aligned in (at least) 'width' columns.
+    // No vsnprintf, no Pool - this is a hot path.
+    static void print_number(int value, bool isSigned, int width);
+
+    // The execution trace: the last TRACE_SIZE CompiledNodes we ran.
+    // _tracing points to the storage of the TRACE variable ("TRACE ON").
+    // Recording one must be cheap; so we keep what the node has at hand,
+    // and only turn it into an id (see TRACE_LITERAL, etc) in .TRACE.
+    typedef struct TraceRecord {
+        uint8_t _kind;    // the node's CompiledNode kind...
+        int _raw;         // ...its c_ops index, or its word's entry (a cell)
+        uint8_t _depth;   // stack depth (saturated)...
+        int _tos;         // ...and the top of the stack, before we ran it
+    } TraceRecord;
+    static int *_tracing;
+    static TraceRecord _trace[TRACE_SIZE];
+    static unsigned _traceNext, _traceCount;
+    static void trace(CompiledNode& node);
+    static uint16_t trace_id(const TraceRecord& rec);
+    // ...and for the decoding side, the names of the natively-implemented words.
+    static const char *name_of_C_op(int idx);
+
     static EvalResult evaluate_stack_top(const __FlashStringHelper *errorMessage);
     static bool commonArithmetic(int& v1, int& v2, const __FlashStringHelper *msg);
     static CompiledNode::ExecuteResult add(CompiledNodes::iterator it);
@@ -133,17 +234,133 @@ public:
     static CompiledNode::ExecuteResult then(CompiledNodes::iterator it);
     static CompiledNode::ExecuteResult swap(CompiledNodes::iterator it);
     static CompiledNode::ExecuteResult rot(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult hex(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult decimal(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult binary(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult Udot(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult dotR(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult lessSharp(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult sharp(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult sharpS(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult holdChar(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult sign(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult sharpGreater(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult type(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult allot(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult cells(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult on(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult off(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult dotTrace(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult maxStack(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult cAt(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult cBang(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult andd(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult orr(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult xorr(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult invert(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult lshift(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult rshift(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult cset(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult cclear(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult ctoggle(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult ms(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult us(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult ticks(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult execute(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult toR(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult rFrom(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult rFetch(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult twoToR(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult twoRFrom(CompiledNodes::iterator it);
+
+    // What verified words are compiled against: the same as the above,
+    // minus the checks that the stack has what they need (see verify.cpp)
+    static CompiledNode::ExecuteResult add_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult sub_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult mul_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult equal_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult greater_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult less_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult andd_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult orr_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult xorr_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult lshift_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult rshift_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult invert_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult dup_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult drop_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult swap_unchecked(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult rot_unchecked(CompiledNodes::iterator it);
+    // ...and back: the checked variant of each (or itself, if it has none)
+    static CompiledNode::FuncPtr checked_variant(CompiledNode::FuncPtr funcPtr);
+    // Is what this verified word takes on the stack, so it can skip the checks?
+    static bool may_skip_checks(DictionaryPtr word);
+
+    // What the CASE, OF and ENDCASE nodes do (see resolve_cases)
+    static CompiledNode::ExecuteResult dispatch_case(
+        CaseTable *table, CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult of(
+        CompiledNodes::box *target, CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult endcase(CompiledNodes::iterator it);
+
+    // ...and what the LOCALS and TO_LOCAL nodes do.
+    static CompiledNode::ExecuteResult open_frame(
+        uint8_t count, uint8_t initialized, CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult to_local(int slot, CompiledNodes::iterator it);
+#ifdef WORD_PROFILE
+    static CompiledNode::ExecuteResult dotProfile(CompiledNodes::iterator it);
+    static CompiledNode::ExecuteResult zeroProfile(CompiledNodes::iterator it);
+
+    // The counters of the natively-implemented words, in c_ops order
+    static WordCounter *_builtinCounters;
+    static WordCounter& builtin_counter(int idx);
+#endif
 
 private:
-    static Optional<int> isnumber(const char * word);
+    static Optional<int> parse_number(const char *word);
+    static Token classify(const char *word);
     static Optional<int> needs_a_number(const __FlashStringHelper *msg);
+    static Optional<uint8_t *> address_of(int addr, size_t bytes);
+
+    // Execution tokens: what ' leaves on the stack, and EXECUTE runs.
+    // A natively-implemented word's token is -1 minus its index in c_ops;
+    // a dictionary word's is its (cell-sized) address - which is positive.
+    static Optional<CompiledNode> compile_XT(const char *word);
+    static DictionaryPtr word_of_xt(int xt);
+    static bool is_xt(int xt);
+    static SuccessOrFailure execute_xt(int xt);
+    static SuccessOrFailure run_C_op(const BakedInCommand *pCmd);
+    static CompiledNode::ExecuteResult modify_byte(
+        CompiledNodes::iterator it, const __FlashStringHelper *msg,
+        bool clearMask, bool xorMask);
     static Optional<CompiledNode> compile_word(const char *word);
+    // Once a word's body is complete, point its CASE/OF/ENDOF nodes to
+    // where they jump to - and give the CASEs a jump table, if they can.
+    static SuccessOrFailure resolve_cases(CompiledNodes& nodes);
+    static void build_case_table(CompiledNodes::box *caseBox, unsigned ofs);
+    // ...and work out its stack effect; if it has a fixed one, compile it
+    // against the unchecked primitives. A word whose DOs and IFs don't
+    // pair up inside it is rejected (see verify.cpp).
+    static SuccessOrFailure verify(DictionaryPtr word);
+    static Optional<CompiledNode> declare_local(const char *word);
+    static int local_slot(const char *word);
+    static void forget_locals();
+    static void abandon_definition();
     static SuccessOrFailure interpret(const char *word);
     static void undoStrtok(char *word);
+    static Optional<CompiledNode> receive_node(char *scratch);
 
 public:
     Forth();
     static SuccessOrFailure parse_line(char *begin, char *end);
+    // A word failed: clean up the IFs and loops it left behind.
+    static void abandon_phrase();
+    // The error for when the Pool is down to POOL_SAFETY_MARGIN
+    static SuccessOrFailure pool_full();
+    static SuccessOrFailure receive_frame(char *scratch);
+    // What a DEFERRED node does (see compiled_node.h)
+    static SuccessOrFailure execute_deferred(DictionaryPtr word, int xt);
+    static bool is_compiling() { return _compiling; }
     static void reset();
 };
 
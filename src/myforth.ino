@@ -22,14 +22,29 @@ void loop()
     }
     if (!get(line))
         exit(0);
-    if (miniforth.parse_line(line, line + strlen(line)))
+    if (line[0] == FRAME_START) {
+        if (miniforth.receive_frame(line))
+            Serial.print(F(" OK\n"));
+    } else if (miniforth.parse_line(line, line + strlen(line)))
         Serial.print(F(" OK\n"));
+    stack_check();
 }
 
 #ifdef __NATIVE_BUILD__
 
+#ifdef DISPATCH_STATS
+// For testing/bench.py - stdout is busy with whatever Forth prints.
+static void report_dispatches()
+{
+    fprintf(stderr, "dispatches %lu\n", CompiledNode::_dispatches);
+}
+#endif
+
 int main()
 {
+#ifdef DISPATCH_STATS
+    atexit(report_dispatches);
+#endif
     setup();
     while(1) {
         loop();
@@ -0,0 +1,47 @@
+#ifndef __PROFILE_MARKS_H__
+#define __PROFILE_MARKS_H__
+
+// Cycle-accurate profiling, under simavr (see testing/avr_profile.c).
+//
+// In a profiling build (-DPROFILE_MARKS; see 'make profile-simulator')
+// we mark the entry to - and exit from - every word we run, plus
+// some of our own machinery (run_full_phrase, flash_printf, the lists).
+//
+// A mark is the address of the name of what we enter, written in the
+// GPIOR2:GPIOR1 pair; followed by the kind of the mark, in GPIOR0.
+// These are general-purpose I/O registers that nothing else uses...
+// and writing to them takes a single cycle. The collector in simavr
+// watches GPIOR0, and timestamps each mark with the cycle counter.
+//
+// The collector includes this file, too - for the kinds of marks:
+#define MARK_WORD   1  // Entering a Forth word; its name is in SRAM
+#define MARK_NATIVE 2  // Entering native code;  its name is in Flash
+#define MARK_EXIT   3  // Leaving whatever we entered last
+
+#if defined(PROFILE_MARKS) && !defined(__NATIVE_BUILD__)
+
+#include <avr/io.h>
+
+struct ProfileScope {
+    ProfileScope(uint8_t kind, const void *name) {
+        uint16_t addr = (uint16_t) name;
+        GPIOR1 = addr & 0xFF;
+        GPIOR2 = addr >> 8;
+        GPIOR0 = kind;
+    }
+    ~ProfileScope() {
+        GPIOR0 = MARK_EXIT;
+    }
+};
+
+#define PROFILE_SCOPE(kind, name) \
+    ProfileScope profileScope(kind, reinterpret_cast<const void *>(name))
+
+#else
+
+// ...and in normal builds, there's no trace of them.
+#define PROFILE_SCOPE(kind, name)
+
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+#include <Arduino.h>
+
+#include "timers.h"
+#include "miniforth.h"
+#include "errors.h"
+
+Timers::Slot Timers::_slots[TIMER_SLOTS];
+volatile uint8_t Timers::_queue[TIMER_QUEUE];
+volatile uint8_t Timers::_head = 0;
+volatile uint8_t Timers::_tail = 0;
+bool Timers::_running = false;
+
+#ifndef __NATIVE_BUILD__
+
+#include <avr/interrupt.h>
+
+// While we change the slots, the ISR must not look at them.
+struct TickGuard {
+    uint8_t _sreg;
+    TickGuard():_sreg(SREG) { cli(); }
+    ~TickGuard() { SREG = _sreg; }
+};
+
+ISR(TIMER1_COMPA_vect)
+{
+    Timers::tick();
+}
+
+// Timer1 in CTC mode, clocked at F_CPU/64: a compare match every 1ms.
+void Timers::start_ticking()
+{
+    TickGuard guard;
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+    OCR1A = F_CPU / 64 / 1000 - 1;
+    TCNT1 = 0;
+    TIMSK1 |= _BV(OCIE1A);
+}
+
+#else
+
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+struct TickGuard {
+    sigset_t _old;
+    TickGuard() {
+        sigset_t alarm;
+        sigemptyset(&alarm);
+        sigaddset(&alarm, SIGALRM);
+        sigprocmask(SIG_BLOCK, &alarm, &_old);
+    }
+    ~TickGuard() { sigprocmask(SIG_SETMASK, &_old, NULL); }
+};
+
+static void on_alarm(int)
+{
+    Timers::tick();
+}
+
+// The host has no spare hardware timer; a 1ms interval timer will do.
+// (SA_RESTART, so that reading our input isn't interrupted by it.)
+void Timers::start_ticking()
+{
+    static bool started = false;
+    if (started)
+        return;
+    started = true;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_alarm;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &sa, NULL);
+    struct itimerval interval = { { 0, 1000 }, { 0, 1000 } };
+    setitimer(ITIMER_REAL, &interval, NULL);
+}
+
+#endif
+
+void Timers::enqueue(uint8_t slot)
+{
+    _queue[_head] = slot;
+    _head = (_head + 1) & (TIMER_QUEUE - 1);
+}
+
+void Timers::tick()
+{
+    for(uint8_t i = 0; i < TIMER_SLOTS; i++) {
+        Slot& slot = _slots[i];
+        if (!slot._word || --slot._countdown)
+            continue;
+        slot._countdown = slot._period;
+        if (!slot._queued) {
+            slot._queued = true;
+            enqueue(i);
+        }
+    }
+}
+
+SuccessOrFailure Timers::attach(DictionaryEntry *word, unsigned period)
+{
+    Slot *free = NULL;
+    {
+        TickGuard guard;
+        for(auto& slot: _slots) {
+            if (slot._word == word) {
+                // Re-attaching changes the period; 0 detaches.
+                slot._word = period ? word : NULL;
+                slot._period = slot._countdown = period;
+                return SUCCESS;
+            }
+            if (!slot._word && !free)
+                free = &slot;
+        }
+        if (!period)
+            return error(F("This word wasn't running periodically: "), word->name());
+        if (!free)
+            return error(F("No free timer slots; detach one with 0 EVERY <word>"));
+        free->_word = word;
+        free->_period = free->_countdown = period;
+        free->_queued = false;
+    }
+    start_ticking();
+    return SUCCESS;
+}
+
+void Timers::clear()
+{
+    TickGuard guard;
+    for(auto& slot: _slots) {
+        slot._word = NULL;
+        slot._queued = false;
+    }
+    _head = _tail = 0;
+    _running = false;
+}
+
+void Timers::run_pending()
+{
+    // The words we run have safe points of their own; but
+    // they must not start other timer words (or themselves).
+    if (_running)
+        return;
+    _running = true;
+    while(_tail != _head) {
+        Slot& slot = _slots[_queue[_tail]];
+        _tail = (_tail + 1) & (TIMER_QUEUE - 1);
+        DictionaryEntry *word = slot._word;
+        if (word) {
+            // We run "inside" whatever phrase we interrupted; that
+            // phrase's stack, IFs and loops are not ours to see, or disturb.
+            IfStates savedIfStates = Forth::_ifStates;
+            LoopsStates savedLoopStates = Forth::_loopStates;
+            uint8_t rdepth = Forth::_rdepth, frame = Forth::_frame;
+            Forth::_ifStates.clear();
+            Forth::_loopStates.clear();
+            unsigned floor = Forth::_stack.hide();
+            bool ok = CompiledNode::run_full_phrase(word) == SUCCESS;
+            if (ok && (!Forth::_stack.empty() || Forth::_rdepth != rdepth))
+                ok = error(F("Timer words must leave the stacks as they found them: "), word->name()) == SUCCESS;
+            // (A failed word leaves its IFs and loops behind)
+            Forth::abandon_phrase();
+            Forth::_stack.show(floor);
+            Forth::_ifStates = savedIfStates;
+            Forth::_loopStates = savedLoopStates;
+            Forth::_rdepth = rdepth;
+            Forth::_frame = frame;
+            // Don't fail again (and again...) every period
+            if (!ok)
+                attach(word, 0);
+        }
+        slot._queued = false;
+    }
+    _running = false;
+}
@@ -0,0 +1,69 @@
+#ifndef __TIMERS_H__
+#define __TIMERS_H__
+
+#include <stdint.h>
+
+#include "defines.h"
+#include "errors.h"
+
+class DictionaryEntry;
+
+// Periodic words: "500 EVERY heartbeat" runs heartbeat every 500ms.
+//
+// A hardware timer ticks every millisecond (in the AVR, Timer1 - Timer0
+// is millis(); in the host, SIGALRM). The tick's handler does the bare
+// minimum: it counts down each attached word's period, and once that
+// expires, it puts the word's slot in a queue. Nothing else.
+//
+// The words themselves run in "normal" context, at safe points: between
+// two node dispatches in run_full_phrase, while MS waits, and while
+// get() is idle waiting for input. So a heartbeat keeps beating while
+// you type - and while your own words run. They run on top of the stack
+// of the word they interrupt, but can't see or change its cells (see
+// array_stack::hide); nor its IFs, loops and return stack.
+//
+// The queue is lock-free: only the tick handler moves its head, and
+// only run_pending moves its tail (both are single bytes, so an AVR
+// reads and writes them atomically). A slot is never queued twice;
+// if a word is still queued (or running) when its period expires
+// again, that run is skipped - so the queue can never overflow.
+class Timers {
+    struct Slot {
+        DictionaryEntry *_word;    // NULL if the slot is free
+        unsigned _period;          // in ms
+        volatile unsigned _countdown;
+        volatile bool _queued;
+    };
+    static Slot _slots[TIMER_SLOTS];
+
+    static volatile uint8_t _queue[TIMER_QUEUE];
+    static volatile uint8_t _head;
+    static volatile uint8_t _tail;
+
+    static bool _running;
+
+#ifdef __NATIVE_BUILD__
+    friend class ForthVM; // it brings its own slots (src_x86/forth_vm.h)
+#endif
+#ifdef JIT
+    friend class Jit;     // its loops check for pending ones (jit.cpp)
+#endif
+
+    static void start_ticking();
+    static void enqueue(uint8_t slot);
+
+public:
+    // Called from the ISR (or the signal handler)
+    static void tick();
+
+    // Attach a word to a period - or, if the period is 0, detach it.
+    static SuccessOrFailure attach(DictionaryEntry *word, unsigned period);
+    // Detach everything (RESET)
+    static void clear();
+
+    // Safe points call this - it must be as cheap as possible.
+    static bool pending() { return _head != _tail; }
+    static void run_pending();
+};
+
+#endif
@@ -0,0 +1,538 @@
+#include "miniforth.h"
+#include "helpers.h"
+#include "verify.h"
+
+// Stack effects.
+//
+// At ';', we walk the word's body once, counting how deep the stack goes
+// at each node - relative to where it was when the word started. If that
+// is the same at each node, however we got there (both arms of an IF
+// leave the same; each pass of a DO/LOOP, too), the word has a fixed
+// effect: it takes _in cells, and leaves _in + _out. Calls to words with
+// a fixed effect count as much; constants and variables push one cell.
+//
+// What can't be known is left alone: words with locals, CASE, EXECUTE,
+// RECURSE, the natives that aren't in the table below - and the words
+// that call them - stay unverified, and run exactly as they always did.
+//
+// A verified word's primitives are then swapped for their unchecked
+// variants: once run_full_phrase sees the _in cells there (see
+// may_skip_checks), nothing inside can run out of them. A single walk of
+// _in cells, instead of a check per primitive. If they aren't all there,
+// the checked variants run instead (see CompiledNode::execute); the word
+// fails where - and with the message - it always did.
+//
+// What we *can* prove wrong at ';', is a word whose DOs and IFs don't
+// pair up inside it: its LOOP or THEN would pop the loop (or IF) stack
+// of its caller - or nothing at all. We reject those.
+//
+// Two things we can't see at ';' could still move the stack under a
+// running verified word: a periodic word (see timers.h), or an IF of the
+// caller's (see run_full_phrase - it would skip nodes of ours). The first
+// can't: it runs on a stack of its own, above ours (see array_stack::hide).
+// For the second, the words that run an IF only skip their checks when
+// no IF is pending.
+//
+// Build with -D NO_VERIFY to keep all the checks (see 'make test-verify').
+
+// How deep IF and DO may nest inside a word, for it to be verified
+#define VERIFY_CONTROL 8
+
+namespace {
+
+// The native words whose stack effect we know - and, for the cheap
+// and frequent ones, the variant that trusts it. (The JIT and the AOT
+// translator know no more than these.)
+struct Effect {
+    CompiledNode::FuncPtr _func;
+    CompiledNode::FuncPtr _unchecked;
+    int8_t _pops, _pushes;
+};
+
+const Effect effects[] PROGMEM = {
+    { &Forth::add,      &Forth::add_unchecked,     2, 1 },
+    { &Forth::sub,      &Forth::sub_unchecked,     2, 1 },
+    { &Forth::mul,      &Forth::mul_unchecked,     2, 1 },
+    { &Forth::equal,    &Forth::equal_unchecked,   2, 1 },
+    { &Forth::greater,  &Forth::greater_unchecked, 2, 1 },
+    { &Forth::less,     &Forth::less_unchecked,    2, 1 },
+    { &Forth::andd,     &Forth::andd_unchecked,    2, 1 },
+    { &Forth::orr,      &Forth::orr_unchecked,     2, 1 },
+    { &Forth::xorr,     &Forth::xorr_unchecked,    2, 1 },
+    { &Forth::lshift,   &Forth::lshift_unchecked,  2, 1 },
+    { &Forth::rshift,   &Forth::rshift_unchecked,  2, 1 },
+    { &Forth::invert,   &Forth::invert_unchecked,  1, 1 },
+    { &Forth::dup,      &Forth::dup_unchecked,     1, 2 },
+    { &Forth::drop,     &Forth::drop_unchecked,    1, 0 },
+    { &Forth::swap,     &Forth::swap_unchecked,    2, 2 },
+    { &Forth::rot,      &Forth::rot_unchecked,     3, 3 },
+    { &Forth::div,      NULL,                      2, 1 },
+    { &Forth::mod,      NULL,                      2, 1 },
+    { &Forth::muldiv,   NULL,                      3, 1 },
+    { &Forth::cells,    NULL,                      1, 1 },
+    { &Forth::at,       NULL,                      1, 1 },
+    { &Forth::bang,     NULL,                      2, 0 },
+    { &Forth::cAt,      NULL,                      1, 1 },
+    { &Forth::cBang,    NULL,                      2, 0 },
+    { &Forth::cset,     NULL,                      2, 0 },
+    { &Forth::cclear,   NULL,                      2, 0 },
+    { &Forth::ctoggle,  NULL,                      2, 0 },
+    { &Forth::dot,      NULL,                      1, 0 },
+    { &Forth::Udot,     NULL,                      1, 0 },
+    { &Forth::UdotR,    NULL,                      1, 0 },
+    { &Forth::dotR,     NULL,                      2, 0 },
+    { &Forth::CR,       NULL,                      0, 0 },
+    { &Forth::type,     NULL,                      2, 0 },
+    { &Forth::hex,      NULL,                      0, 0 },
+    { &Forth::decimal,  NULL,                      0, 0 },
+    { &Forth::binary,   NULL,                      0, 0 },
+    { &Forth::ms,       NULL,                      1, 0 },
+    { &Forth::us,       NULL,                      1, 0 },
+    { &Forth::ticks,    NULL,                      0, 1 },
+    { &Forth::loop_I,   NULL,                      0, 1 },
+    { &Forth::loop_J,   NULL,                      0, 1 },
+    { &Forth::toR,      NULL,                      1, 0 },
+    { &Forth::rFrom,    NULL,                      0, 1 },
+    { &Forth::rFetch,   NULL,                      0, 1 },
+    { &Forth::twoToR,   NULL,                      2, 0 },
+    { &Forth::twoRFrom, NULL,                      0, 2 },
+    // (IF, ELSE, THEN, DO and LOOP - see verify)
+    { &Forth::iff,      NULL,                      1, 0 },
+    { &Forth::elsee,    NULL,                      0, 0 },
+    { &Forth::then,     NULL,                      0, 0 },
+    { &Forth::doloop,   NULL,                      2, 0 },
+    { &Forth::loop,     NULL,                      0, 0 },
+};
+
+}
+
+#define EFFECTS (sizeof(effects)/sizeof(effects[0]))
+
+static CompiledNode::FuncPtr func_of(const Effect *e)
+{
+    return reinterpret_cast<CompiledNode::FuncPtr>(pgm_read_word_near(&e->_func));
+}
+
+static CompiledNode::FuncPtr unchecked_of(const Effect *e)
+{
+    return reinterpret_cast<CompiledNode::FuncPtr>(pgm_read_word_near(&e->_unchecked));
+}
+
+static const Effect *find_effect(CompiledNode::FuncPtr funcPtr)
+{
+    for(unsigned i=0; i<EFFECTS; i++)
+        if (func_of(&effects[i]) == funcPtr)
+            return &effects[i];
+    return NULL;
+}
+
+CompiledNode::FuncPtr Forth::checked_variant(CompiledNode::FuncPtr funcPtr)
+{
+    for(unsigned i=0; i<EFFECTS; i++)
+        if (unchecked_of(&effects[i]) == funcPtr)
+            return func_of(&effects[i]);
+    return funcPtr;
+}
+
+///////////////////////////////////////////////////////////////////////
+// The walk (see verify.h)
+///////////////////////////////////////////////////////////////////////
+
+StackWalk::StackWalk(Control *control, uint8_t room)
+    :_depth(0), _lowest(0), _peak(0), _rdepth(0), _rpeak(0),
+     _loops(0), _maxLoops(0), _ifs(0),
+     _control(control), _room(room), _nested(0)
+{
+}
+
+bool StackWalk::effect_of(CompiledNode::FuncPtr funcPtr, int& pops, int& pushes)
+{
+    const Effect *e = find_effect(funcPtr);
+    if (!e)
+        return false;
+    pops = (int8_t) pgm_read_byte_near(&e->_pops);
+    pushes = (int8_t) pgm_read_byte_near(&e->_pushes);
+    return true;
+}
+
+CompiledNode::FuncPtr StackWalk::unchecked_variant(CompiledNode::FuncPtr funcPtr)
+{
+    const Effect *e = find_effect(funcPtr);
+    return e ? unchecked_of(e) : NULL;
+}
+
+void StackWalk::apply(int pops, int pushes)
+{
+    _depth -= pops;
+    if (_depth < _lowest)
+        _lowest = _depth;
+    _depth += pushes;
+    if (_depth > _peak)
+        _peak = _depth;
+}
+
+void StackWalk::call(int in, int out, int peak)
+{
+    if (_depth - in < _lowest)
+        _lowest = _depth - in;
+    if (_depth + peak > _peak)
+        _peak = _depth + peak;
+    _depth += out;
+}
+
+StackWalk::Outcome StackWalk::iff()
+{
+    _ifs++;
+    if (_nested == _room)
+        return TOO_DEEP;
+    Control *c = &_control[_nested++];
+    c->_isDo = c->_hasElse = false;
+    c->_depth = _depth;
+    c->_rdepth = _rdepth;
+    return FINE;
+}
+
+StackWalk::Outcome StackWalk::elsee()
+{
+    Control *c = _nested ? &_control[_nested - 1] : NULL;
+    if (!c || c->_isDo || c->_hasElse)
+        return UNMATCHED;
+    c->_hasElse = true;
+    c->_armDepth = _depth;
+    c->_armRdepth = _rdepth;
+    _depth = c->_depth;
+    _rdepth = c->_rdepth;
+    return FINE;
+}
+
+StackWalk::Outcome StackWalk::then()
+{
+    if (_ifs)
+        _ifs--;
+    Control *c = _nested ? &_control[_nested - 1] : NULL;
+    if (!c || c->_isDo)
+        return UNMATCHED;
+    _nested--;
+    // Either way, the same stack after it
+    if (c->_hasElse ?
+            _depth != c->_armDepth || _rdepth != c->_armRdepth :
+            _depth != c->_depth || _rdepth != c->_rdepth)
+        return UNBALANCED;
+    return FINE;
+}
+
+StackWalk::Outcome StackWalk::doo()
+{
+    if (++_loops > _maxLoops)
+        _maxLoops = _loops;
+    if (_nested == _room)
+        return TOO_DEEP;
+    Control *c = &_control[_nested++];
+    c->_isDo = true;
+    c->_depth = _depth;
+    c->_rdepth = _rdepth;
+    return FINE;
+}
+
+StackWalk::Outcome StackWalk::loop()
+{
+    if (_loops)
+        _loops--;
+    Control *c = _nested ? &_control[_nested - 1] : NULL;
+    if (!c || !c->_isDo)
+        return UNMATCHED;
+    _nested--;
+    // Every pass, the same stack
+    if (_depth != c->_depth || _rdepth != c->_rdepth)
+        return UNBALANCED;
+    return FINE;
+}
+
+StackWalk::Outcome StackWalk::index(int level)
+{
+    return _loops >= level ? FINE : UNMATCHED;
+}
+
+StackWalk::Outcome StackWalk::toR()
+{
+    if (++_rdepth > RSTACK_SIZE)
+        return TOO_DEEP;
+    if (_rdepth > _rpeak)
+        _rpeak = _rdepth;
+    return FINE;
+}
+
+StackWalk::Outcome StackWalk::rFrom(bool fetch)
+{
+    // (What the caller parked is the caller's)
+    if (!_rdepth)
+        return UNMATCHED;
+    if (!fetch)
+        _rdepth--;
+    return FINE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// At ';'
+///////////////////////////////////////////////////////////////////////
+
+SuccessOrFailure Forth::verify(DictionaryPtr word)
+{
+    CompiledNodes& nodes = word->getCompiledNodes();
+    StackWalk::Control control[VERIFY_CONTROL];
+    StackWalk walk(control, VERIFY_CONTROL);
+    bool fixed = true, touchesIf = false;
+
+    for(auto it = nodes.begin(); it != nodes.end(); ++it) {
+        CompiledNode& node = *it;
+        int pops = 0, pushes = 0;
+        CompiledNode::FuncPtr funcPtr = NULL;
+        switch(node._kind) {
+        case CompiledNode::LITERAL:
+        case CompiledNode::CONSTANT:
+        case CompiledNode::XT:
+            pushes = 1;
+            break;
+        case CompiledNode::STRING:
+            break;
+        case CompiledNode::WORD: {
+            DictionaryPtr callee = node._u._word._dictPtr;
+            CompiledNodes& body = callee->getCompiledNodes();
+            if (!body.empty() && !body.begin().next() &&
+                    (body.begin()->_kind == CompiledNode::CONSTANT ||
+                     body.begin()->_kind == CompiledNode::VARIABLE)) {
+                pushes = 1;
+                break;
+            }
+            // (Including RECURSE: we are still UNVERIFIED ourselves)
+            StackEffect& e = callee->_effect;
+            if (e._in == StackEffect::UNVERIFIED) {
+                fixed = false;
+                break;
+            }
+            // Inside our IF, the callee's IF would confuse ours
+            if (e._touchesIf) {
+                if (walk._ifs)
+                    fixed = false;
+                touchesIf = true;
+            }
+            pops = e._in;
+            pushes = e._in + e._out;
+            break;
+        }
+        case CompiledNode::C_FUNC:
+            funcPtr = node._u._function._funcPtr;
+            if (!StackWalk::effect_of(funcPtr, pops, pushes))
+                fixed = false;
+            break;
+        default:
+            // Locals, and CASE
+            fixed = false;
+            break;
+        }
+        walk.apply(pops, pushes);
+
+        // (The return stack is the caller's business; we leave >R alone)
+        StackWalk::Outcome outcome = StackWalk::FINE;
+        if (funcPtr == &Forth::iff) {
+            // An IF inside an IF confuses run_full_phrase
+            if (walk._ifs)
+                fixed = false;
+            touchesIf = true;
+            outcome = walk.iff();
+        } else if (funcPtr == &Forth::elsee) {
+            if (!walk._ifs)
+                return error(F("ELSE needs an IF, in the same word"));
+            outcome = walk.elsee();
+        } else if (funcPtr == &Forth::then) {
+            if (!walk._ifs)
+                return error(F("THEN needs an IF, in the same word"));
+            outcome = walk.then();
+        } else if (funcPtr == &Forth::doloop)
+            outcome = walk.doo();
+        else if (funcPtr == &Forth::loop) {
+            if (!walk._loops)
+                return error(F("LOOP needs a DO, in the same word"));
+            outcome = walk.loop();
+        }
+        if (outcome != StackWalk::FINE)
+            fixed = false;
+    }
+    if (walk._ifs)
+        return error(F("IF needs a THEN, in the same word"));
+    if (walk._loops)
+        return error(F("DO needs a LOOP, in the same word"));
+#ifdef NO_VERIFY
+    fixed = false;
+#endif
+    if (!fixed || -walk._lowest >= StackEffect::UNVERIFIED ||
+            walk._depth < -128 || walk._depth > 127)
+        return SUCCESS;
+    word->_effect._in = -walk._lowest;
+    word->_effect._out = walk._depth;
+    word->_effect._touchesIf = touchesIf;
+    // The checks are now done once, at the start
+    for(auto it = nodes.begin(); it != nodes.end(); ++it) {
+        if (it->_kind != CompiledNode::C_FUNC)
+            continue;
+        CompiledNode::FuncPtr unchecked = StackWalk::unchecked_variant(it->_u._function._funcPtr);
+        if (unchecked)
+            it->_u._function._funcPtr = unchecked;
+    }
+    return SUCCESS;
+}
+
+bool Forth::may_skip_checks(DictionaryPtr word)
+{
+    StackEffect& e = word->_effect;
+    if (e._touchesIf && !_ifStates.empty())
+        return false;
+    return _stack.depth() >= e._in;
+}
+
+///////////////////////////////////////////////////////////////////////
+// The unchecked variants
+///////////////////////////////////////////////////////////////////////
+
+// The top two cells: we pop the top one, and the caller overwrites
+// the other with the result.
+static StackNode& operands(int& v1, int& v2)
+{
+    StackNode& next = Forth::_stack.from_top(1);
+    v1 = Forth::_stack.top();
+    v2 = next;
+    Forth::_stack.pop();
+    return next;
+}
+
+CompiledNode::ExecuteResult Forth::add_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 + v1;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::sub_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 - v1;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::mul_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 * v1;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::equal_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 == v1 ? 1 : 0;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::greater_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 > v1 ? 1 : 0;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::less_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 < v1 ? 1 : 0;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::andd_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 & v1;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::orr_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 | v1;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::xorr_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = v2 ^ v1;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::lshift_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = unsigned(v1) < 8*sizeof(int) ? int(unsigned(v2) << v1) : 0;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::rshift_unchecked(CompiledNodes::iterator it)
+{
+    int v1, v2;
+    StackNode& result = operands(v1, v2);
+    result = unsigned(v1) < 8*sizeof(int) ? int(unsigned(v2) >> v1) : 0;
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::invert_unchecked(CompiledNodes::iterator it)
+{
+    StackNode& top = _stack.top();
+    top = ~top;
+    return it;
+}
+
+// The shuffles just move cells around.
+CompiledNode::ExecuteResult Forth::dup_unchecked(CompiledNodes::iterator it)
+{
+    StackNode top = _stack.top();
+    _stack.push(top);
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::drop_unchecked(CompiledNodes::iterator it)
+{
+    _stack.pop();
+    return it;
+}
+
+CompiledNode::ExecuteResult Forth::swap_unchecked(CompiledNodes::iterator it)
+{
+    StackNode& top = _stack.top();
+    StackNode& next = _stack.from_top(1);
+    StackNode tmp = top;
+    top = next;
+    next = tmp;
+    return it;
+}
+
+// ( x1 x2 x3 -- x2 x3 x1 )
+CompiledNode::ExecuteResult Forth::rot_unchecked(CompiledNodes::iterator it)
+{
+    StackNode& x3 = _stack.top();
+    StackNode& x2 = _stack.from_top(1);
+    StackNode& x1 = _stack.from_top(2);
+    StackNode tmp = x1;
+    x1 = x2;
+    x2 = x3;
+    x3 = tmp;
+    return it;
+}
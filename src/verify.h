@@ -0,0 +1,68 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include "miniforth.h"
+
+// A walk through a word's body, node by node, that counts how deep the
+// stack is at each one - relative to where it was when the word started.
+// verify() does it at ';'; the JIT and the AOT translator (src_x86/aot.cpp)
+// before they write anything. Each of them feeds it every node - and
+// decides what to make of an Outcome that isn't FINE.
+class StackWalk {
+public:
+    // The IFs and DOs we are inside of
+    struct Control {
+        bool _isDo;
+        bool _hasElse;
+        int _depth, _rdepth;         // at the IF (after it took its flag) or DO
+        int _armDepth, _armRdepth;   // at the ELSE
+    };
+    // ...in 'room' of them, from the caller
+    StackWalk(Control *control, uint8_t room);
+
+    // What a native word takes and leaves, if we know it (the checked
+    // variant, that is; see Forth::checked_variant)
+    static bool effect_of(CompiledNode::FuncPtr funcPtr, int& pops, int& pushes);
+    // ...and the variant of it that trusts it - or NULL
+    static CompiledNode::FuncPtr unchecked_variant(CompiledNode::FuncPtr funcPtr);
+
+    // A node that takes 'pops' cells, and then leaves 'pushes'
+    void apply(int pops, int pushes);
+    // A call to a word that takes 'in' cells, leaves 'out' more than it
+    // took, and adds at most 'peak' meanwhile
+    void call(int in, int out, int peak);
+
+    // After the IF, ELSE... node's own apply(); each must close what
+    // we are in, and leave the same stack - however we got there.
+    enum Outcome {
+        FINE,
+        UNMATCHED,      // an ELSE or THEN outside an IF, a LOOP outside
+                        // a DO; an I, J or R> that reaches the caller's
+        UNBALANCED,     // an IF that leaves more one way than the other,
+                        // a loop that leaves more each pass
+        TOO_DEEP        // more IFs and DOs than the room we got; or >Rs
+    };
+    Outcome iff();
+    Outcome elsee();
+    Outcome then();
+    Outcome doo();
+    Outcome loop();
+    Outcome index(int level);   // I is 1, J is 2
+    Outcome toR();
+    Outcome rFrom(bool fetch);
+
+    // The stack: now, and the least and most it was
+    int _depth, _lowest, _peak;
+    // The return stack (our >Rs): now, and the most
+    int _rdepth, _rpeak;
+    // The DOs we are in, and the most ever; and the IFs. (These count
+    // even what didn't fit in the room we got)
+    int _loops, _maxLoops, _ifs;
+
+private:
+    Control *_control;
+    uint8_t _room;
+    uint8_t _nested;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __WORD_PROFILE_H__
+#define __WORD_PROFILE_H__
+
+// Per-word execution counters (build with -DWORD_PROFILE).
+//
+// Every DictionaryEntry - and every natively-implemented word - counts
+// how many times it was called, and the time spent inside it (callees
+// included; and for recursive words, only the outermost call counts).
+// ".PROFILE" prints the top-N words, "0PROFILE" zeroes them.
+//
+// Without WORD_PROFILE, none of this is compiled in.
+
+#ifdef WORD_PROFILE
+
+#ifdef __NATIVE_BUILD__
+#include <chrono>
+// Nanoseconds
+#define PROFILE_TIME_UNIT "ns"
+inline unsigned long profile_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#else
+// Microseconds, in steps of 4 (Timer0 in a 16MHz UNO)
+#define PROFILE_TIME_UNIT "us"
+inline unsigned long profile_now() {
+    return micros();
+}
+#endif
+
+struct WordCounter {
+    unsigned long _calls;
+    unsigned long _time;
+    unsigned _active;
+    void clear() { _calls = 0; _time = 0; _active = 0; }
+};
+
+struct CountingScope {
+    WordCounter& _counter;
+    unsigned long _start;
+    CountingScope(WordCounter& counter):_counter(counter) {
+        _counter._calls++;
+        _counter._active++;
+        _start = profile_now();
+    }
+    ~CountingScope() {
+        if (!--_counter._active)
+            _counter._time += profile_now() - _start;
+    }
+};
+
+#define COUNT_SCOPE(counter) CountingScope countingScope(counter)
+
+#else
+
+#define COUNT_SCOPE(counter)
+
+#endif
+
+#endif
@@ -5,33 +5,66 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define F(x) x
 
 class SerialStub {
+    // Everything we print goes to stdout - unless a ForthVM captures
+    // it into its caller's buffer (which we keep NUL-terminated; and
+    // what doesn't fit there is dropped, but still counted).
+    char *_capture;
+    size_t _captureSize;
+    size_t _captured;
+    friend class ForthVM;
+
+    void put(const char *data, size_t len) {
+        if (!_capture) {
+            fwrite(data, 1, len, stdout);
+            return;
+        }
+        if (_captured + 1 < _captureSize) {
+            size_t room = _captureSize - 1 - _captured;
+            memcpy(_capture + _captured, data, len < room ? len : room);
+            _capture[_captured + (len < room ? len : room)] = '\0';
+        }
+        _captured += len;
+    }
+
 public:
+    SerialStub():_capture(NULL), _captureSize(0), _captured(0) {}
+
     void print(const char *msg) {
-        printf(msg);
+        put(msg, strlen(msg));
     }
 
     void print(int intVal) {
-        printf("%d", intVal);
+        char tmp[16];
+        put(tmp, snprintf(tmp, sizeof(tmp), "%d", intVal));
     }
 
     void print(long unsigned int intVal) {
-        printf("%lu", intVal);
+        char tmp[24];
+        put(tmp, snprintf(tmp, sizeof(tmp), "%lu", intVal));
     }
 
     void println(long unsigned int intVal) {
-        printf("%lu\n", intVal);
+        print(intVal);
+        put("\n", 1);
+    }
+
+    void write(char c) {
+        put(&c, 1);
     }
 
     void println(const char *msg) {
-        puts(msg);
+        print(msg);
+        put("\n", 1);
     }
 
     void flush() {
-        fflush(stdout);
+        if (!_capture)
+            fflush(stdout);
     }
 
     void begin(int) {}
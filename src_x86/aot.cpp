@@ -0,0 +1,851 @@
+// An ahead-of-time translator, from Forth to C++ - for firmware builds.
+//
+// Reads a Forth source file, and compiles its definitions right here in
+// the host, with the very same engine (as the tether does). Then walks
+// the dictionary, and writes each ':' word whose stack effect it can
+// work out as a C++ function over an array of cells (see src/aot.h).
+// 'make arduino-aot FS=...' builds them into the firmware, as native
+// words: their bodies then live in Flash, and take no SRAM at all.
+//
+// Only the definitions - and the constants, variables and DEFERs they
+// refer to - are made here; the rest of the source (e.g. "10 BLINK")
+// doesn't run in the host. And a constant must be a number typed right
+// before "constant": a computed one (e.g. an ALLOT-ed address) means
+// something else in the target - so words using it are left out.
+// As are the ones using variables, locals, CASE, RECURSE, EXECUTE
+// or DEFER-ed words; and those that call them.
+//
+// Usage:
+//     aot <file.fs> <dir>    ...writes <dir>/aot_words.h and .cpp
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "miniforth.h"
+#include "helpers.h"
+#include "verify.h"
+
+SerialStub Serial;
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "[x] %s\n", msg);
+    exit(1);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Loading the source
+///////////////////////////////////////////////////////////////////////
+
+// The host engine's output (errors aside) is just noise - e.g. banners
+static void quietly(void (*action)())
+{
+    fflush(stdout);
+    int saved = dup(1);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 1);
+    action();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(devNull);
+    close(saved);
+}
+
+static char *quietLine;
+static SuccessOrFailure quietResult;
+
+static void parse_quiet_line()
+{
+    quietResult = Forth::parse_line(quietLine, quietLine + strlen(quietLine));
+}
+
+static SuccessOrFailure parse_quietly(char *line)
+{
+    quietLine = line;
+    quietly(parse_quiet_line);
+    return quietResult;
+}
+
+static void parse(char *line)
+{
+    if (!Forth::parse_line(line, line + strlen(line)))
+        fprintf(stderr, "[x] ...in: %s\n", line);
+}
+
+// The constants whose value the target can't know
+#define MAX_WORDS 1024
+static DictionaryPtr computed[MAX_WORDS];
+static unsigned computedCount;
+
+static void define_constant(const char *value, const char *name)
+{
+    static char buf[2*MAX_LINE_LENGTH + 16];
+    if (*value && !Forth::lookup(value) && !Forth::lookup_C(value)) {
+        snprintf(buf, sizeof(buf), "%s constant %s", value, name);
+        if (parse_quietly(buf))
+            return;
+    }
+    snprintf(buf, sizeof(buf), "0 constant %s", name);
+    parse(buf);
+    if (computedCount == MAX_WORDS)
+        die("Too many computed constants");
+    computed[computedCount++] = &*Forth::_dict.begin();
+}
+
+static bool is_computed(DictionaryPtr wrd)
+{
+    for (unsigned i = 0; i < computedCount; i++)
+        if (computed[i] == wrd)
+            return true;
+    return false;
+}
+
+static void host_reset()
+{
+    quietly(Forth::reset);
+    computedCount = 0;
+}
+
+// The ':' definition being collected - possibly across many lines
+static char definition[16384];
+static size_t definitionLen;
+
+static void append_definition(const char *begin, const char *end)
+{
+    size_t len = end - begin;
+    if (definitionLen + len + 1 >= sizeof(definition))
+        die("Definition too long");
+    memcpy(&definition[definitionLen], begin, len);
+    definitionLen += len;
+    definition[definitionLen] = '\0';
+}
+
+static void finish_definition()
+{
+    static char buf[sizeof(definition)];
+    strcpy(buf, definition);
+    if (!Forth::parse_line(buf, buf + strlen(buf)) || Forth::is_compiling()) {
+        fprintf(stderr, "[x] Failed to compile:\n%s\n", definition);
+        exit(1);
+    }
+    definitionLen = 0;
+}
+
+static void process_line(char *line)
+{
+    static bool inDefinition = false;
+    static bool inString = false;
+    static enum { NOTHING, CONSTANT_NAME, VARIABLE_NAME, DEFER_NAME } nameOf;
+    static char previous[MAX_LINE_LENGTH], last[MAX_LINE_LENGTH];
+    static char value[MAX_LINE_LENGTH];
+    static char buf[2*MAX_LINE_LENGTH + 16];
+
+    char *lineEnd = line + strlen(line);
+    char *textStart = line;
+    char *p = line;
+    while(true) {
+        while(*p && isspace(*p))
+            p++;
+        if (!*p)
+            break;
+        char *tok = p;
+        while(*p && !isspace(*p))
+            p++;
+        char saved = *p;
+        *p = '\0';
+        bool isComment = !inString && !strcmp(tok, "\\");
+        strcpy(last, previous);
+        previous[0] = '\0';
+        if (inString) {
+            if (!strcmp(tok, "\""))
+                inString = false;
+        } else if (isComment) {
+            // ...to the end of the line.
+        } else if (!strcmp(tok, ".\"")) {
+            inString = true;
+        } else if (inDefinition) {
+            if (!strcmp(tok, ";")) {
+                *p = saved;
+                append_definition(textStart, p);
+                finish_definition();
+                inDefinition = false;
+                continue;
+            }
+        } else if (nameOf == CONSTANT_NAME) {
+            define_constant(value, tok);
+            nameOf = NOTHING;
+        } else if (nameOf != NOTHING) {
+            snprintf(buf, sizeof(buf),
+                nameOf == VARIABLE_NAME ? "0 variable %s" : "DEFER %s", tok);
+            parse(buf);
+            nameOf = NOTHING;
+        } else if (!strcmp(tok, "constant")) {
+            // (Its value is the token right before it - if that's a number)
+            strcpy(value, last);
+            nameOf = CONSTANT_NAME;
+        } else if (!strcmp(tok, "variable")) {
+            nameOf = VARIABLE_NAME;
+        } else if (!strcasecmp(tok, "defer")) {
+            nameOf = DEFER_NAME;
+        } else if (!strcasecmp(tok, "reset")) {
+            host_reset();
+        } else if (!strcasecmp(tok, "hex") || !strcasecmp(tok, "decimal") ||
+                   !strcasecmp(tok, "binary")) {
+            // The definitions that follow are in this BASE
+            strcpy(buf, tok);
+            parse(buf);
+        } else if (!strcmp(tok, ":")) {
+            inDefinition = true;
+            textStart = tok;
+        } else if (strlen(tok) < sizeof(previous))
+            strcpy(previous, tok);
+        *p = saved;
+        if (isComment) {
+            if (inDefinition)
+                lineEnd = tok;
+            break;
+        }
+    }
+    if (inDefinition) {
+        append_definition(textStart, lineEnd);
+        append_definition("\n", "\n" + 1);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// Translating the words
+///////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Translated {
+    DictionaryPtr _entry;
+    bool _ok;
+    bool _native;           // called by name: an entry in c_ops
+    bool _needed;           // ...or by one that is
+    int _in;                // the cells it takes,
+    int _out;               // how many more it leaves than it took,
+    int _peak;              // and the most it ever adds, meanwhile
+    size_t _begin, _end;    // its code, in 'code'
+    char _why[96];          // if not _ok
+};
+
+}
+
+static Translated words[MAX_WORDS];
+static unsigned wordCount;
+
+static Translated *translated(DictionaryPtr wrd)
+{
+    for (unsigned i = 0; i < wordCount; i++)
+        if (words[i]._entry == wrd)
+            return &words[i];
+    return NULL;
+}
+
+// The body of a word, if it is just one node (a constant, or a variable)
+static CompiledNode *sole_node(CompiledNodes& body)
+{
+    if (body.empty() || body.begin()._p->_next)
+        return NULL;
+    return &*body.begin();
+}
+
+namespace {
+
+enum Op {
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_MULDIV,
+    OP_EQUAL, OP_LESS, OP_GREATER, OP_AND, OP_OR, OP_XOR,
+    OP_LSHIFT, OP_RSHIFT, OP_INVERT, OP_CELLS, OP_FETCH, OP_STORE,
+    OP_CFETCH, OP_CSTORE, OP_CSET, OP_CCLEAR, OP_CTOGGLE,
+    OP_DUP, OP_DROP, OP_SWAP, OP_ROT,
+    OP_DOT, OP_UDOT, OP_UDOTR, OP_CR, OP_MS, OP_US, OP_TICKS,
+    OP_IF, OP_ELSE, OP_THEN, OP_DO, OP_LOOP, OP_I, OP_J,
+    OP_TO_R, OP_R_FROM, OP_R_FETCH
+};
+
+// The native words we know how to write (what they take and leave is
+// in src/verify.cpp's table)
+const struct Builtin {
+    CompiledNode::FuncPtr _func;
+    Op _op;
+} builtins[] = {
+    { &Forth::add,     OP_ADD },
+    { &Forth::sub,     OP_SUB },
+    { &Forth::mul,     OP_MUL },
+    { &Forth::div,     OP_DIV },
+    { &Forth::mod,     OP_MOD },
+    { &Forth::muldiv,  OP_MULDIV },
+    { &Forth::equal,   OP_EQUAL },
+    { &Forth::less,    OP_LESS },
+    { &Forth::greater, OP_GREATER },
+    { &Forth::andd,    OP_AND },
+    { &Forth::orr,     OP_OR },
+    { &Forth::xorr,    OP_XOR },
+    { &Forth::lshift,  OP_LSHIFT },
+    { &Forth::rshift,  OP_RSHIFT },
+    { &Forth::invert,  OP_INVERT },
+    { &Forth::cells,   OP_CELLS },
+    { &Forth::at,      OP_FETCH },
+    { &Forth::bang,    OP_STORE },
+    { &Forth::cAt,     OP_CFETCH },
+    { &Forth::cBang,   OP_CSTORE },
+    { &Forth::cset,    OP_CSET },
+    { &Forth::cclear,  OP_CCLEAR },
+    { &Forth::ctoggle, OP_CTOGGLE },
+    { &Forth::dup,     OP_DUP },
+    { &Forth::drop,    OP_DROP },
+    { &Forth::swap,    OP_SWAP },
+    { &Forth::rot,     OP_ROT },
+    { &Forth::dot,     OP_DOT },
+    { &Forth::Udot,    OP_UDOT },
+    { &Forth::UdotR,   OP_UDOTR },
+    { &Forth::CR,      OP_CR },
+    { &Forth::ms,      OP_MS },
+    { &Forth::us,      OP_US },
+    { &Forth::ticks,   OP_TICKS },
+    { &Forth::iff,     OP_IF },
+    { &Forth::elsee,   OP_ELSE },
+    { &Forth::then,    OP_THEN },
+    { &Forth::doloop,  OP_DO },
+    { &Forth::loop,    OP_LOOP },
+    { &Forth::loop_I,  OP_I },
+    { &Forth::loop_J,  OP_J },
+    { &Forth::toR,     OP_TO_R },
+    { &Forth::rFrom,   OP_R_FROM },
+    { &Forth::rFetch,  OP_R_FETCH },
+};
+
+}
+
+// What we write: the code of all the words, one after the other...
+static char code[1 << 20];
+static size_t codeLen;
+// ...and the body of the one we are translating.
+static char body[1 << 16];
+static size_t bodyLen;
+
+static void vappend(char *buf, size_t size, size_t& len, const char *fmt, va_list ap)
+{
+    int n = vsnprintf(&buf[len], size - len, fmt, ap);
+    if (n < 0 || len + n >= size)
+        die("The translation of a word is too big");
+    len += n;
+}
+
+static void emit(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vappend(code, sizeof(code), codeLen, fmt, ap);
+    va_end(ap);
+}
+
+// A line of the body - indented as deep as its IFs and DOs go
+static int indent;
+static void line(const char *fmt, ...)
+{
+    va_list ap;
+    static char spaces[] = "                                                ";
+    size_t n = 4*size_t(indent);
+    if (n > sizeof(spaces) - 1)
+        n = sizeof(spaces) - 1;
+    size_t room = sizeof(body) - bodyLen;
+    if (n + 1 >= room)
+        die("The translation of a word is too big");
+    memcpy(&body[bodyLen], spaces, n);
+    bodyLen += n;
+    va_start(ap, fmt);
+    vappend(body, sizeof(body), bodyLen, fmt, ap);
+    va_end(ap);
+    if (bodyLen + 1 >= sizeof(body))
+        die("The translation of a word is too big");
+    body[bodyLen++] = '\n';
+}
+
+// "sp[k]": the cell 'k' above where the word started (its own cells
+// are below that). Good for eight uses in the same line.
+static bool usesSp;
+static const char *cell(int k)
+{
+    static char bufs[8][16];
+    static unsigned next;
+    char *b = bufs[next++ & 7];
+    snprintf(b, sizeof(bufs[0]), "sp[%d]", k);
+    usesSp = true;
+    return b;
+}
+
+// ...and "sp + k", its address.
+static const char *address(int k)
+{
+    static char b[16];
+    if (!k)
+        snprintf(b, sizeof(b), "sp");
+    else
+        snprintf(b, sizeof(b), "sp %c %d", k < 0 ? '-' : '+', k < 0 ? -k : k);
+    usesSp = true;
+    return b;
+}
+
+// A number, as the target's int sees it (16 bits, in the AVR)
+static const char *literal(int v)
+{
+    static char b[24];
+    if (v >= -32768 && v <= 32767)
+        snprintf(b, sizeof(b), "%d", v);
+    else
+        snprintf(b, sizeof(b), "int(0x%Xul)", unsigned(v));
+    return b;
+}
+
+static void c_string(char *buf, size_t size, const char *text)
+{
+    size_t len = 0;
+    while(*text && len + 5 < size) {
+        unsigned char c = *text++;
+        if (c == '"' || c == '\\')
+            len += snprintf(&buf[len], size - len, "\\%c", c);
+        else if (c < ' ' || c > '~')
+            len += snprintf(&buf[len], size - len, "\\%03o", c);
+        else
+            buf[len++] = c;
+    }
+    buf[len] = '\0';
+}
+
+static bool reject(Translated& w, const char *fmt, const char *what)
+{
+    snprintf(w._why, sizeof(w._why), fmt, what);
+    return false;
+}
+
+// How deep IF and DO may nest inside a word
+#define MAX_CONTROL 16
+
+static bool translate(Translated& w, unsigned idx)
+{
+    CompiledNodes& nodes = w._entry->getCompiledNodes();
+    StackWalk::Control control[MAX_CONTROL];
+    StackWalk walk(control, MAX_CONTROL);
+    static char text[4*MAX_LINE_LENGTH + 1];
+    unsigned texts = 0;
+
+    bodyLen = 0;
+    indent = 1;
+    usesSp = false;
+    for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+        CompiledNode& node = *it;
+        // Before the node: its topmost cells are at a, b and c
+        int d = walk._depth, a = d - 1, b = d - 2, c = d - 3;
+        const Builtin *op = NULL;
+        switch(node._kind) {
+        case CompiledNode::LITERAL:
+        case CompiledNode::CONSTANT:
+            line("%s = %s;", cell(d), literal(node._kind == CompiledNode::LITERAL ?
+                node._u._literal._intVal : node._u._constant._intVal));
+            walk.apply(0, 1);
+            break;
+        case CompiledNode::STRING:
+            c_string(text, sizeof(text), node._u._string._strVal.c_str());
+            emit("static const char aot_text_%u_%u[] PROGMEM = { \"%s\" };\n",
+                 idx, texts, text);
+            line("Aot::print_string(aot_text_%u_%u);", idx, texts++);
+            break;
+        case CompiledNode::WORD: {
+            DictionaryPtr callee = node._u._word._dictPtr;
+            CompiledNode *sole = sole_node(callee->getCompiledNodes());
+            if (sole && sole->_kind == CompiledNode::CONSTANT) {
+                if (is_computed(callee))
+                    return reject(w, "uses %s - a computed constant", callee->name());
+                line("%s = %s;", cell(d), literal(sole->_u._constant._intVal));
+                walk.apply(0, 1);
+                break;
+            }
+            if (sole && sole->_kind == CompiledNode::VARIABLE)
+                return reject(w, "uses the variable %s", callee->name());
+            Translated *t = translated(callee);
+            if (!t || !t->_ok)
+                return reject(w, "calls %s, that isn't translated", callee->name());
+            line("if (!aot_%u(%s))", unsigned(t - words), address(d));
+            line("    return false;");
+            walk.call(t->_in, t->_out, t->_peak);
+            continue;
+        }
+        case CompiledNode::C_FUNC:
+            // (The engine verified it: its primitives may be unchecked)
+            for (unsigned i = 0; i < sizeof(builtins)/sizeof(builtins[0]); i++)
+                if (builtins[i]._func == Forth::checked_variant(node._u._function._funcPtr))
+                    op = &builtins[i];
+            if (!op)
+                return reject(w, "uses %s", node.getWordName());
+            break;
+        case CompiledNode::XT:
+            return reject(w, "uses %s", "an execution token");
+        case CompiledNode::CASE:
+        case CompiledNode::OF:
+        case CompiledNode::ENDOF:
+        case CompiledNode::ENDCASE:
+            return reject(w, "uses %s", "CASE");
+        case CompiledNode::LOCALS:
+        case CompiledNode::LOCAL:
+        case CompiledNode::TO_LOCAL:
+            return reject(w, "uses %s", "locals");
+        default:
+            return reject(w, "is %s", "not a ':' definition");
+        }
+        if (!op)
+            continue;
+
+        int pops, pushes;
+        StackWalk::effect_of(op->_func, pops, pushes);
+        walk.apply(pops, pushes);
+        StackWalk::Outcome outcome;
+        switch(op->_op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+            // (Wrapping around, as the interpreter does)
+            line("%s = int(unsigned(%s) %c unsigned(%s));", cell(b), cell(b),
+                 op->_op == OP_ADD ? '+' : op->_op == OP_SUB ? '-' : '*', cell(a));
+            break;
+        case OP_DIV:
+        case OP_MOD:
+            line("if (!%s)", cell(a));
+            line("    return Aot::division_by_zero(%s);", address(b));
+            line("%s = %s %c %s;", cell(b), cell(b), op->_op == OP_DIV ? '/' : '%', cell(a));
+            break;
+        case OP_MULDIV:
+            line("if (!%s)", cell(a));
+            line("    return Aot::division_by_zero(%s);", address(c));
+            line("%s = int(long(%s) * %s / %s);", cell(c), cell(c), cell(b), cell(a));
+            break;
+        case OP_EQUAL:
+        case OP_LESS:
+        case OP_GREATER:
+            line("%s = %s %s %s;", cell(b), cell(b),
+                 op->_op == OP_EQUAL ? "==" : op->_op == OP_LESS ? "<" : ">", cell(a));
+            break;
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+            line("%s %c= %s;", cell(b),
+                 op->_op == OP_AND ? '&' : op->_op == OP_OR ? '|' : '^', cell(a));
+            break;
+        case OP_LSHIFT:
+        case OP_RSHIFT:
+            line("%s = unsigned(%s) < 8*sizeof(int) ? int(unsigned(%s) %s %s) : 0;",
+                 cell(b), cell(a), cell(b), op->_op == OP_LSHIFT ? "<<" : ">>", cell(a));
+            break;
+        case OP_INVERT:
+            line("%s = ~%s;", cell(a), cell(a));
+            break;
+        case OP_CELLS:
+            line("%s = int(unsigned(%s) * sizeof(int));", cell(a), cell(a));
+            break;
+        case OP_FETCH:
+            line("if (!cell_is_address(%s, sizeof(int)))", cell(a));
+            line("    return Aot::bad_address(%s);", address(a));
+            line("%s = *reinterpret_cast<int *>(cell_to_ptr(%s));", cell(a), cell(a));
+            break;
+        case OP_STORE:
+            line("if (!cell_is_address(%s, sizeof(int)))", cell(a));
+            line("    return Aot::bad_address(%s);", address(b));
+            line("*reinterpret_cast<int *>(cell_to_ptr(%s)) = %s;", cell(a), cell(b));
+            break;
+        case OP_CFETCH:
+            line("if (!cell_is_address(%s, 1))", cell(a));
+            line("    return Aot::bad_address(%s);", address(a));
+            line("%s = *reinterpret_cast<volatile uint8_t *>(cell_to_ptr(%s));",
+                 cell(a), cell(a));
+            break;
+        case OP_CSTORE:
+            line("if (!cell_is_address(%s, 1))", cell(a));
+            line("    return Aot::bad_address(%s);", address(b));
+            line("*reinterpret_cast<volatile uint8_t *>(cell_to_ptr(%s)) = %s;",
+                 cell(a), cell(b));
+            break;
+        case OP_CSET:
+        case OP_CCLEAR:
+        case OP_CTOGGLE:
+            line("if (!cell_is_address(%s, 1))", cell(a));
+            line("    return Aot::bad_address(%s);", address(b));
+            line("Aot::modify_byte(%s, %s, %s, %s);", cell(a), cell(b),
+                 op->_op != OP_CTOGGLE ? "true" : "false",
+                 op->_op != OP_CCLEAR ? "true" : "false");
+            break;
+        case OP_DUP:
+            line("%s = %s;", cell(d), cell(a));
+            break;
+        case OP_DROP:
+            break;
+        case OP_SWAP:
+            line("{ int t = %s; %s = %s; %s = t; }", cell(b), cell(b), cell(a), cell(a));
+            break;
+        case OP_ROT:
+            line("{ int t = %s; %s = %s; %s = %s; %s = t; }",
+                 cell(c), cell(c), cell(b), cell(b), cell(a), cell(a));
+            break;
+        case OP_DOT:
+        case OP_UDOT:
+        case OP_UDOTR:
+            line("Aot::%s(%s);", op->_op == OP_DOT ? "dot" :
+                 op->_op == OP_UDOT ? "udot" : "udotR", cell(a));
+            break;
+        case OP_CR:
+            line("Aot::cr();");
+            break;
+        case OP_MS:
+        case OP_US:
+            line("if (!Aot::wait(%s, %s, %s))", address(a), cell(a),
+                 op->_op == OP_US ? "true" : "false");
+            line("    return false;");
+            break;
+        case OP_TICKS:
+            line("%s = int(ticks_ms());", cell(d));
+            break;
+        case OP_IF:
+            if (walk.iff() != StackWalk::FINE)
+                return reject(w, "nests %s too deep", "IF/DO");
+            line("if (%s) {", cell(a));
+            indent++;
+            break;
+        case OP_ELSE:
+            if (walk.elsee() != StackWalk::FINE)
+                return reject(w, "has %s", "an ELSE without an IF");
+            indent--;
+            line("} else {");
+            indent++;
+            break;
+        case OP_THEN:
+            outcome = walk.then();
+            if (outcome == StackWalk::UNMATCHED)
+                return reject(w, "has %s", "a THEN without an IF");
+            if (outcome != StackWalk::FINE)
+                return reject(w, "has %s", "an IF that leaves more either way");
+            indent--;
+            line("}");
+            break;
+        case OP_DO:
+            // ( limit index -- )
+            if (walk.doo() != StackWalk::FINE)
+                return reject(w, "nests %s too deep", "IF/DO");
+            line("i%d = %s;", walk._loops, cell(a));
+            line("n%d = %s;", walk._loops, cell(b));
+            line("do {");
+            indent++;
+            break;
+        case OP_LOOP: {
+            int level = walk._loops;
+            outcome = walk.loop();
+            if (outcome == StackWalk::UNMATCHED)
+                return reject(w, "has %s", "a LOOP without a DO");
+            if (outcome != StackWalk::FINE)
+                return reject(w, "has %s", "a loop that leaves more each pass");
+            // Between two passes is a safe point for the periodic words
+            line("if (Timers::pending() && !Aot::run_timers(%s))", address(walk._depth));
+            line("    return false;");
+            indent--;
+            line("} while (++i%d < n%d);", level, level);
+            break;
+        }
+        case OP_I:
+        case OP_J:
+            if (walk.index(op->_op == OP_I ? 1 : 2) != StackWalk::FINE)
+                return reject(w, "uses %s", "the index of its caller's loop");
+            line("%s = i%d;", cell(d), op->_op == OP_I ? walk._loops : walk._loops - 1);
+            break;
+        case OP_TO_R:
+            if (walk.toR() != StackWalk::FINE)
+                return reject(w, "nests %s too deep", ">R");
+            line("r%d = %s;", walk._rdepth, cell(a));
+            break;
+        case OP_R_FROM:
+        case OP_R_FETCH: {
+            int level = walk._rdepth;
+            if (walk.rFrom(op->_op == OP_R_FETCH) != StackWalk::FINE)
+                return reject(w, "uses %s", "what its caller parked with >R");
+            line("%s = r%d;", cell(d), level);
+            break;
+        }
+        }
+    }
+    if (walk._loops || walk._ifs || walk._rdepth)
+        return reject(w, "has %s", "an unbalanced IF, DO or >R");
+
+    w._in = -walk._lowest;
+    w._out = walk._depth;
+    w._peak = walk._peak;
+    emit("// %s: takes %d cell%s, leaves %d\n", w._entry->name(),
+         w._in, w._in == 1 ? "" : "s", w._in + w._out);
+    emit("static bool aot_%u(int *%s)\n{\n", idx, usesSp ? "sp" : "");
+    for (int i = 1; i <= walk._maxLoops; i++)
+        emit("    int i%d, n%d;\n", i, i);
+    for (int i = 1; i <= walk._rpeak; i++)
+        emit("    int r%d;\n", i);
+    emit("%.*s", int(bodyLen), body);
+    emit("    return true;\n}\n\n");
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Writing it all down
+///////////////////////////////////////////////////////////////////////
+
+// Only the newest word of each name can be called by name - and only
+// if no native word has it; which is looked up first.
+static bool is_native(Translated& w, unsigned idx)
+{
+    const char *name = w._entry->name();
+    if (strlen(name) > AOT_MAX_NAME_LENGTH) {
+        snprintf(w._why, sizeof(w._why),
+                 "has a name longer than %d characters", AOT_MAX_NAME_LENGTH);
+        return false;
+    }
+    if (Forth::lookup_C(name))
+        return reject(w, "has the name of %s", "a native word");
+    for (unsigned i = idx + 1; i < wordCount; i++)
+        if (!strcasecmp(words[i]._entry->name(), name))
+            return reject(w, "was redefined %s", "later on");
+    return true;
+}
+
+static void mark_callees(Translated& w)
+{
+    for (auto& node: w._entry->getCompiledNodes())
+        if (node._kind == CompiledNode::WORD) {
+            Translated *t = translated(node._u._word._dictPtr);
+            if (t)
+                t->_needed = true;
+        }
+}
+
+static FILE *create(const char *dir, const char *name)
+{
+    static char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        die("Failed to create the output files");
+    return fp;
+}
+
+static void write_header(const char *dir, const char *source)
+{
+    FILE *fp = create(dir, "aot_words.h");
+    fprintf(fp, "// Generated by src_x86/aot, from %s - don't edit.\n", source);
+    fprintf(fp, "// The words it translated to C++ (see src/aot.h)\n");
+    fprintf(fp, "#ifndef __AOT_WORDS_H__\n#define __AOT_WORDS_H__\n\n");
+    fprintf(fp, "#include \"miniforth.h\"\n\n");
+    for (unsigned i = 0; i < wordCount; i++) {
+        if (!words[i]._native)
+            continue;
+        fprintf(fp, "extern const char aot_name_%u[] PROGMEM;\n", i);
+        fprintf(fp, "CompiledNode::ExecuteResult aot_word_%u(CompiledNodes::iterator it);\n", i);
+    }
+    fprintf(fp, "\n// ...their entries in c_ops\n#define AOT_C_OPS");
+    for (unsigned i = 0; i < wordCount; i++)
+        if (words[i]._native)
+            fprintf(fp, " \\\n    { (__FlashStringHelper *)aot_name_%u, &aot_word_%u },", i, i);
+    fprintf(fp, "\n\n#endif\n");
+    fclose(fp);
+}
+
+static void write_code(const char *dir, const char *source)
+{
+    FILE *fp = create(dir, "aot_words.cpp");
+    fprintf(fp, "// Generated by src_x86/aot, from %s - don't edit.\n", source);
+    fprintf(fp, "#include \"miniforth.h\"\n\n#ifdef AOT_WORDS\n\n");
+    fprintf(fp, "#ifndef __NATIVE_BUILD__\n#include <Arduino.h>\n#endif\n\n");
+    fprintf(fp, "#include <stdint.h>\n\n");
+    fprintf(fp, "#include \"helpers.h\"\n#include \"timers.h\"\n");
+    fprintf(fp, "#include \"aot.h\"\n#include \"aot_words.h\"\n\n");
+    for (unsigned i = 0; i < wordCount; i++)
+        if (words[i]._needed)
+            fwrite(&code[words[i]._begin], 1, words[i]._end - words[i]._begin, fp);
+    for (unsigned i = 0; i < wordCount; i++) {
+        Translated& w = words[i];
+        if (!w._native)
+            continue;
+        static char name[4*MAX_LINE_LENGTH + 1];
+        c_string(name, sizeof(name), w._entry->name());
+        for (char *p = name; *p; p++)
+            *p = toupper(*p);
+        fprintf(fp, "const char aot_name_%u[] PROGMEM = { \"%s\" };\n", i, name);
+        fprintf(fp, "CompiledNode::ExecuteResult aot_word_%u(CompiledNodes::iterator it)\n{\n", i);
+        fprintf(fp, "    int cells[%d];\n", w._in + w._peak > 0 ? w._in + w._peak : 1);
+        fprintf(fp, "    return Aot::run(&aot_%u, cells, %d, %d, it);\n}\n\n", i, w._in, w._out);
+    }
+    fprintf(fp, "#endif\n");
+    fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <file.fs> <output directory>\n", argv[0]);
+        return 1;
+    }
+    FILE *fp = fopen(argv[1], "r");
+    if (!fp)
+        die("Failed to open the Forth source");
+
+    // Our own engine's messages go to stderr
+    fflush(stdout);
+    dup2(2, 1);
+
+    host_reset();
+    static char buf[1024];
+    while(fgets(buf, sizeof(buf), fp))
+        process_line(buf);
+    fclose(fp);
+    if (definitionLen)
+        die("The last definition is missing its ';'");
+
+    // Oldest first: the words each one calls come before it
+    for (auto& entry: Forth::_dict) {
+        CompiledNode *sole = sole_node(entry.getCompiledNodes());
+        if (sole && (sole->_kind == CompiledNode::CONSTANT ||
+                     sole->_kind == CompiledNode::VARIABLE))
+            continue;
+        if (wordCount == MAX_WORDS)
+            die("Too many words");
+        words[wordCount++]._entry = &entry;
+    }
+    for (unsigned i = 0; i < wordCount / 2; i++) {
+        Translated tmp = words[i];
+        words[i] = words[wordCount - 1 - i];
+        words[wordCount - 1 - i] = tmp;
+    }
+    for (unsigned i = 0; i < wordCount; i++) {
+        Translated& w = words[i];
+        w._begin = codeLen;
+        w._ok = translate(w, i);
+        if (!w._ok)
+            codeLen = w._begin;
+        w._end = codeLen;
+        w._native = w._needed = w._ok && is_native(w, i);
+    }
+    // ...so the words they call come after them, here.
+    for (unsigned i = wordCount; i-- > 0; )
+        if (words[i]._needed)
+            mark_callees(words[i]);
+
+    write_header(argv[2], argv[1]);
+    write_code(argv[2], argv[1]);
+
+    unsigned natives = 0;
+    for (unsigned i = 0; i < wordCount; i++)
+        if (words[i]._native)
+            natives++;
+        else if (!words[i]._ok || !words[i]._needed)
+            fprintf(stderr, "[-] Left %s to the interpreter: it %s\n",
+                    words[i]._entry->name(), words[i]._why);
+    fprintf(stderr, "[-] Translated %u of %u words, to %s/aot_words.cpp\n",
+            natives, wordCount, argv[2]);
+    return 0;
+}
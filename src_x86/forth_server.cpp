@@ -0,0 +1,411 @@
+// A REPL server: many independent Forth sessions, on one host.
+//
+// Each connection gets an interpreter of its own (a ForthVM; see
+// forth_vm.h) - and talks to it just as picocom talks to a board:
+// it sends lines, and gets back what they printed, an " OK" if all
+// went well, and a "> " prompt. One epoll loop serves them all; and
+// as each session only costs its ForthVM (mostly, its Pool) plus a
+// few small buffers, thousands of idle sessions are cheap.
+//
+// Usage:
+//     forth_server [-p <pool bytes>] [-l <library.fs>] <path>|<port>
+//
+// ...listening on a Unix domain socket, or on 127.0.0.1:<port>. With -l,
+// the library is compiled once, and all sessions are made on top of it
+// (see ForthVM::freeze); then -p is the Pool space of each session's own.
+//
+// A session that fills its Pool gets an error, like the board would
+// (see POOL_SAFETY_MARGIN); RESET gives it room again. The others never
+// notice.
+//
+// Sessions only run when they have input: periodic words (EVERY)
+// only tick while their session runs a line.
+//
+// And the server is cooperative: it runs one line of one session at a
+// time, to its end. A word that loops forever (": spin BEGIN AGAIN ;")
+// stalls every session - there is no time budget per line. Serve only
+// clients you trust to that extent.
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "forth_vm.h"
+
+// A session stops reading input while this much output waits for
+// its client to read it.
+#define OUT_HIGH_WATER 65536
+
+// Where a library (-l) is compiled: the sessions' own Pools come after it
+#define LIBRARY_POOL_SIZE (1024*1024)
+
+// The Pool of each session (or its own part, after a library) - unless
+// -p says otherwise. The board's 1K or the x86 tests' 4K only hold a few
+// dozen words; a session at a REPL deserves more.
+#define SESSION_POOL_SIZE (16*1024)
+
+// What a single line may print; the rest is dropped
+static char output[65536];
+
+static const char prompt[] = "> ";
+
+struct Session {
+    int _fd;
+    ForthVM *_vm;
+    char _in[4 * MAX_LINE_LENGTH];
+    size_t _inLen;
+    bool _skipping;     // the rest of a line that was too long
+    bool _closing;      // the client sent all it will send
+    char *_out;         // what the client didn't read yet
+    size_t _outLen, _outSize;
+    uint32_t _events;   // what we wait for, in epoll
+    Session(int fd, ForthVM *library, size_t poolSize)
+        :_fd(fd),
+         _vm(library ? new ForthVM(*library, poolSize) : new ForthVM(poolSize)),
+         _inLen(0), _skipping(false), _closing(false),
+         _out(NULL), _outLen(0), _outSize(0), _events(0) {}
+    ~Session() {
+        delete _vm;
+        free(_out);
+        close(_fd);
+    }
+};
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "[x] %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static void append_output(Session *s, const char *data, size_t len)
+{
+    if (s->_outLen + len > s->_outSize) {
+        size_t size = s->_outSize ? s->_outSize : 256;
+        while (size < s->_outLen + len)
+            size *= 2;
+        s->_out = reinterpret_cast<char *>(realloc(s->_out, size));
+        if (!s->_out)
+            die("Out of memory");
+        s->_outSize = size;
+    }
+    memcpy(s->_out + s->_outLen, data, len);
+    s->_outLen += len;
+}
+
+// Send what we can, without blocking. False if the client is gone.
+static bool flush_output(Session *s)
+{
+    size_t sent = 0;
+    while (sent < s->_outLen) {
+        ssize_t n = send(s->_fd, s->_out + sent, s->_outLen - sent, MSG_NOSIGNAL);
+        if (n > 0)
+            sent += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
+            return false;
+    }
+    memmove(s->_out, s->_out + sent, s->_outLen - sent);
+    s->_outLen -= sent;
+    // A session that went quiet doesn't keep a big buffer around
+    if (!s->_outLen && s->_outSize > OUT_HIGH_WATER) {
+        free(s->_out);
+        s->_out = NULL;
+        s->_outSize = 0;
+    }
+    return true;
+}
+
+static void run_line(Session *s, char *line)
+{
+    size_t len = strlen(line);
+    if (len && line[len - 1] == '\r')
+        line[--len] = '\0';
+    s->_vm->capture(output, sizeof(output));
+    bool ok = s->_vm->eval(line);
+    size_t printed = s->_vm->captured();
+    append_output(s, output, printed < sizeof(output) ? printed : sizeof(output) - 1);
+    if (printed >= sizeof(output)) {
+        static const char truncated[] = "\n[x] ...and more output, that was dropped\n";
+        append_output(s, truncated, sizeof(truncated) - 1);
+    }
+    if (ok) {
+        static const char okMsg[] = " OK\n";
+        append_output(s, okMsg, sizeof(okMsg) - 1);
+    }
+    append_output(s, prompt, sizeof(prompt) - 1);
+}
+
+// Run the complete lines we have - while the client keeps up with
+// reading what they print. Returns whether we ran any.
+static bool process_input(Session *s)
+{
+    static const char tooLong[] = "[x] Too lengthy line!\n> ";
+    bool ran = false;
+    size_t start = 0;
+    while (s->_outLen < OUT_HIGH_WATER) {
+        char *begin = s->_in + start;
+        char *eol = reinterpret_cast<char *>(memchr(begin, '\n', s->_inLen - start));
+        if (!eol) {
+            size_t pending = s->_inLen - start;
+            if (s->_skipping)
+                start = s->_inLen;
+            else if (pending >= MAX_LINE_LENGTH) {
+                append_output(s, tooLong, sizeof(tooLong) - 1);
+                s->_skipping = true;
+                start = s->_inLen;
+            } else if (pending && s->_closing) {
+                // The last line may not end with a newline
+                char line[MAX_LINE_LENGTH];
+                memcpy(line, begin, pending);
+                line[pending] = '\0';
+                run_line(s, line);
+                start = s->_inLen;
+                ran = true;
+            }
+            break;
+        }
+        size_t len = eol - begin;
+        start += len + 1;
+        if (s->_skipping) {
+            s->_skipping = false;
+            continue;
+        }
+        if (len >= MAX_LINE_LENGTH) {
+            append_output(s, tooLong, sizeof(tooLong) - 1);
+            continue;
+        }
+        *eol = '\0';
+        run_line(s, begin);
+        ran = true;
+    }
+    memmove(s->_in, s->_in + start, s->_inLen - start);
+    s->_inLen -= start;
+    return ran;
+}
+
+// False if the client is gone
+static bool read_input(Session *s)
+{
+    while (s->_inLen < sizeof(s->_in)) {
+        ssize_t n = read(s->_fd, s->_in + s->_inLen, sizeof(s->_in) - s->_inLen);
+        if (n > 0)
+            s->_inLen += n;
+        else if (n == 0) {
+            s->_closing = true;
+            break;
+        } else if (errno == EINTR)
+            continue;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else
+            return false;
+    }
+    return true;
+}
+
+static void update_events(int epfd, Session *s)
+{
+    uint32_t events = 0;
+    if (!s->_closing && s->_outLen < OUT_HIGH_WATER && s->_inLen < sizeof(s->_in))
+        events |= EPOLLIN;
+    if (s->_outLen)
+        events |= EPOLLOUT;
+    if (events == s->_events)
+        return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = s;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, s->_fd, &ev) < 0)
+        die("epoll_ctl");
+    s->_events = events;
+}
+
+// False when the session is over
+static bool serve(Session *s, uint32_t events)
+{
+    if (events & EPOLLERR)
+        return false;
+    if ((events & (EPOLLIN | EPOLLHUP)) && !s->_closing && !read_input(s))
+        return false;
+    for (;;) {
+        bool ran = process_input(s);
+        if (!flush_output(s))
+            return false;
+        if (!ran || s->_outLen)
+            break;
+    }
+    // Said all it had to say, and heard all the answers
+    if (s->_closing && !s->_outLen && (!s->_inLen || s->_skipping))
+        return false;
+    return true;
+}
+
+static int listen_unix(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        die(path);
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        die("socket");
+    unlink(path);
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+        die(path);
+    return fd;
+}
+
+static int listen_tcp(int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        die("socket");
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+        die("bind");
+    return fd;
+}
+
+static void accept_sessions(
+    int epfd, int listenFd, ForthVM *library, size_t poolSize, bool tcp)
+{
+    for (;;) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            // e.g. out of descriptors; the others still deserve service
+            perror("[x] accept");
+            return;
+        }
+        if (tcp) {
+            // Echoes are small; don't hold them back
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        Session *s = new Session(fd, library, poolSize);
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = s->_events = EPOLLIN;
+        ev.data.ptr = s;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            die("epoll_ctl");
+        append_output(s, prompt, sizeof(prompt) - 1);
+        if (!flush_output(s)) {
+            delete s;
+            continue;
+        }
+        update_events(epfd, s);
+    }
+}
+
+// Compile it once, for all the sessions to share
+static ForthVM *load_library(const char *fname)
+{
+    FILE *fp = fopen(fname, "r");
+    if (!fp)
+        die(fname);
+    ForthVM *library = new ForthVM(LIBRARY_POOL_SIZE);
+    char line[MAX_LINE_LENGTH + 2];
+    while (fgets(line, sizeof(line), fp)) {
+        if (!library->eval(line)) {
+            fprintf(stderr, "[x] %s: failed at: %s\n", fname, line);
+            exit(1);
+        }
+    }
+    fclose(fp);
+    if (!library->freeze())
+        exit(1);
+    fprintf(stderr, "[-] Compiled %s: %lu bytes of Pool, shared by all sessions\n",
+        fname, (unsigned long) library->frozen_size());
+    return library;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t poolSize = SESSION_POOL_SIZE;
+    ForthVM *library = NULL;
+    int arg = 1;
+    for (; arg < argc - 2; arg += 2) {
+        if (!strcmp(argv[arg], "-p"))
+            poolSize = strtoul(argv[arg + 1], NULL, 0);
+        else if (!strcmp(argv[arg], "-l"))
+            library = load_library(argv[arg + 1]);
+        else
+            break;
+    }
+    if (arg != argc - 1 || poolSize < 1024) {
+        fprintf(stderr, "Usage: %s [-p <pool bytes>] [-l <library.fs>] "
+            "<socket path>|<port>\n", argv[0]);
+        exit(1);
+    }
+    const char *where = argv[arg];
+    bool tcp = *where && strspn(where, "0123456789") == strlen(where);
+    int listenFd = tcp ? listen_tcp(atoi(where)) : listen_unix(where);
+    if (listen(listenFd, SOMAXCONN) < 0)
+        die("listen");
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        die("epoll_create1");
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // (sessions have theirs)
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev) < 0)
+        die("epoll_ctl");
+
+    fprintf(stderr, "[-] Serving on %s%s; a session takes %lu bytes, "
+        "plus up to %lu of Pool\n", tcp ? "127.0.0.1:" : "", where,
+        (unsigned long) (sizeof(Session) + sizeof(ForthVM)),
+        (unsigned long) poolSize);
+
+    struct epoll_event events[256];
+    for (;;) {
+        int n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (n < 0) {
+            // (e.g. the ticks of the timers)
+            if (errno == EINTR)
+                continue;
+            die("epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            Session *s = reinterpret_cast<Session *>(events[i].data.ptr);
+            if (!s) {
+                accept_sessions(epfd, listenFd, library, poolSize, tcp);
+                continue;
+            }
+            if (!serve(s, events[i].events)) {
+                delete s;  // (closing its fd takes it out of epoll)
+                continue;
+            }
+            update_events(epfd, s);
+        }
+    }
+}
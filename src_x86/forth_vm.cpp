@@ -0,0 +1,398 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <utility>
+
+#include "forth_vm.h"
+
+// Programs that use us have no Serial of their own
+SerialStub Serial;
+
+ForthVM *ForthVM::_active = NULL;
+
+static size_t page_size()
+{
+    static size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t round_to_pages(size_t size)
+{
+    return (size + page_size() - 1) / page_size() * page_size();
+}
+
+// Our state starts out as the engine's does - before its first RESET.
+// Our Pool is made of whole pages, in case we are frozen one day.
+ForthVM::ForthVM(size_t poolSize)
+    :_frozen(false), _frozenSize(0), _overlays(0), _memfd(-1),
+     _frozenBase(NULL), _view(NULL),
+     _poolData(reinterpret_cast<char *>(mmap(
+         NULL, round_to_pages(poolSize), PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))),
+     _poolSize(poolSize), _poolOffset(0),
+     _rdepth(0), _frame(0),
+     _dotNumberOfDigits(0), _base(NULL), _hold(NULL), _holdPtr(NULL),
+     _tracing(NULL), _traceNext(0), _traceCount(0),
+#ifdef WORD_PROFILE
+     _builtinCounters(NULL),
+#endif
+     _compiling(false), _wordBeingCompiled(NULL),
+     _definingConstant(false), _definingVariable(false),
+     _attachingTimer(false), _tickingWord(false),
+     _definingDeferred(false), _settingDeferred(false),
+     _definingString(false), _startOfString(NULL),
+     _definingLocals(false), _localsUninitialized(false),
+     _localsComment(false), _storingLocal(false),
+     _localNamesUsed(0), _localCount(0), _localInitialized(0),
+     _callDepth(0), _checking(false),
+     _head(0), _tail(0), _running(false),
+     _capture(NULL), _captureSize(0), _captured(0)
+{
+    DASSERT(_poolData != MAP_FAILED, "No memory for the Pool of a ForthVM...");
+    memset(_trace, 0, sizeof(_trace));
+    memset(_localNames, 0, sizeof(_localNames));
+    memset(_slots, 0, sizeof(_slots));
+    memset(_queue, 0, sizeof(_queue));
+    reset();
+}
+
+ForthVM::ForthVM(ForthVM& base, size_t poolSize)
+{
+    DASSERT(base._frozen, "ForthVMs can only be made on top of frozen ones");
+    start_on(base, poolSize);
+}
+
+// We begin where the frozen VM stopped: with its dictionary, its
+// variables (their cells are in its Pool, like all its data)... with
+// all of its state. Except for its Pool: our view of it is a private
+// mapping of the frozen image, so the kernel copies any page of it
+// that we write to - for us only. After the frozen part, the pages
+// are all zeros; our own part of the Pool.
+void ForthVM::start_on(ForthVM& base, size_t poolSize)
+{
+    *this = base;
+    _frozen = false;
+    _frozenSize = 0;
+    _overlays = 0;
+    _memfd = -1;
+    _frozenBase = &base;
+    _view = reinterpret_cast<char *>(mmap(
+        NULL, round_to_pages(base._poolSize), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, base._memfd, 0));
+    DASSERT(_view != MAP_FAILED, "No memory for the Pool of a ForthVM...");
+    base._overlays++;
+    _poolSize = base._frozenSize + poolSize < base._poolSize ?
+        base._frozenSize + poolSize : base._poolSize;
+    // The frozen VM's pictured numbers are on one of its pages; rather
+    // than have our first "." copy that page, we get a _hold of our own -
+    // the start of our own part of the Pool.
+    _hold = _poolData + _poolOffset;
+    _poolOffset += HOLD_SIZE;
+    _holdPtr = &_hold[HOLD_SIZE - 1];
+    // The frozen VM's free nodes are in its (read-only) pages
+    _freeCompiledNodes = FreeList<CompiledNode>();
+    _freeDictionaryEntries = FreeList<DictionaryEntry>();
+    _freeLoopStates = FreeList<LoopState>();
+    _freeIfStates = FreeList<IfState>();
+#ifdef JIT
+    // Its translations are its own; we make ours
+    _jit = Jit::State();
+#endif
+    _capture = NULL;
+    _captureSize = 0;
+    _captured = 0;
+}
+
+// What start_on got; but not the frozen VM itself.
+void ForthVM::stop_being_on_top()
+{
+    munmap(_view, round_to_pages(_frozenBase->_poolSize));
+#ifdef JIT
+    Jit::release(_jit);
+#endif
+    _frozenBase->_overlays--;
+}
+
+ForthVM::~ForthVM()
+{
+    if (_frozenBase)
+        stop_being_on_top();
+    else {
+        DASSERT(!_overlays, "A frozen ForthVM must outlive those on top of it");
+        munmap(_poolData, round_to_pages(_poolSize));
+        if (_memfd >= 0)
+            close(_memfd);
+#ifdef JIT
+        Jit::release(_jit);
+#endif
+    }
+}
+
+template <class T>
+void ForthVM::FreeList<T>::exchange()
+{
+    std::swap(_head, forward_list<T>::_freeList);
+    std::swap(_memory, forward_list<T>::_freeListMemory);
+}
+
+// Volatiles don't std::swap
+template <class T>
+static void swap_volatile(volatile T& ours, volatile T& engine)
+{
+    T tmp = ours;
+    ours = engine;
+    engine = tmp;
+}
+
+void ForthVM::exchange()
+{
+    // The tick handler must find either all of our timers, or none
+    sigset_t alarm, old;
+    sigemptyset(&alarm);
+    sigaddset(&alarm, SIGALRM);
+    sigprocmask(SIG_BLOCK, &alarm, &old);
+
+    std::swap(_poolData, Pool::pool_data);
+    std::swap(_poolSize, Pool::pool_size);
+    std::swap(_poolOffset, Pool::pool_offset);
+    _freeCompiledNodes.exchange();
+    _freeDictionaryEntries.exchange();
+    _freeLoopStates.exchange();
+    _freeIfStates.exchange();
+
+    std::swap(_stack, Forth::_stack);
+    std::swap(_dict, Forth::_dict);
+    std::swap(_loopStates, Forth::_loopStates);
+    std::swap(_rstack, Forth::_rstack);
+    std::swap(_rdepth, Forth::_rdepth);
+    std::swap(_frame, Forth::_frame);
+    std::swap(_ifStates, Forth::_ifStates);
+    std::swap(_dotNumberOfDigits, Forth::_dotNumberOfDigits);
+    std::swap(_base, Forth::_base);
+    // (Both point into our Pool)
+    std::swap(_hold, Forth::_hold);
+    std::swap(_holdPtr, Forth::_holdPtr);
+    std::swap(_tracing, Forth::_tracing);
+    std::swap(_trace, Forth::_trace);
+    std::swap(_traceNext, Forth::_traceNext);
+    std::swap(_traceCount, Forth::_traceCount);
+#ifdef WORD_PROFILE
+    std::swap(_builtinCounters, Forth::_builtinCounters);
+#endif
+    std::swap(_dictionaryKey, Forth::_dictionary_key);
+    std::swap(_compiling, Forth::_compiling);
+    std::swap(_wordBeingCompiled, Forth::_wordBeingCompiled);
+    std::swap(_definingConstant, Forth::definingConstant);
+    std::swap(_definingVariable, Forth::definingVariable);
+    std::swap(_attachingTimer, Forth::attachingTimer);
+    std::swap(_tickingWord, Forth::tickingWord);
+    std::swap(_definingDeferred, Forth::definingDeferred);
+    std::swap(_settingDeferred, Forth::settingDeferred);
+    std::swap(_definingString, Forth::definingString);
+    std::swap(_startOfString, Forth::startOfString);
+    std::swap(_definingLocals, Forth::definingLocals);
+    std::swap(_localsUninitialized, Forth::localsUninitialized);
+    std::swap(_localsComment, Forth::localsComment);
+    std::swap(_storingLocal, Forth::storingLocal);
+    std::swap(_localNames, Forth::_localNames);
+    std::swap(_localNamesUsed, Forth::_localNamesUsed);
+    std::swap(_localCount, Forth::_localCount);
+    std::swap(_localInitialized, Forth::_localInitialized);
+
+    std::swap(_callDepth, CompiledNode::_callDepth);
+    std::swap(_checking, CompiledNode::_checking);
+
+    for (int i = 0; i < TIMER_SLOTS; i++) {
+        std::swap(_slots[i]._word, Timers::_slots[i]._word);
+        std::swap(_slots[i]._period, Timers::_slots[i]._period);
+        swap_volatile(_slots[i]._countdown, Timers::_slots[i]._countdown);
+        swap_volatile(_slots[i]._queued, Timers::_slots[i]._queued);
+    }
+    for (int i = 0; i < TIMER_QUEUE; i++)
+        swap_volatile(_queue[i], Timers::_queue[i]);
+    swap_volatile(_head, Timers::_head);
+    swap_volatile(_tail, Timers::_tail);
+    std::swap(_running, Timers::_running);
+
+#ifdef JIT
+    std::swap(_jit, Jit::_state);
+#endif
+
+    std::swap(_capture, Serial._capture);
+    std::swap(_captureSize, Serial._captureSize);
+    std::swap(_captured, Serial._captured);
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// Our view of the Pool goes where the frozen VM's Pool is; the same
+// place for all the VMs on top of it, so all pointers stay valid.
+// Moving a mapping moves its pages as they are - nothing is copied.
+void ForthVM::activate()
+{
+    exchange();
+    if (!_frozenBase)
+        return;
+    size_t size = round_to_pages(_frozenBase->_poolSize);
+    void *p = mremap(_view, size, size, MREMAP_MAYMOVE | MREMAP_FIXED,
+        Pool::pool_data);
+    DASSERT(p != MAP_FAILED, "Failed to map the Pool of a ForthVM...");
+}
+
+// ...and back out of the way; leaving the frozen image in its place.
+void ForthVM::deactivate()
+{
+    if (_frozenBase) {
+        size_t size = round_to_pages(_frozenBase->_poolSize);
+        void *home = mmap(NULL, size, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        DASSERT(home != MAP_FAILED, "No memory for the Pool of a ForthVM...");
+        _view = reinterpret_cast<char *>(mremap(Pool::pool_data, size, size,
+            MREMAP_MAYMOVE | MREMAP_FIXED, home));
+        DASSERT(_view != MAP_FAILED, "Failed to map the Pool of a ForthVM...");
+        void *frozen = mmap(Pool::pool_data, size, PROT_READ,
+            MAP_SHARED | MAP_FIXED, _frozenBase->_memfd, 0);
+        DASSERT(frozen != MAP_FAILED, "Failed to map the Pool of a ForthVM...");
+    }
+    exchange();
+}
+
+bool ForthVM::usable()
+{
+    if (_frozen)
+        (void) error(F("A frozen ForthVM never changes; make one on top of it"));
+    return !_frozen;
+}
+
+// What we froze goes in a memfd: the VMs on top of us map it privately,
+// and we map it too - shared and read-only - where our Pool was, to keep
+// that place taken (see activate).
+SuccessOrFailure ForthVM::freeze()
+{
+    if (!usable())
+        return FAILURE;
+    if (_frozenBase)
+        return error(F("Only a ForthVM that isn't on top of another can be frozen"));
+    if (_compiling || !_stack.empty() || _rdepth ||
+            !_loopStates.empty() || !_ifStates.empty())
+        return error(F("A ForthVM can't be frozen in the middle of something"));
+    // The VMs on top of us start with their own words on a page of their own
+    size_t frozenSize = round_to_pages(_poolOffset);
+    if (frozenSize >= _poolSize)
+        return error(F("No room in the Pool left, after what we'd freeze"));
+    size_t size = round_to_pages(_poolSize);
+    int fd = memfd_create("forth-pool", MFD_CLOEXEC);
+    if (fd < 0)
+        return error(F("Failed to make a memfd for the frozen Pool"));
+    if (ftruncate(fd, size) < 0 ||
+            pwrite(fd, _poolData, frozenSize, 0) != (ssize_t) frozenSize ||
+            mmap(_poolData, size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        close(fd);
+        return error(F("Failed to write the frozen Pool to its memfd"));
+    }
+    _memfd = fd;
+    _frozenSize = frozenSize;
+    _poolOffset = frozenSize;
+    _frozen = true;
+    return SUCCESS;
+}
+
+SuccessOrFailure ForthVM::eval(const char *source)
+{
+    if (!usable())
+        return FAILURE;
+    Active active(*this);
+    unsigned errors = errors_so_far();
+
+    // parse_line tokenizes in place; so, in a copy of our own.
+    size_t len = strlen(source);
+    char *copy = reinterpret_cast<char *>(malloc(len + 1));
+    if (!copy)
+        return error(F("No memory to copy the source to evaluate..."));
+    memcpy(copy, source, len + 1);
+
+    SuccessOrFailure ret = SUCCESS;
+    char *line = copy, *end = copy + len;
+    while (line < end) {
+        char *eol = strchr(line, '\n');
+        if (!eol)
+            eol = end;
+        *eol = '\0';
+        if (!Forth::parse_line(line, eol))
+            ret = FAILURE;
+        line = eol + 1;
+    }
+    free(copy);
+
+    // Many errors don't stop the line, so parse_line doesn't fail them
+    return errors == errors_so_far() ? ret : FAILURE;
+}
+
+void ForthVM::push(int cell)
+{
+    if (!usable())
+        return;
+    Active active(*this);
+    Forth::_stack.push(cell);
+}
+
+Optional<int> ForthVM::pop()
+{
+    if (!usable())
+        return FAILURE;
+    Active active(*this);
+    if (Forth::_stack.empty())
+        return FAILURE;
+    int top = Forth::_stack.top();
+    Forth::_stack.pop();
+    return top;
+}
+
+unsigned ForthVM::depth()
+{
+    // (Frozen VMs have nothing on their stack)
+    if (_frozen)
+        return 0;
+    Active active(*this);
+    return Forth::_stack.depth();
+}
+
+void ForthVM::capture(char *buffer, size_t size)
+{
+    _capture = buffer;
+    _captureSize = buffer ? size : 0;
+    _captured = 0;
+    if (buffer && size)
+        buffer[0] = '\0';
+}
+
+void ForthVM::reset()
+{
+    if (!usable())
+        return;
+    if (_frozenBase) {
+        // Back to the frozen VM's words - and to its pages
+        ForthVM& base = *_frozenBase;
+        size_t ownPoolSize = _poolSize - base._frozenSize;
+        char *capture = _capture;
+        size_t captureSize = _captureSize;
+        stop_being_on_top();
+        start_on(base, ownPoolSize);
+        this->capture(capture, captureSize);
+        return;
+    }
+    Active active(*this);
+    // Without the banner: there's no human on the other side
+    char *capture = Serial._capture;
+    size_t size = Serial._captureSize, captured = Serial._captured;
+    static char banner;
+    Serial._capture = &banner;
+    Serial._captureSize = 0;
+    Forth::reset();
+    Serial._capture = capture;
+    Serial._captureSize = size;
+    Serial._captured = captured;
+}
@@ -0,0 +1,185 @@
+#ifndef __FORTH_VM_H__
+#define __FORTH_VM_H__
+
+#include "miniforth.h"
+#include "timers.h"
+#include "jit.h"
+
+// A Forth of our own - for host programs that embed the engine
+// (they link with libminiforth.a; see 'make -C src_x86 lib').
+//
+// The engine keeps all of its state in statics - so that the AVR never
+// pays for passing a 'this' around. So instead, each ForthVM keeps its
+// own copy of that state (its own Pool, too); and while one of its
+// methods runs, it swaps it with the engine's - and back, when done.
+// The AVR build doesn't even know about it.
+//
+// So any number of ForthVMs can live side by side; but there is still
+// just the one engine. Only one VM per process is active at a time -
+// from one thread at a time: ForthVMs are neither reentrant nor usable
+// concurrently. And every eval, push or pop pays for the swap, twice:
+// all of the engine's statics, plus (on top of a frozen VM) moving the
+// mapping of the VM's Pool into place. A VM's periodic words (EVERY) only run
+// while that VM is in use. A VM whose Pool fills up gets errors (see
+// POOL_SAFETY_MARGIN); but a DASSERT still halts the whole process.
+//
+// Many VMs that need the same library of words don't each have to
+// compile it: compile it once in a VM, freeze() it - and make the others
+// on top of it. They all share its (read-only) Pool; each one adds its
+// own words and data after it, and gets its own copy of its variables.
+// A write to anything else of the shared part - an ALLOT-ed array,
+// a DEFER-ed word - copies just the page it falls in, for that VM only:
+// each VM maps the frozen Pool privately, and the kernel copies on write.
+// So each VM only costs what it added to - or changed in - the library.
+class ForthVM {
+public:
+    explicit ForthVM(size_t poolSize = POOL_SIZE);
+    // On top of a frozen VM, with room for 'poolSize' bytes of our own
+    // (but no more than what the frozen one had left). It must outlive us.
+    ForthVM(ForthVM& base, size_t poolSize);
+    ~ForthVM();
+
+    // Run Forth source: one or more lines, separated by '\n'.
+    // Fails if anything in there reported an error.
+    SuccessOrFailure eval(const char *source);
+
+    // The data stack
+    void push(int cell);
+    Optional<int> pop();
+    unsigned depth();
+
+    // From now on, what this VM prints goes to 'buffer' - always
+    // NUL-terminated, and truncated if need be - instead of stdout.
+    // A NULL buffer sends it to stdout again.
+    void capture(char *buffer, size_t size);
+    // ...and how much it printed since then (truncated or not).
+    size_t captured() const { return _captured; }
+
+    // Forget all the words, and empty the stacks; like RESET.
+    // (On top of a frozen VM, go back to just its words. A RESET
+    // from Forth forgets those too, though.)
+    void reset();
+
+    // Share all we have so far with the VMs made on top of us; and
+    // from now on, never change. Fails if we are in the middle of
+    // something (compiling, or with things on the stack).
+    SuccessOrFailure freeze();
+    // ...and how much of our Pool that was.
+    size_t frozen_size() const { return _frozenSize; }
+
+private:
+    // No copies; they would share our Pool. (But the constructor on top
+    // of a frozen VM starts with a copy of its state; see there)
+    ForthVM(const ForthVM&);
+    ForthVM& operator=(const ForthVM&) = default;
+
+    // Swap our state with the engine's - once to start using us,
+    // and once more to stop.
+    void exchange();
+    void activate();
+    void deactivate();
+    struct Active {
+        ForthVM& _vm;
+        ForthVM *_previous;
+        Active(ForthVM& vm):_vm(vm), _previous(_active) { _vm.activate(); _active = &vm; }
+        ~Active() { _vm.deactivate(); _active = _previous; }
+    };
+    static ForthVM *_active;
+
+    // Frozen VMs don't run anything
+    bool usable();
+
+    void start_on(ForthVM& base, size_t poolSize);
+    void stop_being_on_top();
+
+    // Once frozen: how much of our Pool we share, how many VMs are
+    // made on top of us, and the memfd that holds what we share.
+    bool _frozen;
+    size_t _frozenSize;
+    unsigned _overlays;
+    int _memfd;
+
+    // ...or, if we are made on top of a frozen VM: that one; and our
+    // (private) mapping of its memfd - where it is while we are not active.
+    ForthVM *_frozenBase;
+    char *_view;
+
+    // The nodes that our lists released, for them to reuse
+    template <class T>
+    struct FreeList {
+        typename forward_list<T>::box *_head;
+        unsigned _memory;
+        FreeList():_head(NULL), _memory(0) {}
+        void exchange();
+    };
+
+    // Pool
+    char *_poolData;
+    size_t _poolSize;
+    size_t _poolOffset;
+    FreeList<CompiledNode> _freeCompiledNodes;
+    FreeList<DictionaryEntry> _freeDictionaryEntries;
+    FreeList<LoopState> _freeLoopStates;
+    FreeList<IfState> _freeIfStates;
+
+    // Forth
+    StackNodes _stack;
+    DictionaryType _dict;
+    LoopsStates _loopStates;
+    StackNode _rstack[RSTACK_SIZE];
+    uint8_t _rdepth;
+    uint8_t _frame;
+    IfStates _ifStates;
+    int _dotNumberOfDigits;
+    int *_base;
+    char *_hold;
+    char *_holdPtr;
+    int *_tracing;
+    Forth::TraceRecord _trace[TRACE_SIZE];
+    unsigned _traceNext, _traceCount;
+#ifdef WORD_PROFILE
+    WordCounter *_builtinCounters;
+#endif
+    Word _dictionaryKey;
+    bool _compiling;
+    DictionaryPtr _wordBeingCompiled;
+    bool _definingConstant;
+    bool _definingVariable;
+    bool _attachingTimer;
+    bool _tickingWord;
+    bool _definingDeferred;
+    bool _settingDeferred;
+    bool _definingString;
+    const char *_startOfString;
+    bool _definingLocals;
+    bool _localsUninitialized;
+    bool _localsComment;
+    bool _storingLocal;
+    char _localNames[LOCAL_NAMES_SIZE];
+    uint8_t _localNamesUsed;
+    uint8_t _localCount;
+    uint8_t _localInitialized;
+
+    // CompiledNode
+    unsigned _callDepth;
+    bool _checking;
+
+    // Timers
+    Timers::Slot _slots[TIMER_SLOTS];
+    uint8_t _queue[TIMER_QUEUE];
+    uint8_t _head;
+    uint8_t _tail;
+    bool _running;
+
+#ifdef JIT
+    // The translations of our words
+    Jit::State _jit;
+#endif
+
+    // Serial
+    char *_capture;
+    size_t _captureSize;
+    size_t _captured;
+};
+
+#endif
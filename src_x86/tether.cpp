@@ -0,0 +1,499 @@
+// A host-side, tethered compiler for MiniForth.
+//
+// Reads a Forth source file, and compiles every ':' definition in it
+// right here in the host - with the very same engine, against a mirror
+// of the target's dictionary. The compiled bodies are sent to the target
+// as binary frames (see src/frames.cpp), that it links directly into
+// its dictionary. Everything else is sent as text.
+//
+// Usage:
+//     tether <file.fs>           ...writes the upload stream to stdout
+//     tether <file.fs> <port>    ...uploads it to the board on <port>
+//     tether --decode <file.fs>  ...decodes a ".TRACE" dump, from stdin
+//
+// The first form can be piped to the x86 build (see 'make test-tether').
+// The second follows the XON credits of the firmware (see getline.cpp).
+// The third just builds the mirror - and uses it to name the ids
+// of the trace that the target dumped, after running <file.fs>.
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+
+#include "miniforth.h"
+#include "helpers.h"
+
+SerialStub Serial;
+
+// Where the upload stream goes: stdout, or the serial port.
+// (The host engine's own messages go to stderr.)
+static int outFd = -1;
+static bool toBoard = false;
+
+// The device's stdout, when talking to a board
+static int echoFd = -1;
+
+static unsigned char frame[4096];
+static unsigned frameLen;
+static unsigned char frameChecksum;
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "[x] %s\n", msg);
+    exit(1);
+}
+
+static SuccessOrFailure emit_byte(unsigned char c)
+{
+    if (frameLen >= sizeof(frame))
+        return FAILURE;
+    frame[frameLen++] = c;
+    frameChecksum += c;
+    return SUCCESS;
+}
+
+static SuccessOrFailure emit_varint(unsigned val)
+{
+    while(val >= 0x80) {
+        if (!emit_byte(0x80 | (val & 0x7F)))
+            return FAILURE;
+        val >>= 7;
+    }
+    return emit_byte(val);
+}
+
+static SuccessOrFailure emit_chars(const char *p)
+{
+    size_t len = strlen(p);
+    if (len >= MAX_LINE_LENGTH || !emit_byte(len))
+        return FAILURE;
+    while(*p)
+        if (!emit_byte(*p++))
+            return FAILURE;
+    return SUCCESS;
+}
+
+// How far from the top of the dictionary a word is
+static Optional<unsigned> distance_of(DictionaryPtr wrd)
+{
+    unsigned distance = 0;
+    for(auto it = Forth::_dict.begin(); it != Forth::_dict.end(); ++it) {
+        if (&*it == wrd)
+            return distance;
+        distance++;
+    }
+    return FAILURE;
+}
+
+static SuccessOrFailure emit_node(CompiledNode& node)
+{
+    if (!emit_byte(node._kind))
+        return FAILURE;
+    switch(node._kind) {
+    case CompiledNode::LITERAL: {
+        // Zig-zag, so that small negatives stay small
+        int v = node._u._literal._intVal;
+        return emit_varint(((unsigned)v << 1) ^ (unsigned)-(v < 0));
+    }
+    case CompiledNode::STRING:
+        return emit_chars(node._u._string._strVal.c_str());
+    case CompiledNode::C_FUNC: {
+        return emit_byte(node._u._function._index);
+    }
+    case CompiledNode::WORD: {
+        auto distance = distance_of(node._u._word._dictPtr);
+        return distance ? emit_varint(distance.value()) : FAILURE;
+    }
+    case CompiledNode::XT: {
+        // Our tokens are our addresses; send what the target can resolve
+        int v = node._u._xt._xt;
+        if (node._u._xt._dictPtr) {
+            auto distance = distance_of(node._u._xt._dictPtr);
+            if (!distance)
+                return FAILURE;
+            v = distance.value();
+        }
+        return emit_varint(((unsigned)v << 1) ^ (unsigned)-(v < 0));
+    }
+    case CompiledNode::CASE:
+    case CompiledNode::OF:
+    case CompiledNode::ENDOF:
+    case CompiledNode::ENDCASE:
+        // Our jump targets are our addresses; the target finds its own
+        return SUCCESS;
+    case CompiledNode::LOCALS:
+        if (!emit_byte(node._u._locals._count))
+            return FAILURE;
+        return emit_byte(node._u._locals._initialized);
+    case CompiledNode::LOCAL:
+    case CompiledNode::TO_LOCAL:
+        return emit_byte(node._u._local._slot);
+    default:
+        // Nothing else can be inside a ':' definition...
+        // or if it can, we don't know how to send it yet.
+        return FAILURE;
+    }
+}
+
+// Build the frame for a word that we just compiled
+static SuccessOrFailure build_frame(DictionaryPtr wrd)
+{
+    frameLen = 0;
+    // FRAME_START, and room for the length - known only at the end
+    for(int i=0; i<3; i++)
+        if (!emit_byte(i ? 0 : FRAME_START))
+            return FAILURE;
+    // ...the checksum covers everything after it
+    frameChecksum = 0;
+    if (!emit_chars(wrd->name()))
+        return FAILURE;
+
+    // The target pushes nodes at the front of its list - send them reversed
+    static CompiledNode *reversed[sizeof(frame)/2];
+    unsigned count = 0;
+    CompiledNodes& nodes = wrd->getCompiledNodes();
+    for(auto it = nodes.begin(); it != nodes.end(); ++it) {
+        if (count == sizeof(reversed)/sizeof(reversed[0]))
+            return FAILURE;
+        reversed[count++] = &*it;
+    }
+    if (!emit_varint(count))
+        return FAILURE;
+    while(count)
+        if (!emit_node(*reversed[--count]))
+            return FAILURE;
+    unsigned char checksum = frameChecksum;
+    if (!emit_byte(checksum))
+        return FAILURE;
+    frame[1] = (frameLen - 3) & 0xFF;
+    frame[2] = (frameLen - 3) >> 8;
+    return SUCCESS;
+}
+
+static void write_all(const void *buf, size_t len)
+{
+    const char *p = reinterpret_cast<const char *>(buf);
+    while(len) {
+        ssize_t n = write(outFd, p, len);
+        if (n <= 0)
+            die("Failed to write the upload stream");
+        p += n;
+        len -= n;
+    }
+}
+
+// Echo what the board says - for up to 'timeout' msec of silence.
+// Returns true as soon as the board grants us credit for another line.
+static bool echo_board(int timeout)
+{
+    while(true) {
+        struct pollfd pfd = { outFd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout) <= 0)
+            return false;
+        unsigned char buf[256];
+        ssize_t n = read(outFd, buf, sizeof(buf));
+        if (n <= 0)
+            die("Failed to read from the board");
+        bool credit = false;
+        for(ssize_t i=0; i<n; i++) {
+            if (buf[i] == XON_CHAR)
+                credit = true;
+            else if (write(echoFd, &buf[i], 1) != 1)
+                die("Failed to echo the board's output");
+        }
+        if (credit)
+            return true;
+    }
+}
+
+static void wait_for_credit()
+{
+    if (toBoard && !echo_board(10000))
+        die("Timeout waiting for the board's prompt");
+}
+
+static unsigned textLines, frames, frameBytes;
+
+static void send_text(const char *begin, const char *end)
+{
+    while(begin < end && isspace(*begin))
+        begin++;
+    while(end > begin && isspace(end[-1]))
+        end--;
+    if (begin == end)
+        return;
+    if (end - begin >= MAX_LINE_LENGTH - 1)
+        fprintf(stderr, "[x] Warning: line longer than the target accepts\n");
+    write_all(begin, end - begin);
+    // The '\r' ends the line for the board, the '\n' for the x86 build.
+    write_all("\r\n", 2);
+    textLines++;
+    wait_for_credit();
+}
+
+// The host engine's output (errors aside) is just noise - e.g. banners
+static void quietly(void (*action)())
+{
+    fflush(stdout);
+    int saved = dup(1);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 1);
+    action();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(devNull);
+    close(saved);
+}
+
+static void host_reset()
+{
+    quietly(Forth::reset);
+}
+
+// The target will create a constant, variable or DEFER-ed word called 'name';
+// all we need in our mirror is something with that name, at the
+// same place in the dictionary.
+static void mirror_name(const char *name)
+{
+    static char buf[MAX_LINE_LENGTH + 16];
+    snprintf(buf, sizeof(buf), "0 constant %s", name);
+    Forth::parse_line(buf, buf + strlen(buf));
+}
+
+// The ':' definition being collected - possibly across many lines
+static char definition[16384];
+static size_t definitionLen;
+
+static void append_definition(const char *begin, const char *end)
+{
+    size_t len = end - begin;
+    if (definitionLen + len + 1 >= sizeof(definition))
+        die("Definition too long");
+    memcpy(&definition[definitionLen], begin, len);
+    definitionLen += len;
+    definition[definitionLen] = '\0';
+}
+
+static void finish_definition()
+{
+    static char buf[sizeof(definition)];
+    strcpy(buf, definition);
+    if (!Forth::parse_line(buf, buf + strlen(buf)) || Forth::is_compiling()) {
+        fprintf(stderr, "[x] Failed to compile:\n%s\n", definition);
+        exit(1);
+    }
+    if (build_frame(&*Forth::_dict.begin())) {
+        write_all(frame, frameLen);
+        frames++;
+        frameBytes += frameLen;
+        wait_for_credit();
+    } else {
+        // Something we can't (yet) send pre-compiled; the target
+        // will have to compile this one on its own.
+        char *line = definition;
+        while(line) {
+            char *eol = strchr(line, '\n');
+            send_text(line, eol ? eol : line + strlen(line));
+            line = eol ? eol + 1 : NULL;
+        }
+    }
+    definitionLen = 0;
+}
+
+static void process_line(char *line)
+{
+    static bool inDefinition = false;
+    static bool inString = false;
+    static bool nameExpected = false;
+
+    char *lineEnd = line + strlen(line);
+    char *textStart = line;
+    char *p = line;
+    while(true) {
+        while(*p && isspace(*p))
+            p++;
+        if (!*p)
+            break;
+        char *tok = p;
+        while(*p && !isspace(*p))
+            p++;
+        char saved = *p;
+        *p = '\0';
+        bool isComment = !inString && !strcmp(tok, "\\");
+        if (inString) {
+            if (!strcmp(tok, "\""))
+                inString = false;
+        } else if (isComment) {
+            // ...to the end of the line.
+        } else if (!strcmp(tok, ".\"")) {
+            inString = true;
+        } else if (inDefinition) {
+            if (!strcmp(tok, ";")) {
+                *p = saved;
+                append_definition(textStart, p);
+                finish_definition();
+                inDefinition = false;
+                textStart = p;
+                continue;
+            }
+        } else if (nameExpected) {
+            mirror_name(tok);
+            nameExpected = false;
+        } else if (!strcmp(tok, "variable") || !strcmp(tok, "constant") ||
+                   !strcasecmp(tok, "defer")) {
+            nameExpected = true;
+        } else if (!strcasecmp(tok, "reset")) {
+            host_reset();
+        } else if (!strcmp(tok, ":")) {
+            send_text(textStart, tok);
+            inDefinition = true;
+            textStart = tok;
+        }
+        *p = saved;
+        if (isComment) {
+            if (inDefinition)
+                lineEnd = tok;
+            break;
+        }
+    }
+    if (inDefinition) {
+        append_definition(textStart, lineEnd);
+        append_definition("\n", "\n" + 1);
+    } else
+        send_text(textStart, lineEnd);
+}
+
+static int open_port(const char *port)
+{
+    int fd = open(port, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        die("Failed to open the serial port");
+    struct termios tio;
+    if (!tcgetattr(fd, &tio)) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIFLUSH);
+    }
+    return fd;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What a trace id (see TRACE_LITERAL in defines.h) refers to
+static const char *name_of_trace_id(unsigned id)
+{
+    if (id == TRACE_LITERAL)
+        return "(literal)";
+    if (id == TRACE_STRING)
+        return "(string)";
+    if (id == TRACE_CONTROL)
+        return "(CASE/OF/ENDOF/ENDCASE)";
+    if (id == TRACE_LOCAL)
+        return "(local)";
+    if (id & TRACE_BUILTIN) {
+        const char *name = Forth::name_of_C_op(id & ~TRACE_BUILTIN);
+        return name ? name : "(unknown native)";
+    }
+    // Dictionary index, counting from the oldest entry
+    unsigned total = 0;
+    for(auto& word: Forth::_dict) {
+        (void) word;
+        total++;
+    }
+    if (id >= total)
+        return "(unknown word)";
+    auto it = Forth::_dict.begin();
+    for(unsigned distance = total - 1 - id; distance; distance--)
+        ++it;
+    return it->name();
+}
+
+// Turn each "id depth top-of-stack" line of a .TRACE dump into names.
+// The top of the stack is as wide as the target's int.
+static void decode_trace(FILE *fp)
+{
+    static char line[256];
+    while(fgets(line, sizeof(line), fp)) {
+        unsigned id, depth;
+        char tos[32];
+        if (sscanf(line, "%4x %2x %31[0-9A-Fa-f]", &id, &depth, tos) != 3)
+            continue;
+        unsigned long raw = strtoul(tos, NULL, 16);
+        unsigned bits = 4*strlen(tos);
+        long value = bits < 8*sizeof(long) && (raw >> (bits - 1)) & 1 ?
+            (long)(raw - (1UL << bits)) : (long)raw;
+        if (depth)
+            printf("%-20s depth %3u  top %ld\n", name_of_trace_id(id), depth, value);
+        else
+            printf("%-20s depth %3u\n", name_of_trace_id(id), depth);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool decoding = argc == 3 && !strcmp(argv[1], "--decode");
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <file.fs> [<port>]\n", argv[0]);
+        fprintf(stderr, "       %s --decode <file.fs> < trace\n", argv[0]);
+        return 1;
+    }
+    FILE *fp = fopen(argv[decoding ? 2 : 1], "r");
+    if (!fp)
+        die("Failed to open the Forth source");
+
+    // Our own engine's messages go to stderr; stdout is for the
+    // upload stream, or for what the board says.
+    fflush(stdout);
+    if (decoding) {
+        // Build the mirror - but upload nothing.
+        outFd = open("/dev/null", O_WRONLY);
+        echoFd = dup(1);
+    } else if (argc == 3) {
+        toBoard = true;
+        outFd = open_port(argv[2]);
+        echoFd = dup(1);
+    } else
+        outFd = dup(1);
+    dup2(2, 1);
+
+    // Both our mirror and the target start from a clean dictionary.
+    // Then drain all the board says, so we hold exactly one credit.
+    host_reset();
+    write_all("\rreset\r\n", 8);
+    wait_for_credit();
+    while(toBoard && echo_board(500))
+        ;
+
+    double start = now();
+    static char line[1024];
+    while(fgets(line, sizeof(line), fp))
+        process_line(line);
+    fclose(fp);
+    if (definitionLen)
+        die("The last definition is missing its ';'");
+
+    if (decoding) {
+        fflush(stdout);
+        dup2(echoFd, 1);
+        decode_trace(stdin);
+        return 0;
+    }
+    fprintf(stderr,
+        "[-] Sent %u frames (%u bytes) and %u text lines in %.3f sec\n",
+        frames, frameBytes, textLines, now() - start);
+    return 0;
+}
@@ -0,0 +1,93 @@
+// Embedding MiniForth in a host program - see forth_vm.h.
+//
+// Two interpreters, side by side: each has its own dictionary and
+// stack, and we take turns with them. What they print, we capture.
+#include <stdio.h>
+#include <string.h>
+
+#include "forth_vm.h"
+
+static int failures = 0;
+
+static void expect(const char *what, const char *got, const char *expected)
+{
+    bool ok = !strcmp(got, expected);
+    printf("%s %s: \"%s\"\n", ok ? "[-]" : "[x]", what, got);
+    if (!ok) {
+        printf("    (expected \"%s\")\n", expected);
+        failures++;
+    }
+}
+
+int main()
+{
+    char outA[128], outB[128];
+    ForthVM a, b(16384);
+    a.capture(outA, sizeof(outA));
+    b.capture(outB, sizeof(outB));
+
+    // The same name, two different words
+    a.eval(": answer 42 ;\n: show answer . ;");
+    b.eval(": answer 6 7 * 1 + ;\n"
+           ": show answer . ;");
+    a.eval("show");
+    b.eval("show");
+    expect("A says", outA, " 42");
+    expect("B says", outB, " 43");
+
+    // Cells go in and out of each stack separately
+    a.push(1000);
+    b.push(7);
+    a.eval("3 *");
+    b.eval("DUP *");
+    Optional<int> fromA = a.pop(), fromB = b.pop();
+    char nums[64];
+    snprintf(nums, sizeof(nums), "%d %d - and %u %u left",
+        fromA ? fromA.value() : -1, fromB ? fromB.value() : -1,
+        a.depth(), b.depth());
+    expect("Popped", nums, "3000 49 - and 0 0 left");
+
+    // Errors fail the eval - and don't leak into the other VM
+    a.capture(outA, sizeof(outA));
+    bool failed = !a.eval("nosuchword");
+    bool fine = b.eval("1 2 + DROP");
+    expect("Unknown words fail", failed && fine ? "yes" : "no", "yes");
+
+    // Output that doesn't fit is truncated - but still counted
+    char tiny[8];
+    b.capture(tiny, sizeof(tiny));
+    b.eval(": many 10 0 DO I . LOOP ; many");
+    char counts[64];
+    snprintf(counts, sizeof(counts), "%s (%zu)", tiny, b.captured());
+    expect("Truncated", counts, " 0 1 2  (20)");
+
+    // A library, compiled once - and shared by the VMs on top of it
+    ForthVM library(65536);
+    library.eval("0 variable hits\n"
+                 "10 CELLS ALLOT constant slots\n"
+                 ": hit hits @ 1 + hits ! ;\n"
+                 ": slot CELLS slots + ;\n"
+                 "DEFER greet");
+    library.freeze();
+    {
+        ForthVM c(library, 4096), d(library, 4096);
+        c.capture(outA, sizeof(outA));
+        d.capture(outB, sizeof(outB));
+        // Each has its own copy of the variables, arrays, DEFER-ed words
+        c.eval("hit hit 7 3 slot ! : hi 1 ; ' hi IS greet");
+        d.eval("hit 9 3 slot ! : hi 2 ; ' hi IS greet");
+        c.eval("hits @ . 3 slot @ . greet .");
+        d.eval("hits @ . 3 slot @ . greet .");
+        expect("C's library", outA, " 2 7 1");
+        expect("D's library", outB, " 1 9 2");
+        d.reset();
+        d.eval("hits @ . 3 slot @ .");
+        expect("D, after reset()", outB, " 0 0");
+    }
+    ForthVM e(library, 4096);
+    e.capture(outA, sizeof(outA));
+    e.eval("hits @ . 3 slot @ .");
+    expect("The library never changed", outA, " 0 0");
+
+    return failures ? 1 : 0;
+}
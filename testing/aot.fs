@@ -0,0 +1,61 @@
+\ The corners of the ahead-of-time translator (see src_x86/aot.cpp).
+\ 'make test-aot' translates the words of this file, and builds them
+\ into the x86 build; run through that, and through the plain one
+\ (where the interpreter runs them all), both must print the same.
+." Arithmetic... " : ar 7 3 - 5 * 2 / 9 + ; ar . -7 2 / . -7 2 MOD .
+." Wrapping around... " : big $7FFFFFFF 1 + ; big .
+: neg 0 SWAP - ; big neg .
+." Comparisons... " : cmp DUP ROT DUP ROT < . = . ; 1 2 cmp 2 2 cmp
+." Shifts... " : sh 1 SWAP LSHIFT U. ; 31 sh 32 sh 33 sh
+: shr -1 SWAP RSHIFT U. ; 1 shr 32 shr 0 shr
+." Bits... " : bits 12 10 AND 3 OR 6 XOR INVERT ; bits .
+." Scaling... " : scl 1000 3 7 */ ; scl . : sc2 */ ; 10 20 3 sc2 .
+." Stack shuffles... " : sf 1 2 3 ROT SWAP DUP ; sf . . . .
+." Deep shuffles... " : dp 1 2 3 4 5 6 ROT ROT DROP SWAP DUP ; dp .S
+." Takes from below... " : tb + + ; 1 2 3 tb .
+." Division by zero, deep inside... " : dz 0 / ; : dzz 1 2 3 dz 4 ;
+10 dzz
+." ...leaves the stack as the interpreter does... " .S
+DROP DROP DROP
+." MOD by zero in a loop... " : mz 3 0 DO 10 I MOD . LOOP ; mz
+." Arrays... " 8 CELLS ALLOT constant arr
+: fill 8 0 DO I I * arr I CELLS + ! LOOP ;
+: sum 0 8 0 DO arr I CELLS + @ + LOOP ; fill sum .
+." ...through an address on the stack... " : at1 @ 1 + ; arr 3 CELLS + at1 .
+: st! ! ; 77 arr st! arr @ .
+." Bytes... "
+: cb DUP 0 SWAP C! DUP 5 SWAP CSET DUP 4 SWAP CCLEAR DUP 3 SWAP CTOGGLE C@ ;
+arr cb .
+." A variable... " 5 variable vv : inc vv @ 1 + vv ! ; inc inc vv @ .
+: twice inc inc ; twice vv @ .
+." Nested loops... " : nl 3 0 DO 4 1 DO J I * . LOOP LOOP ; nl
+." Loops in calls in loops... " : in4 4 0 DO I . LOOP ;
+: out2 2 0 DO in4 LOOP ; out2
+." Loop runs at least once... " : once 0 5 DO I . LOOP ; once
+." Big loop... " : bl 0 SWAP 0 DO I + LOOP ; 100000 bl .
+." IF/ELSE... " : sgn DUP 0 < IF DROP -1 ELSE 0 > THEN ;
+5 sgn . -5 sgn . 0 sgn .
+." IF, THEN... " : ab DUP 0 < IF 0 SWAP - THEN ; -3 ab . 3 ab .
+." IF with calls... " : pk IF in4 ELSE sgn . THEN ; 1 pk 7 0 pk
+." IF in a loop... " : ev 6 0 DO I 2 MOD IF ." odd " ELSE I . THEN LOOP ;
+ev
+." Return stack... " : rs 10 >R 20 >R R@ . R> R> + ; rs .
+." ...across a loop... " : rl 7 >R 3 0 DO I R@ * . LOOP R> DROP ; rl
+." Printing... " : pr 42 . -1 U. 5 U.R 7 . CR ." done " ; pr
+." Strings... " : hi ." hello " ." world " ; hi
+." Waiting... " : wt 5 MS 100 US 0 MS -1 MS ." waited " ; wt
+." Ticks... " : tk TICKS TICKS SWAP - 0 < ; tk .
+." Recursion... " : fact DUP 1 > IF DUP 1 - RECURSE * THEN ; 10 fact .
+." Callers of recursion... " : f5 5 fact ; f5 .
+." ...and ELSE... " : r2 DUP IF DUP 1 - RECURSE + ELSE DROP 0 THEN ;
+4 r2 .
+." Locals... " : lsum {: a b :} a b + ; 3 4 lsum .
+." CASE... " : cs CASE 1 OF 10 ENDOF 2 OF 20 ENDOF 0 SWAP ENDCASE ;
+2 cs .
+." Execution tokens... " : xt ['] ab EXECUTE ; -9 xt .
+." Deferred words... " DEFER op : dbl op op ; ' neg IS op 4 dbl .
+." Redefined words... " : two 2 ; : four two two + ; four .
+: two 3 ; four . two .
+." Long names... " : a_really_long_name 1 2 + ; a_really_long_name .
+\ (For the periodic words' check, in 'make test-aot')
+: spin 7 SWAP 0 DO I DROP LOOP ;
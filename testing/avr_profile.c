@@ -0,0 +1,278 @@
+/*
+ * Cycle-accurate, per-word profiler for MiniForth - under simavr.
+ *
+ * Usage:
+ *     avr_profile <firmware.elf> <scenario.fs>
+ *
+ * Runs a profiling build of the firmware (see src/profile_marks.h)
+ * inside an ATmega328P at 16MHz; feeds it the scenario over the UART -
+ * one line per XON credit, just like testing/test_forth.py does - and
+ * watches its marks in GPIOR0. When the scenario is done, it reports
+ * for each word (and each piece of marked native code) the calls,
+ * and the inclusive/exclusive cycles spent in it.
+ *
+ * What the firmware says is echoed to stderr; the report goes to stdout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "avr_uart.h"
+
+#include "../src/profile_marks.h"
+
+#define XON_CHAR     0x11
+#define GPIOR0_ADDR  0x3E
+#define GPIOR1_ADDR  0x4A
+#define GPIOR2_ADDR  0x4B
+
+#define MAX_NAME     32
+#define MAX_ENTRIES  512
+#define MAX_DEPTH    256
+
+typedef struct {
+    char name[MAX_NAME];
+    unsigned long calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+    int active;  /* recursion: only the outermost call counts as inclusive */
+} entry_t;
+
+typedef struct {
+    entry_t *entry;
+    avr_cycle_count_t start;
+    avr_cycle_count_t children;
+} frame_t;
+
+static entry_t entries[MAX_ENTRIES];
+static int entryCount;
+static frame_t stack[MAX_DEPTH];
+static int depth;
+static unsigned long lostMarks;
+
+static entry_t *entry_for(const char *name)
+{
+    for (int i = 0; i < entryCount; i++)
+        if (!strcmp(entries[i].name, name))
+            return &entries[i];
+    if (entryCount == MAX_ENTRIES) {
+        fprintf(stderr, "[x] Too many distinct names; raise MAX_ENTRIES\n");
+        exit(1);
+    }
+    entry_t *e = &entries[entryCount++];
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    return e;
+}
+
+/* The names are NUL-terminated strings, in SRAM or in Flash */
+static void read_name(avr_t *avr, int inFlash, uint16_t addr, char *name)
+{
+    const uint8_t *mem = inFlash ? avr->flash : avr->data;
+    uint32_t limit = inFlash ? avr->flashend : avr->ramend;
+    uint32_t i = 0;
+    while (i < MAX_NAME - 1 && addr + i <= limit && mem[addr + i]) {
+        name[i] = mem[addr + i];
+        i++;
+    }
+    name[i] = '\0';
+}
+
+static void on_mark(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+    (void) addr;
+    (void) param;
+    avr_cycle_count_t now = avr->cycle;
+    if (v == MARK_EXIT) {
+        if (!depth) {
+            lostMarks++;
+            return;
+        }
+        frame_t *f = &stack[--depth];
+        avr_cycle_count_t inclusive = now - f->start;
+        f->entry->exclusive += inclusive - f->children;
+        if (!--f->entry->active)
+            f->entry->inclusive += inclusive;
+        if (depth)
+            stack[depth - 1].children += inclusive;
+        return;
+    }
+    if (v != MARK_WORD && v != MARK_NATIVE)
+        return;
+    if (depth == MAX_DEPTH) {
+        fprintf(stderr, "[x] Marks nested too deep; raise MAX_DEPTH\n");
+        exit(1);
+    }
+    char name[MAX_NAME];
+    uint16_t nameAddr = avr->data[GPIOR1_ADDR] | (avr->data[GPIOR2_ADDR] << 8);
+    read_name(avr, v == MARK_NATIVE, nameAddr, name);
+    frame_t *f = &stack[depth++];
+    f->entry = entry_for(name);
+    f->entry->calls++;
+    f->entry->active++;
+    f->start = now;
+    f->children = 0;
+}
+
+/* The scenario, and where we are in it */
+static char *scenario;
+static size_t scenarioPos, scenarioLen;
+
+/* The bytes of the line we are currently sending */
+static char pending[256];
+static size_t pendingPos, pendingLen;
+static int uartBusy;
+static int finished;
+
+static void next_line(void)
+{
+    pendingPos = pendingLen = 0;
+    while (scenarioPos < scenarioLen && pendingLen < sizeof(pending) - 2) {
+        char c = scenario[scenarioPos++];
+        if (c == '\n')
+            break;
+        pending[pendingLen++] = c;
+    }
+    pending[pendingLen++] = '\r';
+}
+
+static void on_uart_output(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    (void) irq;
+    (void) param;
+    if (value == XON_CHAR) {
+        /* The firmware granted us credit for one more line */
+        if (scenarioPos >= scenarioLen)
+            finished = 1;
+        else
+            next_line();
+    } else
+        fputc(value, stderr);
+}
+
+static void on_uart_xon(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    (void) irq;
+    (void) value;
+    (void) param;
+    uartBusy = 0;
+}
+
+static void on_uart_xoff(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    (void) irq;
+    (void) value;
+    (void) param;
+    uartBusy = 1;
+}
+
+static int by_exclusive(const void *a, const void *b)
+{
+    const entry_t *ea = a, *eb = b;
+    return ea->exclusive < eb->exclusive ? 1 : ea->exclusive > eb->exclusive ? -1 : 0;
+}
+
+static void report(avr_t *avr)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < entryCount; i++)
+        total += entries[i].exclusive;
+    qsort(entries, entryCount, sizeof(entries[0]), by_exclusive);
+    printf("%-20s %10s %14s %14s %7s %12s\n",
+        "name", "calls", "inclusive", "exclusive", "excl%", "excl usec");
+    for (int i = 0; i < entryCount; i++) {
+        entry_t *e = &entries[i];
+        printf("%-20s %10lu %14llu %14llu %6.2f%% %12.1f\n",
+            e->name, e->calls,
+            (unsigned long long) e->inclusive,
+            (unsigned long long) e->exclusive,
+            total ? 100.0 * e->exclusive / total : 0.0,
+            e->exclusive * 1e6 / avr->frequency);
+    }
+    printf("[-] %llu cycles in total, all marked code; ",
+        (unsigned long long) total);
+    printf("%llu cycles run overall\n", (unsigned long long) avr->cycle);
+    if (lostMarks || depth)
+        printf("[x] %lu unmatched exits, %d unfinished entries\n",
+            lostMarks, depth);
+}
+
+static char *read_file(const char *fname, size_t *len)
+{
+    FILE *fp = fopen(fname, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = malloc(*len + 1);
+    if (data && fread(data, 1, *len, fp) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <firmware.elf> <scenario.fs>\n", argv[0]);
+        return 1;
+    }
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[1], &firmware)) {
+        fprintf(stderr, "[x] Failed to load %s\n", argv[1]);
+        return 1;
+    }
+    scenario = read_file(argv[2], &scenarioLen);
+    if (!scenario) {
+        fprintf(stderr, "[x] Failed to read %s\n", argv[2]);
+        return 1;
+    }
+
+    avr_t *avr = avr_make_mcu_by_name("atmega328p");
+    if (!avr) {
+        fprintf(stderr, "[x] simavr doesn't know the atmega328p\n");
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    avr->frequency = 16000000;
+
+    avr_register_io_write(avr, GPIOR0_ADDR, on_mark, NULL);
+
+    /* We talk to the UART directly; not via its stdio dumping */
+    uint32_t flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+    avr_irq_t *uartIn = avr_io_getirq(
+        avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+    avr_irq_register_notify(
+        avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+        on_uart_output, NULL);
+    avr_irq_register_notify(
+        avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XON),
+        on_uart_xon, NULL);
+    avr_irq_register_notify(
+        avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XOFF),
+        on_uart_xoff, NULL);
+
+    while (!finished) {
+        int state = avr_run(avr);
+        if (state == cpu_Done || state == cpu_Crashed) {
+            fprintf(stderr, "\n[x] The firmware stopped running\n");
+            break;
+        }
+        if (!uartBusy && pendingPos < pendingLen)
+            avr_raise_irq(uartIn, (uint8_t) pending[pendingPos++]);
+    }
+    fprintf(stderr, "\n");
+    report(avr);
+    return finished ? 0 : 1;
+}
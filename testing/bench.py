@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""
+Usage:
+    bench.py [-r <runs>] [-l <label>] [-o <file>] <x86_forth_bench>
+
+Runs a fixed set of Forth benchmarks on the optimized x86 build
+(see 'make bench'), and reports - one JSON object per line - the
+ns per operation and the dispatches per second of each one.
+
+Each benchmark is a setup (definitions, data) and a timed part.
+We run the binary with both, and with the setup alone; the difference
+is what the timed part cost - without process startup and parsing.
+The fastest of <runs> executions is kept, for each of the two.
+
+The dispatches are those of the interpreter; a build with the JIT
+only counts the ones before its words were translated.
+
+Options:
+    -r <runs>   Executions per measurement [default: 5]
+    -l <label>  Tag each result with the build measured (e.g. "jit")
+    -o <file>   Also append the results to this file
+"""
+import sys
+import json
+import time
+import argparse
+import subprocess
+
+README_FIZZBUZZ = """
+: fizz DUP 3 MOD 0 = IF ." fizz " 1 ELSE 0 THEN SWAP ;
+: buzz DUP 5 MOD 0 = IF ." buzz " 1 ELSE 0 THEN SWAP ;
+: emitNum ROT ROT + 0 = if . ELSE DROP THEN ;
+: mainloop ." ( " fizz buzz emitNum ." ) " ;
+: fb 37 1 DO I mainloop LOOP ;
+"""
+
+SIEVE_SIZE = 8190
+SIEVE = """
+%d constant N
+N CELLS ALLOT constant flags
+: over SWAP DUP ROT ROT ;
+: flag CELLS flags + ;
+: clear N 0 DO 1 I flag ! LOOP ;
+: mark N 1 - over / 1 + 2 DO DUP I * flag 0 SWAP ! LOOP DROP ;
+: sieve clear N 2 DO I flag @ I DUP * N < * IF I mark THEN LOOP ;
+: count 0 N 2 DO I flag @ + LOOP ;
+""" % SIEVE_SIZE
+
+GCD = """
+: over SWAP DUP ROT ROT ;
+: gcd DUP IF SWAP over MOD RECURSE 0 THEN DROP ;
+"""
+
+# a*x*x + b*x + c - juggling the stack, and via locals
+QUAD = """
+: over SWAP DUP ROT ROT ;
+: quad >R ROT ROT over * ROT + * R> + ;
+: quadl {: x a b c :} a x * b + x * c + ;
+"""
+
+COMMAND_CODES = 32
+
+
+def dispatcher(step):
+    # A protocol handler: one OF per command code (0, step, 2*step...).
+    # Dense codes get a jump table; sparse ones, a chain of compares.
+    lines = [": cmd CASE"]
+    for i in range(0, COMMAND_CODES, 4):
+        lines.append(" ".join(
+            "%d OF %d ENDOF" % (c*step, c*10) for c in range(i, i+4)))
+    lines.append("0 SWAP ENDCASE ;")
+    return "\n".join(lines) + "\n"
+
+
+def dispatch_all(step):
+    return (": cmds 1000 0 DO %d 0 DO I %d * cmd DROP LOOP LOOP ;\n"
+            "cmds %d cmd .\n" % (COMMAND_CODES, step, (COMMAND_CODES-1)*step))
+
+
+COMPILED_WORDS = 2000
+
+
+def dictionary_heavy():
+    # Each word calls the very first one - so every lookup has
+    # to walk all the way down an ever-growing dictionary.
+    lines = [": w0 0 ;"]
+    for i in range(1, COMPILED_WORDS):
+        lines.append(": w%d %d DUP + w0 DROP ;" % (i, i))
+    return "\n".join(lines) + "\n"
+
+
+# name, setup, timed part, operations in the timed part, unit, expected
+BENCHMARKS = [
+    ("fizzbuzz", README_FIZZBUZZ,
+     ": fbs 100 0 DO fb LOOP ;\nfbs\n", 100*36, "number", "( buzz )"),
+    ("nested_do", ": nest 300 0 DO 300 0 DO I J + DROP LOOP LOOP ;\n",
+     ": nests 10 0 DO nest LOOP ;\nnests\n", 10*300*300, "iteration", None),
+    ("fib", ": fib DUP 1 > IF DUP 1 - fib SWAP 2 - fib + THEN ;\n",
+     "25 fib .\n", 2*121393 - 1, "call", " 75025"),
+    # Consecutive Fibonacci numbers: Euclid's worst case, 29 calls deep
+    ("gcd", GCD,
+     ": gcds 1000 0 DO 832040 514229 gcd DROP LOOP ;\ngcds 1071 462 gcd .\n",
+     1000*30, "call", " 21"),
+    ("case_table", dispatcher(1), dispatch_all(1),
+     1000*COMMAND_CODES, "dispatch", " 310"),
+    ("case_chain", dispatcher(100), dispatch_all(100),
+     1000*COMMAND_CODES, "dispatch", " 310"),
+    ("quad_stack", QUAD,
+     ": quads 10000 0 DO I 3 5 7 quad DROP LOOP ;\nquads 2 3 5 7 quad .\n",
+     10000, "call", " 29"),
+    ("quad_locals", QUAD,
+     ": quads 10000 0 DO I 3 5 7 quadl DROP LOOP ;\nquads 2 3 5 7 quadl .\n",
+     10000, "call", " 29"),
+    ("sieve", SIEVE,
+     ": sieves 5 0 DO sieve LOOP ;\nsieves count .\n", 5, "sieve", " 1027"),
+    ("dictionary_compile", "",
+     dictionary_heavy(), COMPILED_WORDS, "definition", None),
+    ("print_heavy", ": pr 2000 0 DO I . LOOP ;\n",
+     ": prs 10 0 DO pr LOOP ;\nprs\n", 10*2000, "number", " 1999"),
+]
+
+
+def run(binary, script):
+    start = time.perf_counter()
+    proc = subprocess.run(
+        [binary], input=script.encode(),
+        stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    elapsed = time.perf_counter() - start
+    dispatches = 0
+    for line in proc.stderr.decode(errors='replace').splitlines():
+        if line.startswith("dispatches "):
+            dispatches = int(line.split()[1])
+    return elapsed, dispatches, proc.stdout.decode(errors='replace')
+
+
+def fastest(binary, script, runs):
+    results = [run(binary, script) for _ in range(runs)]
+    return min(results, key=lambda r: r[0])
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("-r", dest="runs", type=int, default=5)
+    parser.add_argument("-l", dest="label")
+    parser.add_argument("-o", dest="output")
+    parser.add_argument("binary")
+    args = parser.parse_args()
+
+    failed = False
+    results = []
+    for name, setup, timed, ops, unit, expected in BENCHMARKS:
+        base_time, base_dispatches, _ = fastest(args.binary, setup, args.runs)
+        full_time, full_dispatches, output = fastest(
+            args.binary, setup + timed, args.runs)
+        if "[x]" in output or (expected and expected not in output):
+            print("[x] Benchmark '%s' did not run correctly" % name,
+                  file=sys.stderr)
+            failed = True
+            continue
+        elapsed = max(full_time - base_time, 1e-9)
+        dispatches = full_dispatches - base_dispatches
+        result = {
+            "name": name,
+            "ops": ops,
+            "unit": unit,
+            "ns_per_op": round(elapsed * 1e9 / ops, 1),
+            "dispatches": dispatches,
+            "dispatches_per_sec": round(dispatches / elapsed),
+        }
+        if args.label:
+            result["build"] = args.label
+        results.append(result)
+        print(json.dumps(result))
+        sys.stdout.flush()
+
+    if args.output:
+        with open(args.output, "a") as f:
+            for result in results:
+                f.write(json.dumps(result) + "\n")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,74 @@
+\ The corners of the JIT (see src/jit.h). 'make test-jit' runs this with
+\ every word translated on its first call, and with none of them translated;
+\ and both must print exactly the same.
+RESET
+." Arithmetic... " : ar 7 3 - 5 * 2 / 9 + ; ar . -7 2 / . -7 2 MOD .
+." Wrapping around... " : big $7FFFFFFF 1 + ; big .
+: neg 0 SWAP - ; big neg .
+." Comparisons... " : cmp DUP ROT DUP ROT < . = . ; 1 2 cmp 2 2 cmp
+." Shifts by 31, 32, 33... " : sh 1 SWAP LSHIFT U. ; 31 sh 32 sh 33 sh
+." ...and right... " : shr -1 SWAP RSHIFT U. ; 1 shr 32 shr 0 shr
+." Constant shifts... " : csh 1 31 LSHIFT U. 1 32 LSHIFT . -1 40 RSHIFT . ;
+csh
+." Bits... " : bits 12 10 AND 3 OR 6 XOR INVERT ; bits .
+." Stack shuffles... " : sf 1 2 3 ROT SWAP DUP ; sf . . . .
+." Deep shuffles... " : dp 1 2 3 4 5 6 ROT ROT DROP SWAP DUP ; dp .S
+RESET
+." Takes from below... " : tb + + ; 1 2 3 tb .
+." ...but not enough there... " 5 tb
+." ...leaves as before... " .S
+." Division by zero, deep inside... " : dz 0 / ; : dzz 1 2 3 dz 4 ;
+10 dzz
+." ...leaves the stack as before... " .S
+RESET
+." MOD by zero in a loop... " : mz 3 0 DO 10 I MOD . LOOP ; mz
+." ...leaves... " .S
+RESET
+." A variable on the stack... " 5 variable vv : at1 @ 1 + ; vv at1 .
+." Variables... " : inc vv @ 1 + vv ! ; inc inc vv @ .
+." Arrays... " 8 CELLS ALLOT constant arr
+: fill 8 0 DO I I * arr I CELLS + ! LOOP ;
+: sum 0 8 0 DO arr I CELLS + @ + LOOP ; fill sum .
+." BASE... " : hx 16 BASE ! 255 . 10 BASE ! ; hx BASE @ .
+RESET
+." Nested loops... " : nl 3 0 DO 4 1 DO J I * . LOOP LOOP ; nl
+." Loops in calls in loops... " : in4 4 0 DO I . LOOP ;
+: out2 2 0 DO in4 LOOP ; out2
+." Loop runs at least once... " : once 0 5 DO I . LOOP ; once
+." Big loop... " : bl 0 SWAP 0 DO I + LOOP ; 100000 bl .
+RESET
+: in4 4 0 DO I . LOOP ;
+." IF/ELSE... " : sgn DUP 0 < IF DROP -1 ELSE 0 > THEN ;
+5 sgn . -5 sgn . 0 sgn .
+." IF, THEN... " : ab DUP 0 < IF 0 SWAP - THEN ; -3 ab . 3 ab .
+." IF with calls... " : pk IF in4 ELSE sgn . THEN ; 1 pk 7 0 pk
+." IF in a loop... " : ev 6 0 DO I 2 MOD IF ." odd " ELSE I . THEN LOOP ;
+ev
+." From an interpreted IF... " : caller IF 3 ab . 7 ELSE 8 THEN . ;
+1 caller 0 caller
+RESET
+: ab DUP 0 < IF 0 SWAP - THEN ; : neg 0 SWAP - ;
+." Return stack... " : rs 10 >R 20 >R R@ . R> R> + ; rs .
+." ...across a loop... " : rl 7 >R 3 0 DO I R@ * . LOOP R> DROP ; rl
+." Printing... " : pr 42 . -1 U. 5 U.R 7 . CR ." done " ; pr
+." Strings... " : hi ." hello " ." world " ; hi
+." Execution tokens... " : xt ['] ab EXECUTE ; -9 xt .
+." Deferred words... " DEFER op : twice op op ; ' neg IS op 4 twice .
+RESET
+." Recursion... " : fact DUP 1 > IF DUP 1 - RECURSE * THEN ; 10 fact .
+." Callers of recursion... " : f5 5 fact ; f5 .
+." ...and ELSE... " : r2 DUP IF DUP 1 - RECURSE + ELSE DROP 0 THEN ;
+4 r2 .
+." Locals... " : lsum {: a b :} a b + ; 3 4 lsum .
+." CASE... " : cs CASE 1 OF 10 ENDOF 2 OF 20 ENDOF 0 SWAP ENDCASE ;
+2 cs .
+RESET
+." TRACE... " : tr 1 2 + ; TRACE ON tr DROP TRACE OFF .TRACE
+\ (How many beats we get, depends on how fast we are; see 'make test-jit')
+." Every 1ms, while looping... " 0 variable beats
+: beat beats @ 1 + beats ! ; : spin 7 SWAP 0 DO I DROP LOOP ;
+1 EVERY beat 20000 spin 0 EVERY beat .
+." Redefined words... " : two 2 ; : four two two + ; four .
+: two 3 ; four .
+." RESET forgets them all... " RESET
+: two 2 ; two .
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""
+Usage:
+    scaling.py [-q] [-r <runs>] [-o <prefix>] <x86_forth_scale>
+
+Synthesizes ever-bigger Forth programs, and measures how the cost of
+compiling, looking up and executing grows with their size:
+
+    compile_words   defining words, after N of them  (per word)
+    lookup          finding the oldest of N words    (per lookup)
+    call_chain      calling through N nested words   (per call)
+    long_body       compiling a word of N nodes      (per node)
+    run_long_body   running a word of N nodes        (per node)
+    dots            ".S" of a stack N deep           (per stack item)
+
+Anything that is not flat in the per-item column is super-linear.
+As in bench.py, each measurement runs the binary with and without
+the measured part, and keeps the difference of the fastest runs.
+The measured parts repeat their work enough times to stand well
+above the noise of process startup (which includes clearing the Pool).
+
+The results go to stdout (CSV), to <prefix>.csv - and if matplotlib
+is around, they are also plotted in <prefix>.png.
+
+Options:
+    -q           Quick: only the smaller sizes
+    -r <runs>    Executions per measurement [default: 5]
+    -o <prefix>  Where to store the results [default: testing/scaling]
+"""
+import sys
+import time
+import argparse
+import subprocess
+
+# How much work each measured part does (roughly, in list steps)
+WORK = 4000000
+COMPILED_WORDS = 100000
+
+SIZES = {
+    "compile_words": [1000, 10000, 30000, 100000],
+    "lookup": [1000, 10000, 30000, 100000],
+    "call_chain": [100, 1000, 3000, 10000],
+    "long_body": [100, 1000, 10000, 50000],
+    "run_long_body": [100, 1000, 10000, 50000],
+    "dots": [100, 1000, 3000, 6000],
+}
+
+
+def words(n, prefix="w"):
+    return "".join(": %s%d %d ;\n" % (prefix, i, i) for i in range(n))
+
+
+def chain(n):
+    lines = [": c0 1 ;"]
+    lines += [": c%d c%d ;" % (i, i-1) for i in range(1, n)]
+    return "\n".join(lines) + "\n"
+
+
+def long_body(n, name="long"):
+    # Bodies span as many lines as they need; we keep each one short
+    # (the engine's MAX_LINE_LENGTH is 80).
+    lines = [": " + name]
+    pairs = n // 2
+    while pairs > 0:
+        count = min(pairs, 10)
+        lines.append(" ".join(["1 DROP"] * count))
+        pairs -= count
+    lines.append(";")
+    return "\n".join(lines) + "\n"
+
+
+def repeat(line, times):
+    return (line + "\n") * times
+
+
+# For each phase: (setup, measured part, items in the measured part)
+def scripts(phase, n):
+    if phase == "compile_words":
+        return words(n), words(COMPILED_WORDS, "v"), COMPILED_WORDS
+    if phase == "lookup":
+        lookups = max(100, WORK // n)
+        return words(n), repeat("w0 DROP", lookups), lookups
+    if phase == "call_chain":
+        calls = max(5, WORK // n)
+        return chain(n), repeat("c%d DROP" % (n-1), calls), n * calls
+    if phase == "long_body":
+        bodies = max(1, WORK // 20 // n)
+        measured = "".join(long_body(n, "long%d" % i) for i in range(bodies))
+        return "", measured, n * bodies
+    if phase == "run_long_body":
+        runs = max(5, WORK // n)
+        return long_body(n), repeat("long", runs), n * runs
+    if phase == "dots":
+        setup = ": fill 0 DO I LOOP ;\n%d fill\n" % n
+        dumps = max(1, WORK // 20 // n)
+        return setup, repeat(".S", dumps), n * dumps
+    raise ValueError(phase)
+
+
+def run(binary, script):
+    start = time.perf_counter()
+    proc = subprocess.run(
+        [binary], input=script.encode(),
+        stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    elapsed = time.perf_counter() - start
+    return elapsed, proc.stdout.decode(errors='replace')
+
+
+def fastest(binary, script, runs):
+    best = None
+    for _ in range(runs):
+        elapsed, output = run(binary, script)
+        if "[x]" in output or "Halting" in output:
+            return None
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def plot(results, prefix):
+    try:
+        import matplotlib
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print("[-] No matplotlib - skipping the plot", file=sys.stderr)
+        return
+    phases = list(SIZES)
+    fig, axes = plt.subplots(2, 3, figsize=(15, 8))
+    for ax, phase in zip(axes.flat, phases):
+        points = [(n, ns) for p, n, _, ns in results if p == phase]
+        if not points:
+            continue
+        ax.loglog([n for n, _ in points], [ns for _, ns in points], "o-")
+        ax.set_title(phase)
+        ax.set_xlabel("size")
+        ax.set_ylabel("ns per item")
+        ax.grid(True, which="both", alpha=0.3)
+    fig.tight_layout()
+    fig.savefig(prefix + ".png")
+    print("[-] Plotted in %s.png" % prefix, file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("-q", dest="quick", action="store_true")
+    parser.add_argument("-r", dest="runs", type=int, default=5)
+    parser.add_argument("-o", dest="prefix", default="testing/scaling")
+    parser.add_argument("binary")
+    args = parser.parse_args()
+
+    failed = False
+    results = []
+    print("phase,size,seconds,ns_per_item")
+    for phase, sizes in SIZES.items():
+        if args.quick:
+            sizes = sizes[:2]
+        for n in sizes:
+            setup, measured, items = scripts(phase, n)
+            base = fastest(args.binary, setup, args.runs)
+            full = fastest(args.binary, setup + measured, args.runs)
+            if base is None or full is None:
+                print("[x] %s failed at size %d (Pool too small?)" %
+                      (phase, n), file=sys.stderr)
+                failed = True
+                break
+            elapsed = max(full - base, 0.0)
+            ns = elapsed * 1e9 / items
+            results.append((phase, n, elapsed, ns))
+            print("%s,%d,%.6f,%.1f" % (phase, n, elapsed, ns))
+            sys.stdout.flush()
+
+    with open(args.prefix + ".csv", "w") as f:
+        f.write("phase,size,seconds,ns_per_item\n")
+        for phase, n, elapsed, ns in results:
+            f.write("%s,%d,%.6f,%.1f\n" % (phase, n, elapsed, ns))
+    plot(results, args.prefix)
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,50 +1,75 @@
 #!/usr/bin/env python3
 """
 Usage:
-    test_forth.py -p <port> -i <file>
+    test_forth.py -p <port> -i <file> [-t <secs>]
     test_forth.py (-h | --help)
+
+Options:
+    -t <secs>   Give up if the device stays silent this long [default: 10]
 """
-import os
 import sys
 import time
 import serial
 
 import docopt
 
+# After each prompt, the firmware sends an XON - granting us
+# the credit to send it one more line (see getline.cpp).
+XON = b'\x11'
+
+
+def echo(data):
+    sys.stdout.write(data.decode(errors='replace'))
+    sys.stdout.flush()
+
+
+def wait_for_credit(ser, timeout):
+    ser.timeout = timeout
+    while True:
+        data = ser.read(max(1, ser.in_waiting))
+        if not data:
+            print("\n[x] Timeout waiting for the device's prompt")
+            sys.exit(1)
+        before, xon, after = data.partition(XON)
+        echo(before + after)
+        if xon:
+            return
+
 
-def send_cmd_wait_OK(ser, line):
-    ser.timeout = 0.1
-    resp = ''
+def sync(ser, timeout):
+    # Start from an idle prompt, with exactly one credit granted to us;
+    # drain whatever the device said before (and in response to) this.
+    ser.reset_input_buffer()
+    ser.write('\rreset\r'.encode())
+    wait_for_credit(ser, timeout)
+    ser.timeout = 0.5
     while True:
-        it = time.time()
-        data = ser.read().decode()
-        resp += data
-        sys.stdout.write(data)
-        sys.stdout.flush()
-        if '\n> ' in resp:
+        data = ser.read(max(1, ser.in_waiting))
+        if not data:
             break
-        # if time.time() - it > 1:
-        #     print("[x] Timeout waiting for OK")
-        #     sys.exit(1)
-    time.sleep(0.1)
+        echo(data.replace(XON, b''))
 
+
+def send_line(ser, line):
     line = line.strip()
-    for c in line:
-        time.sleep(0.01)
-        ser.write(c.encode())
-        print(c, end='')
-        sys.stdout.flush()
-    ser.write('\r'.encode())
+    ser.write((line + '\r').encode())
+    print(line, end='')
+    sys.stdout.flush()
 
 
 def main(args):
     ser = serial.Serial(args.get('<port>'), 115200)
-    ser.write('\rreset\r'.encode())
-    file_input = args.get('<file>')
-    for line in open(file_input).readlines():
-        send_cmd_wait_OK(ser, line)
+    timeout = float(args.get('-t'))
+    sync(ser, timeout)
+    lines = open(args.get('<file>')).readlines()
+    start = time.time()
+    for line in lines:
+        send_line(ser, line)
+        wait_for_credit(ser, timeout)
         print("\n==> ", end='')
-    send_cmd_wait_OK(ser, "\r")
+    elapsed = time.time() - start
+    print("\n[-] Sent %d lines in %.3f sec: %.1f lines/sec" % (
+        len(lines), elapsed, len(lines) / elapsed))
 
 
 if __name__ == "__main__":
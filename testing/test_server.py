@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+"""
+Usage:
+    test_server.py [-n <sessions>] [-e <echoes>] <forth_server>
+
+Starts the REPL server on a Unix domain socket, and opens <sessions>
+connections to it - each defining its own version of the same word,
+so we can check that every session sees only its own. Then measures
+the echo latency (the round trip of a line, to its " OK") of one
+session, while all the others sit idle; and the server's memory per
+session (its PSS, before and after they connect).
+
+Also sends them bad addresses and execution tokens ("123456789 @"),
+which must fail in their session only; and fills one session's Pool,
+which must be an error for that session only.
+
+Then does it all again; but with a library of words that the server
+compiles once, and shares with all sessions (-l). Each session uses
+it - and writes to its variables and arrays, which must stay its own.
+
+Options:
+    -n <sessions>  How many sessions to open [default: 500]
+    -e <echoes>    How many round trips to time [default: 2000]
+"""
+import os
+import sys
+import time
+import socket
+import argparse
+import tempfile
+import subprocess
+
+
+def rss_kb(pid):
+    # Each session maps the library's pages; its RSS counts them once per
+    # mapping - its PSS, once per page.
+    try:
+        with open("/proc/%d/smaps_rollup" % pid) as f:
+            for line in f:
+                if line.startswith("Pss:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    with open("/proc/%d/status" % pid) as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+def read_until_prompt(sock):
+    data = b""
+    while not data.endswith(b"> "):
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise EOFError("the server closed the session")
+        data += chunk
+    return data.decode(errors='replace')
+
+
+def talk(sock, line):
+    sock.sendall(line.encode() + b"\n")
+    return read_until_prompt(sock)
+
+
+LIBRARY_WORDS = 300
+LIBRARY = "".join(": lib%d %d ;\n" % (i, i) for i in range(LIBRARY_WORDS)) + """
+0 variable hits
+16 CELLS ALLOT constant slots
+: hit hits @ 1 + hits ! ;
+: hit-n 0 DO hit LOOP ;
+: slot CELLS slots + ;
+"""
+
+
+def serve(binary, sessions, echoes, library=None):
+    """Returns whether all went well"""
+    tmpdir = tempfile.mkdtemp()
+    path = os.path.join(tmpdir, "forth.sock")
+    cmd = [binary, path]
+    if library:
+        libpath = os.path.join(tmpdir, "library.fs")
+        with open(libpath, "w") as f:
+            f.write(library)
+        cmd = [binary, "-l", libpath, path]
+    server = subprocess.Popen(cmd, stderr=subprocess.PIPE)
+    failed = False
+    try:
+        for _ in range(2 if library else 1):
+            print(server.stderr.readline().decode().rstrip())
+        baseline = rss_kb(server.pid)
+
+        socks = []
+        for i in range(sessions):
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(path)
+            read_until_prompt(sock)
+            socks.append(sock)
+        for i, sock in enumerate(socks):
+            talk(sock, ": me %d ;" % i)
+            if library:
+                # Each writes to the library's data; a different amount
+                talk(sock, "%d hit-n me 3 slot !" % (i % 7 + 1))
+        for i, sock in enumerate(socks):
+            answer = talk(sock, "me 1 + .")
+            expected = " %d OK" % (i + 1)
+            if library:
+                answer = talk(sock, "me lib299 + . hits @ . 3 slot @ .")
+                expected = " %d %d %d OK" % (i + 299, i % 7 + 1, i)
+            if expected not in answer:
+                print("[x] Session %d answered: %r" % (i, answer))
+                failed = True
+        per_session = (rss_kb(server.pid) - baseline) * 1024 / sessions
+        print("[-] %d sessions, each with its own dictionary: %.0f bytes each"
+              % (sessions, per_session))
+
+        # One busy session, among the idle ones
+        sock = socks[0]
+        rtts = []
+        for _ in range(echoes):
+            start = time.perf_counter()
+            answer = talk(sock, "1 DROP")
+            rtts.append(time.perf_counter() - start)
+            if "OK" not in answer:
+                print("[x] Echo answered: %r" % answer)
+                failed = True
+                break
+        rtts.sort()
+        print("[-] Echo latency: median %.1f us, 99th percentile %.1f us"
+              % (rtts[len(rtts)//2] * 1e6, rtts[len(rtts)*99//100] * 1e6))
+
+        # Errors stay in their session
+        if "[x]" not in talk(socks[1], "nosuchword") or \
+                " 3 OK" not in talk(socks[2], "me 1 + ."):
+            print("[x] An error leaked across sessions")
+            failed = True
+
+        # ...and so do bad addresses and execution tokens - even in
+        # words the JIT translated (they run a few times first)
+        talk(socks[1], ": peek @ ; : poke ! ; 0 variable v")
+        for _ in range(3):
+            talk(socks[1], "v peek DROP 7 v poke")
+        for hostile in ("100 EXECUTE", "123456789 @", "7 -4 !",
+                        "65 123456789 C!", "123456789 10 TYPE",
+                        "123456789 peek", "7 -4 poke"):
+            if "[x]" not in talk(socks[1], hostile):
+                print("[x] A bad address went through: %r" % hostile)
+                failed = True
+        if " 7 2 OK" not in talk(socks[1], "v peek . me 1 + .") or \
+                "0255 OK" not in talk(socks[1], "255 <# # # # # #> TYPE") or \
+                " 4 OK" not in talk(socks[3], "me 1 + ."):
+            print("[x] A bad address hurt the sessions")
+            failed = True
+
+        # A session that fills its Pool gets an error; the server, and the
+        # other sessions, carry on - and RESET gives it room again
+        full = False
+        for i in range(5000):
+            if "[x]" in talk(socks[4], ": fill%d %d %d + ;" % (i, i, i)):
+                full = True
+                break
+        if not full or " 6 OK" not in talk(socks[5], "me 1 + .") or \
+                "OK" not in talk(socks[4], "RESET") or \
+                " 3 OK" not in talk(socks[4], ": me 3 ; me ."):
+            print("[x] A full Pool hurt the sessions")
+            failed = True
+
+        for sock in socks:
+            sock.close()
+    finally:
+        server.kill()
+        server.wait()
+        for f in os.listdir(tmpdir):
+            os.unlink(os.path.join(tmpdir, f))
+        os.rmdir(tmpdir)
+    return not failed
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("-n", dest="sessions", type=int, default=500)
+    parser.add_argument("-e", dest="echoes", type=int, default=2000)
+    parser.add_argument("binary")
+    args = parser.parse_args()
+
+    ok = serve(args.binary, args.sessions, args.echoes)
+    print("[-] Now with a library of %d words, shared by all sessions"
+          % LIBRARY_WORDS)
+    ok = serve(args.binary, args.sessions, args.echoes, LIBRARY) and ok
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,49 @@
+\ The corners of the stack-effect verification (see src/verify.cpp).
+\ 'make test-verify' runs this through the x86 build, and through one
+\ built with -D NO_VERIFY (where all the primitives check the stack);
+\ both must print the same.
+." Arithmetic... " : ar 7 3 - 5 * 2 / 9 + ; ar . 1 ar + .
+." Comparisons... " : cmp DUP ROT DUP ROT < . = . ; 1 2 cmp 2 2 cmp
+." Shifts and bits... " : sh 1 SWAP LSHIFT -1 ROT RSHIFT XOR INVERT ;
+3 4 sh U. 32 32 sh U.
+." Shuffles... " : sf 1 2 3 ROT SWAP DUP DROP ; sf . . .
+." Takes from below... " : tb + + ; 1 2 3 tb .
+." ...not enough there... " 1 2 tb
+." ...nothing at all... " .S tb .S
+." ...from a caller that has them... " : tb2 tb 10 * ; 1 2 3 tb2 .
+." ...and from one that doesn't... " : tb3 5 tb ; 7 tb3 .S
+." A variable... " 5 variable vv : inc vv @ 1 + vv ! ; inc inc vv @ .
+." ...passed in... " : incr DUP @ 1 + SWAP ! ; vv incr vv @ .
+." ...and shuffled... " : sw SWAP ! ; vv 42 sw vv @ .
+." ...its address, in arithmetic... " : va vv 1 CELLS + 1 CELLS - @ ; va .
+." A constant... " 10 constant ten : tens ten * ; 3 tens .
+." Loops... " : sum 0 SWAP 0 DO I + LOOP ; 10 sum .
+." Nested loops... " : nl 3 0 DO 4 1 DO J I * . LOOP LOOP ; nl
+." A loop that grows the stack... " : gr 3 0 DO I LOOP ; gr . . .
+." IF/ELSE... " : sgn DUP 0 < IF DROP -1 ELSE 0 > THEN ;
+5 sgn . -5 sgn . 0 sgn .
+." IF arms that differ... " : arms IF 1 2 ELSE 3 THEN ; 1 arms . . 0 arms .
+." IF, THEN... " : ab DUP 0 < IF 0 SWAP - THEN ; -3 ab . 3 ab .
+." ...inside an IF of the prompt... " 1 IF -4 ab . 4 ab . THEN
+." ...and of a caller... " : outer IF -7 ab ELSE 8 ab THEN . ;
+1 outer 0 outer
+." Return stack... " : rs 10 >R 20 >R R@ . R> R> + ; rs .
+." Recursion... " : fact DUP 1 > IF DUP 1 - RECURSE * THEN ; 6 fact .
+." Calls to it... " : f5 5 fact ; f5 .
+." Locals... " : lsum {: a b :} a b + ; 3 4 lsum . : ls2 lsum 2 * ; 1 2 ls2 .
+." Execution tokens... " : xt ['] sgn EXECUTE ; -9 xt .
+." Redefined words... " : two 2 ; : four two two + ; four .
+: two 3 ; four . two .
+." Stack overflow... " : deep 0 DO I LOOP ; : dropn 0 DO DROP LOOP ; 300 deep
+." ...leaves it full... " DROP DROP 254 dropn .S
+." Division by zero, deep inside... " : dz 0 / ; : dzz 1 2 3 dz 4 ;
+10 dzz .S
+DROP DROP DROP
+." Unpaired THEN... " : bad1 1 THEN ;
+." ...ELSE... " : bad2 ELSE 2 ;
+." ...LOOP... " : bad3 LOOP ;
+." ...IF... " : bad4 IF 1 ;
+." ...DO... " : bad5 10 0 DO I . ;
+." ...none of them defined... " WORDS
+\ (For the periodic words' check, in 'make test-verify')
+: spin 0 DO I DROP LOOP ;